@@ -0,0 +1,524 @@
+#include "bcencoder.h"
+
+#include "threadpool.h"
+#include "tracer.h"
+
+#include <algorithm>
+#include <array>
+#include <climits>
+#include <cmath>
+#include <cstring>
+
+namespace {
+// Rows of blocks below this are cheaper to do on one thread than to hand out
+const uint32_t BLOCK_ROWS_PER_TASK = 4;
+
+// Interpolation weights of BC7 4 bit indices, in 64ths
+const int BC7_WEIGHTS[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+// Weight of color1 for each BC1 index in the four color mode
+const float BC1_WEIGHTS[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+
+using Texels = std::array<std::array<uint8_t, 4>, 16>;
+using Color = std::array<float, 4>;
+using Endpoint = std::array<int, 4>;
+
+int passCount(BcQuality quality)
+{
+    switch (quality) {
+    case BcQuality::Fast:
+        return 1;
+    case BcQuality::Normal:
+        return 2;
+    case BcQuality::High:
+        return 4;
+    }
+    return 1;
+}
+
+// Blocks on the right and bottom edge repeat the last column and row
+void loadBlock(const uint8_t *pixels,
+               const MipLevel &level,
+               uint32_t blockX,
+               uint32_t blockY,
+               Texels &texels)
+{
+    for (uint32_t y = 0; y < 4; y++) {
+        const uint32_t row = std::min(blockY * 4 + y, level.height - 1);
+        for (uint32_t x = 0; x < 4; x++) {
+            const uint32_t column = std::min(blockX * 4 + x, level.width - 1);
+            memcpy(texels[y * 4 + x].data(), pixels + (size_t(row) * level.width + column) * 4, 4);
+        }
+    }
+}
+
+// Channels past the fitted ones are left opaque
+void boundingBox(const Texels &texels, int channels, Color endpoints[2])
+{
+    endpoints[0].fill(255.0f);
+    endpoints[1].fill(0.0f);
+    for (const auto &texel : texels) {
+        for (int c = 0; c < channels; c++) {
+            endpoints[0][c] = std::min(endpoints[0][c], float(texel[c]));
+            endpoints[1][c] = std::max(endpoints[1][c], float(texel[c]));
+        }
+    }
+
+    // Pulling the corners in by a sixteenth favors the bulk of the block over its extremes
+    for (int c = 0; c < channels; c++) {
+        const float inset = (endpoints[1][c] - endpoints[0][c]) / 16.0f;
+        endpoints[0][c] += inset;
+        endpoints[1][c] -= inset;
+    }
+    for (int c = channels; c < 4; c++) {
+        endpoints[1][c] = 255.0f;
+    }
+}
+
+// The extremes of the texels along the principal axis of their covariance, found by power
+// iteration starting from the channel that varies most
+void principalAxis(const Texels &texels, int channels, Color endpoints[2])
+{
+    Color mean{};
+    for (const auto &texel : texels) {
+        for (int c = 0; c < channels; c++) {
+            mean[c] += texel[c];
+        }
+    }
+    for (int c = 0; c < channels; c++) {
+        mean[c] /= 16.0f;
+    }
+
+    float covariance[4][4] = {};
+    for (const auto &texel : texels) {
+        for (int i = 0; i < channels; i++) {
+            for (int j = 0; j < channels; j++) {
+                covariance[i][j] += (texel[i] - mean[i]) * (texel[j] - mean[j]);
+            }
+        }
+    }
+
+    int start = 0;
+    for (int c = 1; c < channels; c++) {
+        if (covariance[c][c] > covariance[start][start])
+            start = c;
+    }
+    Color axis{};
+    for (int c = 0; c < channels; c++) {
+        axis[c] = covariance[start][c];
+    }
+
+    for (int iteration = 0; iteration < 8; iteration++) {
+        Color next{};
+        float largest = 0.0f;
+        for (int i = 0; i < channels; i++) {
+            for (int j = 0; j < channels; j++) {
+                next[i] += covariance[i][j] * axis[j];
+            }
+            largest = std::max(largest, std::abs(next[i]));
+        }
+        if (largest < 1e-6f)
+            break;
+        for (int c = 0; c < channels; c++) {
+            axis[c] = next[c] / largest;
+        }
+    }
+
+    float lengthSquared = 0.0f;
+    for (int c = 0; c < channels; c++) {
+        lengthSquared += axis[c] * axis[c];
+    }
+
+    float low = 0.0f;
+    float high = 0.0f;
+    if (lengthSquared > 1e-6f) {
+        for (const auto &texel : texels) {
+            float t = 0.0f;
+            for (int c = 0; c < channels; c++) {
+                t += (texel[c] - mean[c]) * axis[c];
+            }
+            low = std::min(low, t / lengthSquared);
+            high = std::max(high, t / lengthSquared);
+        }
+    }
+
+    for (int c = 0; c < 4; c++) {
+        if (c < channels) {
+            endpoints[0][c] = std::clamp(mean[c] + low * axis[c], 0.0f, 255.0f);
+            endpoints[1][c] = std::clamp(mean[c] + high * axis[c], 0.0f, 255.0f);
+        } else {
+            endpoints[0][c] = endpoints[1][c] = 255.0f;
+        }
+    }
+}
+
+// The endpoints that best reproduce the texels when texel i is endpoints[0] blended with
+// weights[i] of endpoints[1]. False when the weights leave them undetermined.
+bool leastSquares(const Texels &texels, int channels, const float weights[16], Color endpoints[2])
+{
+    float aa = 0.0f;
+    float ab = 0.0f;
+    float bb = 0.0f;
+    Color ax{};
+    Color bx{};
+    for (int i = 0; i < 16; i++) {
+        const float b = weights[i];
+        const float a = 1.0f - b;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int c = 0; c < channels; c++) {
+            ax[c] += a * texels[i][c];
+            bx[c] += b * texels[i][c];
+        }
+    }
+
+    const float determinant = aa * bb - ab * ab;
+    if (std::abs(determinant) < 1e-6f)
+        return false;
+
+    for (int c = 0; c < channels; c++) {
+        endpoints[0][c] = std::clamp((bb * ax[c] - ab * bx[c]) / determinant, 0.0f, 255.0f);
+        endpoints[1][c] = std::clamp((aa * bx[c] - ab * ax[c]) / determinant, 0.0f, 255.0f);
+    }
+    return true;
+}
+
+int squaredError(const std::array<uint8_t, 4> &texel, const Endpoint &color, int channels)
+{
+    int error = 0;
+    for (int c = 0; c < channels; c++) {
+        const int d = texel[c] - color[c];
+        error += d * d;
+    }
+    return error;
+}
+
+uint16_t toRgb565(const Color &color)
+{
+    const auto r = static_cast<uint16_t>(std::lround(color[0] * 31.0f / 255.0f));
+    const auto g = static_cast<uint16_t>(std::lround(color[1] * 63.0f / 255.0f));
+    const auto b = static_cast<uint16_t>(std::lround(color[2] * 31.0f / 255.0f));
+    return static_cast<uint16_t>(r << 11 | g << 5 | b);
+}
+
+Endpoint fromRgb565(uint16_t value)
+{
+    const int r = value >> 11;
+    const int g = (value >> 5) & 63;
+    const int b = value & 31;
+    return {r << 3 | r >> 2, g << 2 | g >> 4, b << 3 | b >> 2, 255};
+}
+
+// Picks the nearest palette entry for every texel, returns the squared error
+int fitBc1(const Texels &texels, uint16_t color0, uint16_t color1, uint32_t &indices)
+{
+    const Endpoint c0 = fromRgb565(color0);
+    const Endpoint c1 = fromRgb565(color1);
+    Endpoint palette[4] = {c0, c1, {}, {}};
+    for (int c = 0; c < 3; c++) {
+        palette[2][c] = (2 * c0[c] + c1[c]) / 3;
+        palette[3][c] = (c0[c] + 2 * c1[c]) / 3;
+    }
+
+    // Equal colors select the three color mode, where index 3 is black
+    const int candidates = color0 == color1 ? 1 : 4;
+
+    int error = 0;
+    indices = 0;
+    for (int i = 0; i < 16; i++) {
+        int best = 0;
+        int bestError = INT_MAX;
+        for (int k = 0; k < candidates; k++) {
+            const int e = squaredError(texels[i], palette[k], 3);
+            if (e < bestError) {
+                best = k;
+                bestError = e;
+            }
+        }
+        indices |= uint32_t(best) << (2 * i);
+        error += bestError;
+    }
+    return error;
+}
+
+void encodeBc1Block(const Texels &texels, BcQuality quality, uint8_t *out)
+{
+    Color endpoints[2];
+    if (quality == BcQuality::Fast) {
+        boundingBox(texels, 3, endpoints);
+    } else {
+        principalAxis(texels, 3, endpoints);
+    }
+
+    uint16_t bestColor0 = 0;
+    uint16_t bestColor1 = 0;
+    uint32_t bestIndices = 0;
+    int bestError = INT_MAX;
+    for (int pass = 0; pass < passCount(quality); pass++) {
+        // color0 above color1 selects the four color mode
+        uint16_t color0 = toRgb565(endpoints[0]);
+        uint16_t color1 = toRgb565(endpoints[1]);
+        if (color0 < color1) {
+            std::swap(color0, color1);
+            std::swap(endpoints[0], endpoints[1]);
+        }
+
+        uint32_t indices;
+        const int error = fitBc1(texels, color0, color1, indices);
+        if (error < bestError) {
+            bestColor0 = color0;
+            bestColor1 = color1;
+            bestIndices = indices;
+            bestError = error;
+        }
+        if (error == 0)
+            break;
+
+        float weights[16];
+        for (int i = 0; i < 16; i++) {
+            weights[i] = BC1_WEIGHTS[(indices >> (2 * i)) & 3];
+        }
+        if (!leastSquares(texels, 3, weights, endpoints))
+            break;
+    }
+
+    out[0] = static_cast<uint8_t>(bestColor0);
+    out[1] = static_cast<uint8_t>(bestColor0 >> 8);
+    out[2] = static_cast<uint8_t>(bestColor1);
+    out[3] = static_cast<uint8_t>(bestColor1 >> 8);
+    for (int i = 0; i < 4; i++) {
+        out[4 + i] = static_cast<uint8_t>(bestIndices >> (8 * i));
+    }
+}
+
+// 7 bits per channel plus a p-bit shared by the channels of the endpoint, returns the
+// squared quantization error
+float quantizeBc7(const Color &color, int pBit, Endpoint &endpoint)
+{
+    float error = 0.0f;
+    for (int c = 0; c < 4; c++) {
+        const long q = std::clamp(std::lround((color[c] - pBit) / 2.0f), 0L, 127L);
+        endpoint[c] = static_cast<int>(q) * 2 + pBit;
+        const float d = endpoint[c] - color[c];
+        error += d * d;
+    }
+    return error;
+}
+
+// Picks an index for every texel, returns the squared error. The other qualities only look
+// at the entries next to the texel's projection onto the line.
+int fitBc7(const Texels &texels, const Endpoint endpoints[2], bool exhaustive, uint8_t indices[16])
+{
+    Endpoint palette[16];
+    for (int k = 0; k < 16; k++) {
+        for (int c = 0; c < 4; c++) {
+            palette[k][c] = ((64 - BC7_WEIGHTS[k]) * endpoints[0][c]
+                             + BC7_WEIGHTS[k] * endpoints[1][c] + 32)
+                            >> 6;
+        }
+    }
+
+    int direction[4];
+    int lengthSquared = 0;
+    for (int c = 0; c < 4; c++) {
+        direction[c] = endpoints[1][c] - endpoints[0][c];
+        lengthSquared += direction[c] * direction[c];
+    }
+
+    int error = 0;
+    for (int i = 0; i < 16; i++) {
+        int first = 0;
+        int last = 15;
+        if (!exhaustive) {
+            int projection = 0;
+            for (int c = 0; c < 4; c++) {
+                projection += (texels[i][c] - endpoints[0][c]) * direction[c];
+            }
+            const long guess = lengthSquared > 0 ? std::lround(15.0f * projection / lengthSquared)
+                                                 : 0;
+            first = static_cast<int>(std::clamp(guess - 1, 0L, 15L));
+            last = static_cast<int>(std::clamp(guess + 1, 0L, 15L));
+        }
+
+        int best = first;
+        int bestError = INT_MAX;
+        for (int k = first; k <= last; k++) {
+            const int e = squaredError(texels[i], palette[k], 4);
+            if (e < bestError) {
+                best = k;
+                bestError = e;
+            }
+        }
+        indices[i] = static_cast<uint8_t>(best);
+        error += bestError;
+    }
+    return error;
+}
+
+// Fields are packed from the least significant bit of the first byte on
+class BitWriter
+{
+public:
+    void write(uint32_t value, unsigned count)
+    {
+        for (unsigned i = 0; i < count; i++, m_position++) {
+            m_words[m_position / 64] |= uint64_t((value >> i) & 1) << (m_position % 64);
+        }
+    }
+
+    void store(uint8_t *out) const
+    {
+        for (int i = 0; i < 16; i++) {
+            out[i] = static_cast<uint8_t>(m_words[i / 8] >> ((i % 8) * 8));
+        }
+    }
+
+private:
+    uint64_t m_words[2] = {};
+    unsigned m_position = 0;
+};
+
+void packBc7Mode6(Endpoint endpoints[2], uint8_t indices[16], uint8_t *out)
+{
+    // The first index is stored without its top bit, so it has to be clear
+    if (indices[0] & 8) {
+        std::swap(endpoints[0], endpoints[1]);
+        for (int i = 0; i < 16; i++) {
+            indices[i] = static_cast<uint8_t>(15 - indices[i]);
+        }
+    }
+
+    BitWriter bits;
+    bits.write(1 << 6, 7);
+    for (int c = 0; c < 4; c++) {
+        bits.write(uint32_t(endpoints[0][c]) >> 1, 7);
+        bits.write(uint32_t(endpoints[1][c]) >> 1, 7);
+    }
+    bits.write(uint32_t(endpoints[0][0]) & 1, 1);
+    bits.write(uint32_t(endpoints[1][0]) & 1, 1);
+    bits.write(indices[0], 3);
+    for (int i = 1; i < 16; i++) {
+        bits.write(indices[i], 4);
+    }
+    bits.store(out);
+}
+
+void encodeBc7Block(const Texels &texels, BcQuality quality, uint8_t *out)
+{
+    Color endpoints[2];
+    if (quality == BcQuality::Fast) {
+        boundingBox(texels, 4, endpoints);
+    } else {
+        principalAxis(texels, 4, endpoints);
+    }
+
+    const bool high = quality == BcQuality::High;
+    Endpoint bestEndpoints[2] = {};
+    uint8_t bestIndices[16] = {};
+    int bestError = INT_MAX;
+    for (int pass = 0; pass < passCount(quality); pass++) {
+        // High tries every p-bit pair on the block, the others take the closest endpoints
+        int passError = INT_MAX;
+        uint8_t passIndices[16];
+        for (int pBits = 0; pBits < 4; pBits++) {
+            Endpoint quantized[2];
+            if (high) {
+                quantizeBc7(endpoints[0], pBits & 1, quantized[0]);
+                quantizeBc7(endpoints[1], pBits >> 1, quantized[1]);
+            } else {
+                for (int e = 0; e < 2; e++) {
+                    Endpoint other;
+                    if (quantizeBc7(endpoints[e], 1, other)
+                        < quantizeBc7(endpoints[e], 0, quantized[e])) {
+                        quantized[e] = other;
+                    }
+                }
+            }
+
+            uint8_t indices[16];
+            const int error = fitBc7(texels, quantized, high, indices);
+            if (error < passError) {
+                passError = error;
+                memcpy(passIndices, indices, sizeof(indices));
+            }
+            if (error < bestError) {
+                bestError = error;
+                bestEndpoints[0] = quantized[0];
+                bestEndpoints[1] = quantized[1];
+                memcpy(bestIndices, indices, sizeof(indices));
+            }
+            if (!high)
+                break;
+        }
+        if (bestError == 0)
+            break;
+
+        float weights[16];
+        for (int i = 0; i < 16; i++) {
+            weights[i] = BC7_WEIGHTS[passIndices[i]] / 64.0f;
+        }
+        if (!leastSquares(texels, 4, weights, endpoints))
+            break;
+    }
+
+    packBc7Mode6(bestEndpoints, bestIndices, out);
+}
+} // namespace
+
+uint32_t bcBlockBytes(BcFormat format)
+{
+    return format == BcFormat::Bc1 ? 8 : 16;
+}
+
+const char *bcFormatName(BcFormat format)
+{
+    return format == BcFormat::Bc1 ? "bc1" : "bc7";
+}
+
+const char *bcQualityName(BcQuality quality)
+{
+    switch (quality) {
+    case BcQuality::Fast:
+        return "fast";
+    case BcQuality::Normal:
+        return "normal";
+    case BcQuality::High:
+        return "high";
+    }
+    return "";
+}
+
+void encodeBcChain(const uint8_t *pixels,
+                   const std::vector<MipLevel> &levels,
+                   uint8_t *blocks,
+                   const std::vector<MipLevel> &blockLevels,
+                   BcFormat format,
+                   BcQuality quality,
+                   ThreadPool &pool)
+{
+    const uint32_t blockBytes = bcBlockBytes(format);
+    for (size_t i = 0; i < levels.size(); i++) {
+        TRACE_SCOPE("bc level");
+        const MipLevel &level = levels[i];
+        const uint8_t *src = pixels + level.offset;
+        uint8_t *dst = blocks + blockLevels[i].offset;
+        const uint32_t blocksWide = (level.width + 3) / 4;
+        const uint32_t blocksHigh = (level.height + 3) / 4;
+
+        pool.parallelFor(blocksHigh, BLOCK_ROWS_PER_TASK, [&](size_t begin, size_t end) {
+            Texels texels;
+            for (size_t y = begin; y < end; y++) {
+                for (uint32_t x = 0; x < blocksWide; x++) {
+                    loadBlock(src, level, x, static_cast<uint32_t>(y), texels);
+                    uint8_t *out = dst + (y * blocksWide + x) * blockBytes;
+                    if (format == BcFormat::Bc1) {
+                        encodeBc1Block(texels, quality, out);
+                    } else {
+                        encodeBc7Block(texels, quality, out);
+                    }
+                }
+            }
+        });
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef BCENCODER_H
+#define BCENCODER_H
+
+#include "mipbuilder.h"
+
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// BC1 stores opaque color in 8 bytes per 4x4 block, BC7 color and alpha in 16. Only BC7
+// mode 6 is written, one RGBA line per block with 4 bit indices.
+enum class BcFormat { Bc1, Bc7 };
+
+// Fast takes the bounding box of a block as its endpoints and projects the texels onto it.
+// Normal fits the endpoints to the principal axis, picks the nearest palette entries and
+// refines the endpoints by least squares. High refines longer, searches every index and
+// every BC7 p-bit combination.
+enum class BcQuality { Fast, Normal, High };
+
+uint32_t bcBlockBytes(BcFormat format);
+
+const char *bcFormatName(BcFormat format);
+const char *bcQualityName(BcQuality quality);
+
+// Encodes an RGBA8 chain laid out by mipChainLayout into the matching block compressed
+// levels, which are laid out with bcBlockBytes. Values are taken as they are, so sRGB
+// encoded colors stay sRGB encoded. Rows of blocks are spread over the pool.
+void encodeBcChain(const uint8_t *pixels,
+                   const std::vector<MipLevel> &levels,
+                   uint8_t *blocks,
+                   const std::vector<MipLevel> &blockLevels,
+                   BcFormat format,
+                   BcQuality quality,
+                   ThreadPool &pool);
+
+#endif // BCENCODER_H
@@ -0,0 +1,461 @@
+#include "bmpreader.h"
+
+#include "threadpool.h"
+#include "tracer.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define BMP_X86
+#if defined(__GNUC__)
+#define BMP_TARGET_SSSE3 __attribute__((target("ssse3")))
+#else
+#define BMP_TARGET_SSSE3
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+const uint32_t BI_RGB = 0;
+const uint32_t BI_RLE8 = 1;
+const uint32_t BI_RLE4 = 2;
+const uint32_t BI_BITFIELDS = 3;
+
+// Output bytes per stripe, small enough to spread a large image over every core
+const size_t STRIPE_BYTES = size_t(1) << 20;
+
+void swizzleBgrScalar(const uchar *src, uint8_t *dst, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++, src += 3, dst += 4) {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        dst[3] = 255;
+    }
+}
+
+void swizzleBgraScalar(const uchar *src, uint8_t *dst, uint32_t count, bool keepAlpha)
+{
+    for (uint32_t i = 0; i < count; i++, src += 4, dst += 4) {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        dst[3] = keepAlpha ? src[3] : 255;
+    }
+}
+
+#if defined(BMP_X86)
+bool hasSsse3()
+{
+#if defined(__GNUC__)
+    static const bool supported = __builtin_cpu_supports("ssse3");
+    return supported;
+#else
+    return true;
+#endif
+}
+
+BMP_TARGET_SSSE3 uint32_t swizzleBgrSsse3(const uchar *src, uint8_t *dst, uint32_t count)
+{
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+    const __m128i alpha = _mm_set1_epi32(static_cast<int>(0xff000000));
+
+    // Each step loads 16 bytes but only consumes 12, so stop before reading past the row
+    uint32_t i = 0;
+    for (; i + 6 <= count; i += 4) {
+        __m128i bgr = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 3));
+        __m128i rgba = _mm_or_si128(_mm_shuffle_epi8(bgr, shuffle), alpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4), rgba);
+    }
+    return i;
+}
+
+BMP_TARGET_SSSE3 uint32_t swizzleBgraSsse3(const uchar *src,
+                                            uint8_t *dst,
+                                            uint32_t count,
+                                            bool keepAlpha)
+{
+    const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    const __m128i alpha = _mm_set1_epi32(keepAlpha ? 0 : static_cast<int>(0xff000000));
+
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i bgra = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i * 4));
+        __m128i rgba = _mm_or_si128(_mm_shuffle_epi8(bgra, shuffle), alpha);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4), rgba);
+    }
+    return i;
+}
+#elif defined(__ARM_NEON)
+uint32_t swizzleBgrNeon(const uchar *src, uint8_t *dst, uint32_t count)
+{
+    uint32_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x3_t bgr = vld3q_u8(src + i * 3);
+        uint8x16x4_t rgba;
+        rgba.val[0] = bgr.val[2];
+        rgba.val[1] = bgr.val[1];
+        rgba.val[2] = bgr.val[0];
+        rgba.val[3] = vdupq_n_u8(255);
+        vst4q_u8(dst + i * 4, rgba);
+    }
+    return i;
+}
+
+uint32_t swizzleBgraNeon(const uchar *src, uint8_t *dst, uint32_t count, bool keepAlpha)
+{
+    uint32_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        uint8x16x4_t bgra = vld4q_u8(src + i * 4);
+        uint8x16x4_t rgba;
+        rgba.val[0] = bgra.val[2];
+        rgba.val[1] = bgra.val[1];
+        rgba.val[2] = bgra.val[0];
+        rgba.val[3] = keepAlpha ? bgra.val[3] : vdupq_n_u8(255);
+        vst4q_u8(dst + i * 4, rgba);
+    }
+    return i;
+}
+#endif
+} // namespace
+
+BmpReader::BmpReader(const QString &fileName)
+    : m_file(fileName)
+{
+    if (!m_file.open(QFile::ReadOnly))
+        return;
+
+    const qint64 fileSize = m_file.size();
+    if (fileSize < 54)
+        return;
+
+    const uchar *data = m_file.map(0, fileSize);
+    if (!data || data[0] != 'B' || data[1] != 'M')
+        return;
+
+    auto readU16 = [data](qint64 offset) {
+        return static_cast<uint16_t>(data[offset] | (data[offset + 1] << 8));
+    };
+    auto readU32 = [data](qint64 offset) {
+        return static_cast<uint32_t>(data[offset]) | (static_cast<uint32_t>(data[offset + 1]) << 8)
+               | (static_cast<uint32_t>(data[offset + 2]) << 16)
+               | (static_cast<uint32_t>(data[offset + 3]) << 24);
+    };
+
+    const uint32_t pixelOffset = readU32(10);
+    const uint32_t headerSize = readU32(14);
+    const int32_t width = static_cast<int32_t>(readU32(18));
+    const int32_t height = static_cast<int32_t>(readU32(22));
+    const uint16_t bitCount = readU16(28);
+    const uint32_t compression = readU32(30);
+
+    // OS/2 core headers have 16 bit sizes and are left to QImage
+    if (headerSize < 40 || width <= 0 || height == 0 || pixelOffset >= fileSize)
+        return;
+
+    if (bitCount == 24 && compression == BI_RGB) {
+        m_encoding = Encoding::Bgr;
+    } else if (bitCount == 32 && compression == BI_RGB) {
+        m_encoding = Encoding::Bgra;
+    } else if (bitCount == 32 && compression == BI_BITFIELDS && fileSize >= 70) {
+        // Only the standard BGRA layout is handled here, everything else goes through QImage.
+        if (readU32(54) != 0x00ff0000 || readU32(58) != 0x0000ff00 || readU32(62) != 0x000000ff)
+            return;
+        m_encoding = Encoding::Bgra;
+        m_hasAlpha = headerSize >= 56 && readU32(66) == 0xff000000;
+    } else if (bitCount == 16 && compression == BI_RGB) {
+        m_encoding = Encoding::Rgb555;
+    } else if (bitCount == 16 && compression == BI_BITFIELDS && fileSize >= 66) {
+        if (readU32(54) == 0xf800 && readU32(58) == 0x07e0 && readU32(62) == 0x001f)
+            m_encoding = Encoding::Rgb565;
+        else if (readU32(54) == 0x7c00 && readU32(58) == 0x03e0 && readU32(62) == 0x001f)
+            m_encoding = Encoding::Rgb555;
+        else
+            return;
+    } else if (bitCount == 8 && (compression == BI_RGB || compression == BI_RLE8)) {
+        m_encoding = compression == BI_RGB ? Encoding::Palette8 : Encoding::Rle8;
+    } else if (bitCount == 4 && (compression == BI_RGB || compression == BI_RLE4)) {
+        m_encoding = compression == BI_RGB ? Encoding::Palette4 : Encoding::Rle4;
+    } else {
+        return;
+    }
+
+    const bool rle = m_encoding == Encoding::Rle4 || m_encoding == Encoding::Rle8;
+    // RLE bitmaps are always stored bottom up
+    if (rle && height < 0)
+        return;
+
+    m_width = static_cast<uint32_t>(width);
+    m_height = static_cast<uint32_t>(std::abs(height));
+    m_bottomUp = height > 0;
+    m_bytesPerPixel = bitCount / 8;
+
+    // 64 bit, a crafted width would wrap the stride and pass the size check below
+    const uint64_t rowStride = ((uint64_t(m_width) * bitCount + 31) / 32) * 4;
+    if (rowStride > UINT32_MAX)
+        return;
+    m_rowStride = static_cast<uint32_t>(rowStride);
+
+    if (bitCount <= 8) {
+        // BGRX entries follow the header, biClrUsed of 0 means all of them
+        const qint64 paletteOffset = 14 + static_cast<qint64>(headerSize);
+        uint32_t colorCount = readU32(46);
+        if (colorCount == 0 || colorCount > (1u << bitCount))
+            colorCount = 1u << bitCount;
+        if (paletteOffset + colorCount * 4 > pixelOffset)
+            return;
+
+        for (uint32_t i = 0; i < colorCount; i++) {
+            const uchar *entry = data + paletteOffset + i * 4;
+            m_palette[i] = {entry[2], entry[1], entry[0], 255};
+        }
+        for (uint32_t i = colorCount; i < m_palette.size(); i++) {
+            m_palette[i] = {0, 0, 0, 255};
+        }
+    }
+
+    if (rle) {
+        // biSizeImage is required for RLE, but the file end is what actually bounds it
+        const uint32_t imageSize = readU32(34);
+        m_dataSize = static_cast<size_t>(fileSize - pixelOffset);
+        if (imageSize > 0)
+            m_dataSize = std::min<size_t>(m_dataSize, imageSize);
+    } else {
+        const uint64_t dataSize = rowStride * m_height;
+        if (dataSize > static_cast<uint64_t>(fileSize - pixelOffset))
+            return;
+        m_dataSize = static_cast<size_t>(dataSize);
+    }
+
+    m_pixels = data + pixelOffset;
+    if (rle && !scanRle())
+        m_pixels = nullptr;
+}
+
+bool BmpReader::scanRle()
+{
+    TRACE_FUNCTION();
+
+    // Only the command headers are read, which is what makes the rows independent. A row
+    // starts at its first pixel command, with x where a delta may have left it. The table
+    // only grows to the rows the stream reaches, a bogus height costs nothing.
+    m_rleRows.clear();
+    const bool rle4 = m_encoding == Encoding::Rle4;
+
+    size_t offset = 0;
+    uint32_t row = 0;
+    uint32_t x = 0;
+    bool rowStarted = false;
+    while (row < m_height) {
+        if (offset + 2 > m_dataSize)
+            return false;
+
+        const uint8_t count = m_pixels[offset];
+        const uint8_t value = m_pixels[offset + 1];
+        if (count > 0 || value > 2) {
+            if (!rowStarted) {
+                if (row >= m_rleRows.size())
+                    m_rleRows.resize(row + 1);
+                m_rleRows[row] = {offset, x};
+                rowStarted = true;
+            }
+        }
+
+        if (count > 0) {
+            offset += 2;
+            x += count;
+        } else if (value == 0) {
+            // End of line
+            offset += 2;
+            row++;
+            x = 0;
+            rowStarted = false;
+        } else if (value == 1) {
+            // End of bitmap, the remaining rows stay at palette entry 0
+            return true;
+        } else if (value == 2) {
+            // Delta, moves right and up without writing the pixels in between
+            if (offset + 4 > m_dataSize)
+                return false;
+            x += m_pixels[offset + 2];
+            if (m_pixels[offset + 3] > 0) {
+                row += m_pixels[offset + 3];
+                rowStarted = false;
+            }
+            offset += 4;
+        } else {
+            // Absolute run of value indices, padded to a 16 bit boundary
+            const size_t bytes = rle4 ? (value + 1u) / 2 : value;
+            offset += 2 + ((bytes + 1) & ~size_t(1));
+            if (offset > m_dataSize)
+                return false;
+            x += value;
+        }
+    }
+    return true;
+}
+
+const uchar *BmpReader::pixelAt(uint32_t x, uint32_t y) const
+{
+    const uint32_t row = m_bottomUp ? m_height - 1 - y : y;
+    return m_pixels + static_cast<size_t>(row) * m_rowStride
+           + static_cast<size_t>(x) * m_bytesPerPixel;
+}
+
+void BmpReader::prefetch() const
+{
+    // One read per page is enough, the sum only keeps the loop from being optimized out
+    volatile uchar sum = 0;
+    for (size_t offset = 0; offset < m_dataSize; offset += 4096)
+        sum = sum + m_pixels[offset];
+}
+
+void BmpReader::decodeRow(uint32_t y, uint32_t x, uint32_t count, uint8_t *rgba) const
+{
+    if (m_encoding == Encoding::Palette8) {
+        const uchar *src = pixelAt(x, y);
+        for (uint32_t i = 0; i < count; i++) {
+            memcpy(rgba + i * 4, m_palette[src[i]].data(), 4);
+        }
+        return;
+    }
+
+    if (m_encoding == Encoding::Palette4) {
+        // High nibble first, pixelAt would round the column down to a whole byte
+        const uint32_t row = m_bottomUp ? m_height - 1 - y : y;
+        const uchar *src = m_pixels + static_cast<size_t>(row) * m_rowStride;
+        for (uint32_t i = 0; i < count; i++) {
+            const uint32_t column = x + i;
+            const uint8_t index = (column & 1) ? src[column / 2] & 0x0f : src[column / 2] >> 4;
+            memcpy(rgba + i * 4, m_palette[index].data(), 4);
+        }
+        return;
+    }
+
+    if (m_encoding == Encoding::Rgb555 || m_encoding == Encoding::Rgb565) {
+        // Expanded with rounding, the same values the GPU conversion produces
+        const bool is565 = m_encoding == Encoding::Rgb565;
+        const uchar *src = pixelAt(x, y);
+        for (uint32_t i = 0; i < count; i++) {
+            const uint32_t v = src[i * 2] | (src[i * 2 + 1] << 8);
+            const uint32_t r = is565 ? v >> 11 : (v >> 10) & 0x1f;
+            const uint32_t g = is565 ? (v >> 5) & 0x3f : (v >> 5) & 0x1f;
+            const uint32_t b = v & 0x1f;
+            const uint32_t gMax = is565 ? 63 : 31;
+            rgba[i * 4] = static_cast<uint8_t>((r * 255 + 15) / 31);
+            rgba[i * 4 + 1] = static_cast<uint8_t>((g * 255 + gMax / 2) / gMax);
+            rgba[i * 4 + 2] = static_cast<uint8_t>((b * 255 + 15) / 31);
+            rgba[i * 4 + 3] = 255;
+        }
+        return;
+    }
+
+    const uchar *src = pixelAt(x, y);
+    uint32_t done = 0;
+
+    if (m_bytesPerPixel == 3) {
+#if defined(BMP_X86)
+        if (hasSsse3())
+            done = swizzleBgrSsse3(src, rgba, count);
+#elif defined(__ARM_NEON)
+        done = swizzleBgrNeon(src, rgba, count);
+#endif
+        swizzleBgrScalar(src + done * 3, rgba + done * 4, count - done);
+    } else {
+#if defined(BMP_X86)
+        if (hasSsse3())
+            done = swizzleBgraSsse3(src, rgba, count, m_hasAlpha);
+#elif defined(__ARM_NEON)
+        done = swizzleBgraNeon(src, rgba, count, m_hasAlpha);
+#endif
+        swizzleBgraScalar(src + done * 4, rgba + done * 4, count - done, m_hasAlpha);
+    }
+}
+
+void BmpReader::decodeRleRow(uint32_t y, uint8_t *rgba) const
+{
+    // Pixels no command writes keep palette entry 0, like QImage leaves them
+    for (uint32_t x = 0; x < m_width; x++) {
+        memcpy(rgba + x * 4, m_palette[0].data(), 4);
+    }
+
+    const uint32_t fileRow = m_height - 1 - y;
+    if (fileRow >= m_rleRows.size() || m_rleRows[fileRow].offset == NO_RLE_DATA)
+        return;
+    const RleRow &row = m_rleRows[fileRow];
+
+    const bool rle4 = m_encoding == Encoding::Rle4;
+    auto put = [&](uint32_t x, uint8_t index) {
+        if (x < m_width)
+            memcpy(rgba + x * 4, m_palette[index].data(), 4);
+    };
+
+    // The pre-scan checked every command against the data size
+    size_t offset = row.offset;
+    uint32_t x = row.x;
+    while (offset + 2 <= m_dataSize) {
+        const uint8_t count = m_pixels[offset];
+        const uint8_t value = m_pixels[offset + 1];
+
+        if (count > 0) {
+            // Encoded run, RLE4 alternates the two nibbles
+            const uint8_t even = rle4 ? value >> 4 : value;
+            const uint8_t odd = rle4 ? value & 0x0f : value;
+            for (uint32_t i = 0; i < count; i++) {
+                put(x + i, (i & 1) ? odd : even);
+            }
+            x += count;
+            offset += 2;
+        } else if (value == 0 || value == 1) {
+            return;
+        } else if (value == 2) {
+            if (m_pixels[offset + 3] > 0)
+                return;
+            x += m_pixels[offset + 2];
+            offset += 4;
+        } else {
+            const uchar *src = m_pixels + offset + 2;
+            for (uint32_t i = 0; i < value; i++) {
+                uint8_t index = src[rle4 ? i / 2 : i];
+                if (rle4)
+                    index = (i & 1) ? index & 0x0f : index >> 4;
+                put(x + i, index);
+            }
+            const size_t bytes = rle4 ? (value + 1u) / 2 : value;
+            offset += 2 + ((bytes + 1) & ~size_t(1));
+            x += value;
+        }
+    }
+}
+
+void BmpReader::copyRaw(uint8_t *dst, ThreadPool &pool) const
+{
+    TRACE_FUNCTION();
+
+    // Copying from the mapping is mostly page faults, which also spread over the cores
+    pool.parallelFor(m_dataSize, STRIPE_BYTES, [&](size_t begin, size_t end) {
+        memcpy(dst + begin, m_pixels + begin, end - begin);
+    });
+}
+
+void BmpReader::decode(uint8_t *rgba, ThreadPool &pool) const
+{
+    TRACE_FUNCTION();
+
+    const size_t rowSize = static_cast<size_t>(m_width) * 4;
+    const bool rle = m_encoding == Encoding::Rle4 || m_encoding == Encoding::Rle8;
+    auto decodeStripe = [&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end; y++) {
+            uint8_t *dst = rgba + y * rowSize;
+            if (rle)
+                decodeRleRow(static_cast<uint32_t>(y), dst);
+            else
+                decodeRow(static_cast<uint32_t>(y), 0, m_width, dst);
+        }
+    };
+    pool.parallelFor(m_height, std::max<size_t>(STRIPE_BYTES / rowSize, 1), decodeStripe);
+}
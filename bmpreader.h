@@ -0,0 +1,90 @@
+#ifndef BMPREADER_H
+#define BMPREADER_H
+
+#include <QFile>
+#include <QString>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+// Memory-mapped reader for 16, 24 and 32 bit, 4 and 8 bit palettized and
+// RLE4/RLE8 BMP files. Rows are decoded straight into the caller's RGBA buffer,
+// so no intermediate copy of the image is ever made.
+class BmpReader
+{
+public:
+    // How the pixel data is stored, Bgra also covers 32 bit files without alpha
+    enum class Encoding { Bgr, Bgra, Rgb555, Rgb565, Palette4, Palette8, Rle4, Rle8 };
+
+    explicit BmpReader(const QString &fileName);
+
+    bool isValid() const { return m_pixels != nullptr; }
+
+    uint32_t width() const { return m_width; }
+    uint32_t height() const { return m_height; }
+    bool hasAlpha() const { return m_hasAlpha; }
+
+    // 24 and 32 bit files, the only ones pixelAt() works on.
+    bool hasDirectPixels() const
+    {
+        return m_encoding == Encoding::Bgr || m_encoding == Encoding::Bgra;
+    }
+
+    // The stored layout, for converting the pixel data somewhere else
+    Encoding encoding() const { return m_encoding; }
+    bool isBottomUp() const { return m_bottomUp; }
+    uint32_t rowStride() const { return m_rowStride; }
+    size_t dataSize() const { return m_dataSize; }
+    const std::array<std::array<uint8_t, 4>, 256> &palette() const { return m_palette; }
+
+    // Copies the pixel data exactly as stored, dataSize() bytes, in stripes on the pool.
+    void copyRaw(uint8_t *dst, ThreadPool &pool) const;
+
+    // Writes the whole image as tightly packed RGBA rows, top row first. Stripes of rows
+    // are decoded concurrently on the pool, each into its final place.
+    void decode(uint8_t *rgba, ThreadPool &pool) const;
+
+    // Writes count RGBA texels of row y (counted from the top) starting at column x.
+    // Not available for RLE files, whose rows only decode whole.
+    void decodeRow(uint32_t y, uint32_t x, uint32_t count, uint8_t *rgba) const;
+
+    // Returns the BGR(A) source texel at (x, y), y counted from the top.
+    const uchar *pixelAt(uint32_t x, uint32_t y) const;
+
+    // Faults the mapped pixel data in, so a later decode does not wait on the disk.
+    void prefetch() const;
+
+private:
+    static const size_t NO_RLE_DATA = ~size_t(0);
+
+    // Where the RLE commands of a row start, found by a pre-scan of the whole stream
+    struct RleRow
+    {
+        size_t offset = NO_RLE_DATA;
+        uint32_t x = 0;
+    };
+
+    bool scanRle();
+    void decodeRleRow(uint32_t y, uint8_t *rgba) const;
+
+    QFile m_file;
+    const uchar *m_pixels = nullptr;
+    Encoding m_encoding = Encoding::Bgr;
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    uint32_t m_bytesPerPixel = 0;
+    uint32_t m_rowStride = 0;
+    size_t m_dataSize = 0;
+    bool m_bottomUp = true;
+    bool m_hasAlpha = false;
+    // RGBA, opaque, unused entries are black
+    std::array<std::array<uint8_t, 4>, 256> m_palette{};
+    // Indexed by file row, bottom row first, rows past the end have no commands
+    std::vector<RleRow> m_rleRows;
+};
+
+#endif // BMPREADER_H
@@ -0,0 +1,143 @@
+#include "bmpreader.h"
+#include "threadpool.h"
+#include "tracer.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QProcess>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Compares the two ways the viewer gets a BMP into its staging buffer: through QImage with a
+// converted copy, like before BmpReader, and decoded by BmpReader in place. Each decoder runs
+// in a child process of its own, so that the peak RSS of one does not hide the other's.
+
+namespace {
+size_t peakResidentSetSize()
+{
+#ifdef Q_OS_WIN
+    PROCESS_MEMORY_COUNTERS counters{};
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.PeakWorkingSetSize;
+#else
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef Q_OS_MACOS
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// The host memory the staging buffer is mapped to, written the way the viewer writes it
+bool decodeToStaging(const QString &decoder, const QString &imageName, ThreadPool &pool)
+{
+    if (decoder == "bmp") {
+        BmpReader bmp(imageName);
+        if (!bmp.isValid())
+            return false;
+        std::unique_ptr<uint8_t[]> staging(new uint8_t[size_t(bmp.width()) * bmp.height() * 4]);
+        bmp.decode(staging.get(), pool);
+        return true;
+    }
+
+    // The viewer's loader before BmpReader
+    QImage image(imageName);
+    if (image.isNull())
+        return false;
+    const QImage converted = image.convertToFormat(QImage::Format_RGBA8888);
+    std::unique_ptr<uint8_t[]> staging(new uint8_t[converted.sizeInBytes()]);
+    memcpy(staging.get(), converted.constBits(), converted.sizeInBytes());
+    return true;
+}
+
+// Prints "<best ms> <average ms> <peak RSS bytes>" for the parent to read
+int runDecoder(const QString &decoder, const QString &imageName, int runs)
+{
+    ThreadPool pool;
+    double bestMs = 0;
+    double sumMs = 0;
+    for (int run = 0; run < runs; run++) {
+        QElapsedTimer timer;
+        timer.start();
+        if (!decodeToStaging(decoder, imageName, pool)) {
+            qWarning() << decoder << "failed to decode" << imageName;
+            return 1;
+        }
+        const double ms = timer.nsecsElapsed() / 1e6;
+        bestMs = run == 0 ? ms : std::min(bestMs, ms);
+        sumMs += ms;
+    }
+
+    printf("%f %f %zu\n", bestMs, sumMs / runs, peakResidentSetSize());
+    return 0;
+}
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Compares decode time and peak RSS of the BMP decoders");
+    parser.addHelpOption();
+    parser.addPositionalArgument("image", "Uncompressed BMP to decode.", "image");
+
+    QCommandLineOption runsOption("runs", "Decodes per decoder.", "n", "10");
+    QCommandLineOption decoderOption("decoder", "Run one decoder, qimage or bmp.", "decoder");
+    parser.addOptions({runsOption, decoderOption});
+    parser.process(a);
+
+    const QStringList images = parser.positionalArguments();
+    if (images.size() != 1)
+        qFatal("One image is required!");
+
+    bool runsOk = false;
+    const int runs = parser.value(runsOption).toInt(&runsOk);
+    if (!runsOk || runs <= 0)
+        qFatal("Invalid --runs!");
+
+    Tracer::setThreadName("main");
+
+    if (parser.isSet(decoderOption))
+        return runDecoder(parser.value(decoderOption), images.first(), runs);
+
+    // The first run of each child also pays for reading the file, later ones hit the page cache
+    int failed = 0;
+    for (const QString &decoder : {QString("qimage"), QString("bmp")}) {
+        QProcess child;
+        child.setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        child.start(QCoreApplication::applicationFilePath(),
+                    {"--decoder", decoder, "--runs", QString::number(runs), images.first()});
+        child.waitForFinished(-1);
+
+        const QStringList result = QString::fromLocal8Bit(child.readAllStandardOutput())
+                                       .trimmed()
+                                       .split(' ');
+        if (child.exitCode() != 0 || result.size() != 3) {
+            failed++;
+            continue;
+        }
+        qDebug().noquote() << decoder.leftJustified(6) << "best:" << result[0].toDouble()
+                           << "ms, avg:" << result[1].toDouble()
+                           << "ms, peak RSS:" << result[2].toULongLong() / (1024 * 1024)
+                           << "MiB";
+    }
+
+    Tracer::write();
+    return failed > 0 ? 1 : 0;
+}
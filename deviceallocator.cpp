@@ -0,0 +1,179 @@
+#include "deviceallocator.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+DeviceAllocator::DeviceAllocator(VkDevice device, VkPhysicalDevice physicalDevice)
+    : m_device(device)
+{
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &m_memoryProperties);
+    m_pools.resize(m_memoryProperties.memoryTypeCount * 2);
+}
+
+DeviceAllocator::~DeviceAllocator()
+{
+    for (auto &pool : m_pools) {
+        for (auto &block : pool) {
+            vkFreeMemory(m_device, block.memory, nullptr);
+        }
+    }
+}
+
+bool DeviceAllocator::allocateFromBlock(Block &block,
+                                        VkDeviceSize size,
+                                        VkDeviceSize alignment,
+                                        VkDeviceSize &offset)
+{
+    // First fit, the padding in front of an aligned range stays on the free list
+    for (auto it = block.freeRanges.begin(); it != block.freeRanges.end(); ++it) {
+        const VkDeviceSize rangeStart = it->first;
+        const VkDeviceSize rangeEnd = it->first + it->second;
+        const VkDeviceSize alignedStart = (rangeStart + alignment - 1) / alignment * alignment;
+        if (alignedStart + size > rangeEnd)
+            continue;
+
+        block.freeRanges.erase(it);
+        if (alignedStart > rangeStart)
+            block.freeRanges.emplace(rangeStart, alignedStart - rangeStart);
+        if (alignedStart + size < rangeEnd)
+            block.freeRanges.emplace(alignedStart + size, rangeEnd - alignedStart - size);
+
+        block.usedBytes += size;
+        offset = alignedStart;
+        return true;
+    }
+    return false;
+}
+
+DeviceAllocation DeviceAllocator::allocate(const VkMemoryRequirements &requirements,
+                                           uint32_t memoryType,
+                                           bool linear)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const uint32_t poolIndex = memoryType * 2 + (linear ? 0 : 1);
+    auto &pool = m_pools[poolIndex];
+    const VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+
+    DeviceAllocation allocation;
+    allocation.size = requirements.size;
+    allocation.pool = poolIndex;
+
+    Block *target = nullptr;
+    for (auto &block : pool) {
+        if (allocateFromBlock(block, requirements.size, alignment, allocation.offset)) {
+            target = &block;
+            break;
+        }
+    }
+
+    if (!target) {
+        const auto &type = m_memoryProperties.memoryTypes[memoryType];
+        const VkDeviceSize heapSize = m_memoryProperties.memoryHeaps[type.heapIndex].size;
+
+        // Small heaps get smaller blocks, oversized requests get a block of their own
+        Block block;
+        const VkDeviceSize defaultSize = std::min(DEFAULT_BLOCK_SIZE, heapSize / 8);
+        block.size = std::max(defaultSize, requirements.size);
+        block.dedicated = requirements.size > defaultSize;
+
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = block.size;
+        allocInfo.memoryTypeIndex = memoryType;
+
+        if (vkAllocateMemory(m_device, &allocInfo, nullptr, &block.memory) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate device memory block!");
+        }
+        m_deviceAllocationCount++;
+
+        // Host visible blocks stay mapped for their whole lifetime
+        if (type.propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+            if (vkMapMemory(m_device, block.memory, 0, VK_WHOLE_SIZE, 0, &block.mapped)
+                != VK_SUCCESS) {
+                vkFreeMemory(m_device, block.memory, nullptr);
+                throw std::runtime_error("failed to map device memory block!");
+            }
+        }
+
+        block.freeRanges.emplace(0, block.size);
+        pool.push_back(std::move(block));
+        target = &pool.back();
+        allocateFromBlock(*target, requirements.size, alignment, allocation.offset);
+    }
+
+    allocation.memory = target->memory;
+    if (target->mapped)
+        allocation.mapped = static_cast<char *>(target->mapped) + allocation.offset;
+
+    m_allocationCount++;
+    return allocation;
+}
+
+void DeviceAllocator::free(DeviceAllocation &allocation)
+{
+    if (allocation.memory == VK_NULL_HANDLE)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    auto &pool = m_pools[allocation.pool];
+    auto block = std::find_if(pool.begin(), pool.end(), [&](const Block &candidate) {
+        return candidate.memory == allocation.memory;
+    });
+    if (block == pool.end()) {
+        throw std::runtime_error("freeing memory that was not allocated here!");
+    }
+
+    // Merge with the free neighbours on both sides
+    VkDeviceSize offset = allocation.offset;
+    VkDeviceSize size = allocation.size;
+    auto next = block->freeRanges.lower_bound(offset);
+    if (next != block->freeRanges.end() && next->first == offset + size) {
+        size += next->second;
+        next = block->freeRanges.erase(next);
+    }
+    if (next != block->freeRanges.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == offset) {
+            offset = previous->first;
+            size += previous->second;
+            block->freeRanges.erase(previous);
+        }
+    }
+    block->freeRanges.emplace(offset, size);
+    block->usedBytes -= allocation.size;
+    m_allocationCount--;
+
+    // One empty default size block per pool is kept around, so loading image after image
+    // reuses it. A block made for one oversized request goes with it.
+    if (block->usedBytes == 0) {
+        auto isEmpty = [](const Block &candidate) {
+            return candidate.usedBytes == 0 && !candidate.dedicated;
+        };
+        if (block->dedicated || std::count_if(pool.begin(), pool.end(), isEmpty) > 1) {
+            vkFreeMemory(m_device, block->memory, nullptr);
+            pool.erase(block);
+        }
+    }
+
+    allocation = DeviceAllocation{};
+}
+
+DeviceAllocator::Stats DeviceAllocator::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    Stats stats;
+    for (const auto &pool : m_pools) {
+        for (const auto &block : pool) {
+            stats.usedBytes += block.usedBytes;
+            stats.reservedBytes += block.size;
+            stats.blockCount++;
+        }
+    }
+    stats.allocationCount = m_allocationCount;
+    stats.deviceAllocationCount = m_deviceAllocationCount;
+    return stats;
+}
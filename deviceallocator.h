@@ -0,0 +1,78 @@
+#ifndef DEVICEALLOCATOR_H
+#define DEVICEALLOCATOR_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+struct DeviceAllocation
+{
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    // Host pointer to the start of the allocation, null unless the memory is host visible
+    void *mapped = nullptr;
+    uint32_t pool = 0;
+};
+
+// Sub-allocates buffers and images out of large per-memory-type blocks, so the
+// driver only sees one vkAllocateMemory per block instead of one per resource.
+class DeviceAllocator
+{
+public:
+    struct Stats
+    {
+        VkDeviceSize usedBytes = 0;
+        VkDeviceSize reservedBytes = 0;
+        uint32_t blockCount = 0;
+        uint32_t allocationCount = 0;
+        uint64_t deviceAllocationCount = 0;
+    };
+
+    DeviceAllocator(VkDevice device, VkPhysicalDevice physicalDevice);
+    ~DeviceAllocator();
+
+    // Linear resources (buffers) and optimal tiling images are kept in separate blocks,
+    // which keeps them bufferImageGranularity apart without tracking neighbours.
+    DeviceAllocation allocate(const VkMemoryRequirements &requirements,
+                              uint32_t memoryType,
+                              bool linear);
+
+    void free(DeviceAllocation &allocation);
+
+    Stats stats() const;
+
+private:
+    struct Block
+    {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize size = 0;
+        VkDeviceSize usedBytes = 0;
+        void *mapped = nullptr;
+        // Made larger than the default size for a single request
+        bool dedicated = false;
+        // Free ranges keyed by offset, adjacent ranges are always merged
+        std::map<VkDeviceSize, VkDeviceSize> freeRanges;
+    };
+
+    bool allocateFromBlock(Block &block,
+                           VkDeviceSize size,
+                           VkDeviceSize alignment,
+                           VkDeviceSize &offset);
+
+    const VkDeviceSize DEFAULT_BLOCK_SIZE = VkDeviceSize(64) << 20;
+
+    VkDevice m_device;
+    VkPhysicalDeviceMemoryProperties m_memoryProperties;
+
+    mutable std::mutex m_mutex;
+    // Indexed by memoryType * 2 + (linear ? 0 : 1)
+    std::vector<std::vector<Block>> m_pools;
+    uint32_t m_allocationCount = 0;
+    uint64_t m_deviceAllocationCount = 0;
+};
+
+#endif // DEVICEALLOCATOR_H
@@ -0,0 +1,240 @@
+#include "gpuprofiler.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+GpuProfiler::GpuProfiler(VkDevice device,
+                         VkPhysicalDevice physicalDevice,
+                         uint32_t queueFamily,
+                         bool enabled,
+                         bool pipelineStatistics)
+    : m_device(device)
+    , m_pipelineStatistics(pipelineStatistics)
+{
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+    const uint32_t validBits = queueFamily < familyCount ? families[queueFamily].timestampValidBits
+                                                         : 0;
+    m_enabled = enabled && validBits > 0;
+    m_timestampMask = validBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << validBits) - 1;
+    m_timestampPeriod = properties.limits.timestampPeriod;
+}
+
+GpuProfiler::~GpuProfiler()
+{
+    for (auto &set : m_sets) {
+        vkDestroyQueryPool(m_device, set.timestamps, nullptr);
+        if (set.statistics != VK_NULL_HANDLE)
+            vkDestroyQueryPool(m_device, set.statistics, nullptr);
+    }
+}
+
+uint32_t GpuProfiler::acquireSet()
+{
+    if (!m_enabled)
+        return 0;
+
+    for (uint32_t i = 0; i < m_sets.size(); i++) {
+        if (!m_sets[i].inUse) {
+            m_sets[i].inUse = true;
+            return i;
+        }
+    }
+
+    QuerySet set;
+    set.inUse = true;
+
+    VkQueryPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = SCOPE_COUNT * 2;
+
+    if (vkCreateQueryPool(m_device, &poolInfo, nullptr, &set.timestamps) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create timestamp query pool!");
+    }
+
+    if (m_pipelineStatistics) {
+        poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+        poolInfo.queryCount = SCOPE_COUNT;
+        poolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT
+                                      | VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT
+                                      | VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+        if (vkCreateQueryPool(m_device, &poolInfo, nullptr, &set.statistics) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline statistics query pool!");
+        }
+    }
+
+    m_sets.push_back(set);
+    return static_cast<uint32_t>(m_sets.size() - 1);
+}
+
+void GpuProfiler::releaseSet(uint32_t set)
+{
+    if (!m_enabled)
+        return;
+
+    m_sets[set].inUse = false;
+    m_sets[set].pending = false;
+}
+
+void GpuProfiler::resetSet(VkCommandBuffer commandBuffer, uint32_t set)
+{
+    if (!m_enabled)
+        return;
+
+    QuerySet &querySet = m_sets[set];
+    vkCmdResetQueryPool(commandBuffer, querySet.timestamps, 0, SCOPE_COUNT * 2);
+    if (querySet.statistics != VK_NULL_HANDLE)
+        vkCmdResetQueryPool(commandBuffer, querySet.statistics, 0, SCOPE_COUNT);
+    querySet.writtenScopes = 0;
+}
+
+void GpuProfiler::beginScope(VkCommandBuffer commandBuffer, uint32_t set, GpuScope scope)
+{
+    if (!m_enabled)
+        return;
+
+    const QuerySet &querySet = m_sets[set];
+    const uint32_t index = static_cast<uint32_t>(scope);
+    vkCmdWriteTimestamp(commandBuffer,
+                        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                        querySet.timestamps,
+                        index * 2);
+    if (querySet.statistics != VK_NULL_HANDLE && hasStatistics(scope))
+        vkCmdBeginQuery(commandBuffer, querySet.statistics, index, 0);
+}
+
+void GpuProfiler::endScope(VkCommandBuffer commandBuffer, uint32_t set, GpuScope scope)
+{
+    if (!m_enabled)
+        return;
+
+    QuerySet &querySet = m_sets[set];
+    const uint32_t index = static_cast<uint32_t>(scope);
+    if (querySet.statistics != VK_NULL_HANDLE && hasStatistics(scope))
+        vkCmdEndQuery(commandBuffer, querySet.statistics, index);
+    vkCmdWriteTimestamp(commandBuffer,
+                        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                        querySet.timestamps,
+                        index * 2 + 1);
+    querySet.writtenScopes |= 1u << index;
+}
+
+void GpuProfiler::submitted(uint32_t set)
+{
+    if (!m_enabled)
+        return;
+
+    m_sets[set].pending = true;
+}
+
+void GpuProfiler::collect(uint32_t set)
+{
+    if (!m_enabled || !m_sets[set].pending)
+        return;
+
+    QuerySet &querySet = m_sets[set];
+    querySet.pending = false;
+
+    for (uint32_t index = 0; index < SCOPE_COUNT; index++) {
+        if (!(querySet.writtenScopes & (1u << index)))
+            continue;
+
+        // Without the wait flag a result that is somehow not there yet is skipped
+        uint64_t timestamps[2] = {};
+        if (vkGetQueryPoolResults(m_device,
+                                  querySet.timestamps,
+                                  index * 2,
+                                  2,
+                                  sizeof(timestamps),
+                                  timestamps,
+                                  sizeof(timestamps[0]),
+                                  VK_QUERY_RESULT_64_BIT)
+            != VK_SUCCESS) {
+            continue;
+        }
+
+        Sample sample{};
+        const uint64_t ticks = ((timestamps[1] & m_timestampMask)
+                                - (timestamps[0] & m_timestampMask))
+                               & m_timestampMask;
+        sample.ms = double(ticks) * m_timestampPeriod / 1e6;
+
+        if (querySet.statistics != VK_NULL_HANDLE && hasStatistics(GpuScope(index))) {
+            // Results come in the order of the statistic bits
+            vkGetQueryPoolResults(m_device,
+                                  querySet.statistics,
+                                  index,
+                                  1,
+                                  sizeof(sample.invocations),
+                                  sample.invocations.data(),
+                                  sizeof(sample.invocations),
+                                  VK_QUERY_RESULT_64_BIT);
+        }
+
+        History &history = m_history[index];
+        history.samples[history.next] = sample;
+        history.next = (history.next + 1) % HISTORY_SIZE;
+        history.count++;
+    }
+}
+
+GpuProfiler::ScopeStats GpuProfiler::stats(GpuScope scope) const
+{
+    ScopeStats stats;
+    const History &history = m_history[static_cast<uint32_t>(scope)];
+    if (history.count == 0)
+        return stats;
+
+    const size_t count = std::min<uint64_t>(history.count, HISTORY_SIZE);
+    std::vector<double> times(count);
+    for (size_t i = 0; i < count; i++) {
+        const Sample &sample = history.samples[i];
+        times[i] = sample.ms;
+        stats.avgMs += sample.ms;
+        stats.vertexInvocations += sample.invocations[0];
+        stats.fragmentInvocations += sample.invocations[1];
+        stats.computeInvocations += sample.invocations[2];
+    }
+
+    stats.samples = history.count;
+    stats.lastMs = history.samples[(history.next + HISTORY_SIZE - 1) % HISTORY_SIZE].ms;
+    stats.minMs = *std::min_element(times.begin(), times.end());
+    stats.avgMs /= count;
+    stats.vertexInvocations /= count;
+    stats.fragmentInvocations /= count;
+    stats.computeInvocations /= count;
+
+    const size_t p99 = std::min(count - 1, count * 99 / 100);
+    std::nth_element(times.begin(), times.begin() + p99, times.end());
+    stats.p99Ms = times[p99];
+    return stats;
+}
+
+const char *GpuProfiler::scopeName(GpuScope scope)
+{
+    switch (scope) {
+    case GpuScope::Upload:
+        return "upload";
+    case GpuScope::MipGeneration:
+        return "mip generation";
+    case GpuScope::Draw:
+        return "draw";
+    case GpuScope::Count:
+        break;
+    }
+    return "";
+}
+
+bool GpuProfiler::hasStatistics(GpuScope scope)
+{
+    // Statistics queries of one pool cannot overlap, and uploads wrap the mip generation
+    return scope == GpuScope::MipGeneration || scope == GpuScope::Draw;
+}
@@ -0,0 +1,107 @@
+#ifndef GPUPROFILER_H
+#define GPUPROFILER_H
+
+#include <vulkan/vulkan.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Sections of GPU work that are timed
+enum class GpuScope { Upload, MipGeneration, Draw, Count };
+
+// Timestamps, and optionally pipeline statistics, around scopes of recorded GPU work.
+//
+// Queries go into query sets, each tied to one command buffer and reset at the start of it,
+// so a replayed command buffer measures again without being re-recorded. Results are only
+// read once the submission that wrote them is known to have completed, a frame or two
+// later, and never wait on the GPU. Each scope keeps a rolling window of samples.
+class GpuProfiler
+{
+public:
+    struct ScopeStats
+    {
+        uint64_t samples = 0;
+        double lastMs = 0;
+        double minMs = 0;
+        double avgMs = 0;
+        double p99Ms = 0;
+        // Averages over the window, zero without pipeline statistics
+        double vertexInvocations = 0;
+        double fragmentInvocations = 0;
+        double computeInvocations = 0;
+    };
+
+    // Stays disabled when the queue family has no timestamps, and every call is a no-op
+    // then. pipelineStatistics needs the pipelineStatisticsQuery feature on the device.
+    GpuProfiler(VkDevice device,
+                VkPhysicalDevice physicalDevice,
+                uint32_t queueFamily,
+                bool enabled,
+                bool pipelineStatistics);
+    ~GpuProfiler();
+
+    bool isEnabled() const { return m_enabled; }
+
+    uint32_t acquireSet();
+    void releaseSet(uint32_t set);
+
+    // Recorded outside a render pass, before any scope of the set
+    void resetSet(VkCommandBuffer commandBuffer, uint32_t set);
+
+    // Scopes of the same set must not nest, except for Upload around the others, and scopes
+    // with statistics must begin and end outside a render pass
+    void beginScope(VkCommandBuffer commandBuffer, uint32_t set, GpuScope scope);
+    void endScope(VkCommandBuffer commandBuffer, uint32_t set, GpuScope scope);
+
+    // The command buffer holding the set has been submitted
+    void submitted(uint32_t set);
+
+    // Takes the samples of a set whose submission has completed, without waiting
+    void collect(uint32_t set);
+
+    ScopeStats stats(GpuScope scope) const;
+
+    static const char *scopeName(GpuScope scope);
+
+private:
+    static const size_t HISTORY_SIZE = 256;
+    static const uint32_t SCOPE_COUNT = static_cast<uint32_t>(GpuScope::Count);
+
+    struct QuerySet
+    {
+        VkQueryPool timestamps = VK_NULL_HANDLE;
+        VkQueryPool statistics = VK_NULL_HANDLE;
+        // One bit per scope recorded since the last reset
+        uint32_t writtenScopes = 0;
+        bool pending = false;
+        bool inUse = false;
+    };
+
+    struct Sample
+    {
+        double ms;
+        std::array<uint64_t, 3> invocations;
+    };
+
+    struct History
+    {
+        std::array<Sample, HISTORY_SIZE> samples;
+        size_t next = 0;
+        uint64_t count = 0;
+    };
+
+    static bool hasStatistics(GpuScope scope);
+
+    VkDevice m_device;
+    bool m_enabled = false;
+    bool m_pipelineStatistics = false;
+    double m_timestampPeriod = 0;
+    uint64_t m_timestampMask = 0;
+
+    std::vector<QuerySet> m_sets;
+    std::array<History, SCOPE_COUNT> m_history;
+};
+
+#endif // GPUPROFILER_H
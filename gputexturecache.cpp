@@ -0,0 +1,134 @@
+#include "gputexturecache.h"
+
+#include "tracer.h"
+
+#include <QDebug>
+
+#include <algorithm>
+
+GpuTextureCache::GpuTextureCache(VkDevice device, DeviceAllocator &allocator, VkDeviceSize budget)
+    : m_device(device)
+    , m_allocator(allocator)
+    , m_budget(budget)
+{}
+
+GpuTextureCache::~GpuTextureCache()
+{
+    for (auto &entry : m_entries) {
+        destroy(entry.texture);
+    }
+    for (auto &texture : m_evicted) {
+        destroy(texture);
+    }
+}
+
+ResidentTexture *GpuTextureCache::find(const QString &fileName)
+{
+    auto it = m_index.find(fileName);
+    if (it == m_index.end())
+        return nullptr;
+
+    m_entries.splice(m_entries.begin(), m_entries, it->second);
+    return &it->second->texture;
+}
+
+ResidentTexture &GpuTextureCache::insert(const QString &fileName, const ResidentTexture &texture)
+{
+    if (ResidentTexture *existing = find(fileName)) {
+        m_evicted.push_back(texture);
+        return *existing;
+    }
+
+    m_entries.push_front({fileName, texture});
+    m_index[fileName] = m_entries.begin();
+    m_usedBytes += texture.memory.size;
+    return m_entries.front().texture;
+}
+
+void GpuTextureCache::evict(const void *user, const QStringList &pinned)
+{
+    m_pinned[user] = pinned;
+    auto isPinned = [this](const QString &fileName) {
+        return std::any_of(m_pinned.begin(), m_pinned.end(), [&fileName](const auto &pins) {
+            return pins.second.contains(fileName);
+        });
+    };
+
+    // Oldest first, pinned textures stay even when they alone exceed the budget
+    auto it = m_entries.end();
+    while (m_usedBytes > m_budget && it != m_entries.begin()) {
+        --it;
+        if (isPinned(it->fileName))
+            continue;
+
+        if (Tracer::statsEnabled())
+            qDebug() << "gpu texture cache evicting" << it->fileName;
+        m_usedBytes -= it->texture.memory.size;
+        m_evicted.push_back(it->texture);
+        m_index.erase(it->fileName);
+        it = m_entries.erase(it);
+    }
+}
+
+void GpuTextureCache::collect(const void *user,
+                              uint64_t completedFrameSerial,
+                              uint64_t completedUploadSerial)
+{
+    m_completed[user] = {completedFrameSerial, completedUploadSerial};
+
+    auto done = std::partition(m_evicted.begin(),
+                               m_evicted.end(),
+                               [this](const ResidentTexture &texture) { return inUse(texture); });
+    if (done == m_evicted.end())
+        return;
+
+    for (auto it = done; it != m_evicted.end(); ++it) {
+        destroy(*it);
+    }
+    m_evicted.erase(done, m_evicted.end());
+    m_destroyedGeneration++;
+}
+
+void GpuTextureCache::release(const void *user)
+{
+    m_pinned.erase(user);
+    m_completed.erase(user);
+
+    auto forget = [user](ResidentTexture &texture) {
+        texture.frameSerials.erase(user);
+        if (texture.uploader == user)
+            texture.uploader = nullptr;
+    };
+    for (auto &entry : m_entries) {
+        forget(entry.texture);
+    }
+    for (auto &texture : m_evicted) {
+        forget(texture);
+    }
+}
+
+bool GpuTextureCache::inUse(const ResidentTexture &texture) const
+{
+    // A user that has not reported yet has completed nothing
+    auto completed = [this](const void *user) {
+        auto it = m_completed.find(user);
+        return it != m_completed.end() ? it->second : Completed{};
+    };
+
+    if (texture.uploader && texture.uploadSerial > completed(texture.uploader).uploadSerial)
+        return true;
+    for (const auto &[user, frameSerial] : texture.frameSerials) {
+        if (frameSerial > completed(user).frameSerial)
+            return true;
+    }
+    return false;
+}
+
+void GpuTextureCache::destroy(ResidentTexture &texture)
+{
+    // The descriptor set goes with its pool
+    vkDestroyDescriptorPool(m_device, texture.descriptorPool, nullptr);
+    vkDestroyImageView(m_device, texture.view, nullptr);
+    vkDestroyImage(m_device, texture.image, nullptr);
+    m_allocator.free(texture.memory);
+}
@@ -0,0 +1,108 @@
+#ifndef GPUTEXTURECACHE_H
+#define GPUTEXTURECACHE_H
+
+#include "deviceallocator.h"
+
+#include <vulkan/vulkan.h>
+
+#include <QString>
+#include <QStringList>
+
+#include <cstdint>
+#include <list>
+#include <map>
+#include <vector>
+
+// A sampled texture with everything needed to draw it
+struct ResidentTexture
+{
+    VkImage image = VK_NULL_HANDLE;
+    DeviceAllocation memory;
+    VkImageView view = VK_NULL_HANDLE;
+    VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t mipLevels = 0;
+    // Format of the sampled view
+    VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+    const char *decoder = "";
+    // The upload batch that fills it and the last frame of each window that drew it, in the
+    // serials of that window. It is destroyed only once all of them have completed.
+    const void *uploader = nullptr;
+    uint64_t uploadSerial = 0;
+    std::map<const void *, uint64_t> frameSerials;
+};
+
+// Textures of browsed images kept on the GPU, keyed by file name and shared by every window
+// on the device. Each window is a user with its own frame and upload serials. Once the
+// textures exceed the VRAM budget the least recently used ones are evicted, except for the
+// ones any user pinned around its current image. An evicted texture may still be read by a
+// frame or an upload in flight, so it is only destroyed by collect() once all of them have
+// completed.
+class GpuTextureCache
+{
+public:
+    GpuTextureCache(VkDevice device, DeviceAllocator &allocator, VkDeviceSize budget);
+
+    // Destroys every texture, evicted or not, the device must be idle
+    ~GpuTextureCache();
+
+    VkDeviceSize budget() const { return m_budget; }
+    VkDeviceSize usedBytes() const { return m_usedBytes; }
+    size_t size() const { return m_entries.size(); }
+
+    // Null when not resident, a hit becomes the most recently used. The pointer stays valid
+    // until the texture is evicted.
+    ResidentTexture *find(const QString &fileName);
+
+    // When another user inserted the same file first, texture is destroyed once its upload
+    // has completed and the texture already resident is returned
+    ResidentTexture &insert(const QString &fileName, const ResidentTexture &texture);
+
+    // Replaces what user pins, then evicts least recently used textures no user pinned until
+    // the rest fits the budget
+    void evict(const void *user, const QStringList &pinned);
+
+    // Records how far user's frames and uploads have completed and destroys evicted textures
+    // nothing uses anymore
+    void collect(const void *user, uint64_t completedFrameSerial, uint64_t completedUploadSerial);
+
+    // For a user whose frames and uploads have all completed and that uses no texture anymore
+    void release(const void *user);
+
+    // Increases whenever textures are destroyed, recorded command buffers may bind them
+    uint64_t destroyedGeneration() const { return m_destroyedGeneration; }
+
+private:
+    struct Entry
+    {
+        QString fileName;
+        ResidentTexture texture;
+    };
+
+    struct Completed
+    {
+        uint64_t frameSerial = 0;
+        uint64_t uploadSerial = 0;
+    };
+
+    bool inUse(const ResidentTexture &texture) const;
+    void destroy(ResidentTexture &texture);
+
+    VkDevice m_device;
+    DeviceAllocator &m_allocator;
+    VkDeviceSize m_budget;
+    VkDeviceSize m_usedBytes = 0;
+
+    // Most recently used first
+    std::list<Entry> m_entries;
+    std::map<QString, std::list<Entry>::iterator> m_index;
+    std::vector<ResidentTexture> m_evicted;
+    uint64_t m_destroyedGeneration = 0;
+
+    std::map<const void *, QStringList> m_pinned;
+    std::map<const void *, Completed> m_completed;
+};
+
+#endif // GPUTEXTURECACHE_H
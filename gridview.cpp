@@ -0,0 +1,249 @@
+#include "gridview.h"
+
+#include "tracer.h"
+
+#include <QFile>
+#include <QFileInfo>
+
+#include <algorithm>
+#include <array>
+#include <stdexcept>
+
+GridView::GridView(const QStringList &images)
+{
+    for (const QString &image : images) {
+        m_images << QFileInfo(image).absoluteFilePath();
+    }
+    const auto count = static_cast<uint32_t>(m_images.size());
+    while (m_columns * m_columns < count) {
+        m_columns++;
+    }
+    m_rows = (count + m_columns - 1) / m_columns;
+}
+
+VkExtent2D GridView::cellExtent(VkExtent2D extent) const
+{
+    return {std::max(extent.width / m_columns, 1u), std::max(extent.height / m_rows, 1u)};
+}
+
+QString GridView::title() const
+{
+    QStringList names;
+    for (const QString &image : m_images) {
+        names << QFileInfo(image).fileName();
+    }
+    return names.join(" | ");
+}
+
+void GridView::createPipelineLayout(RenderContext &context)
+{
+    VkDescriptorSetLayoutBinding samplerLayoutBinding{};
+    samplerLayoutBinding.binding = 1;
+    samplerLayoutBinding.descriptorCount = MAX_VIEWS;
+    samplerLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &samplerLayoutBinding;
+
+    if (vkCreateDescriptorSetLayout(context.device,
+                                    &layoutInfo,
+                                    nullptr,
+                                    &context.gridDescriptorSetLayout)
+        != VK_SUCCESS) {
+        throw std::runtime_error("failed to create grid descriptor set layout!");
+    }
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(GridPushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &context.gridDescriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(context.device,
+                               &pipelineLayoutInfo,
+                               nullptr,
+                               &context.gridPipelineLayout)
+        != VK_SUCCESS) {
+        throw std::runtime_error("failed to create grid pipeline layout!");
+    }
+}
+
+const char *GridView::unavailableReason(const RenderContext &context,
+                                        bool firstImageTiled,
+                                        bool sharedContext) const
+{
+    if (m_images.isEmpty())
+        return nullptr;
+
+    if (!context.nonUniformTextureIndexing)
+        return "the device cannot index textures per instance";
+    if (!QFile::exists(":/shaders/gridcells.spv"))
+        return "the grid shaders were not built";
+    if (firstImageTiled)
+        return "the first image needs tiled mode";
+    if (sharedContext && context.gridPipeline == VK_NULL_HANDLE)
+        return "the shared device was set up without it";
+    return nullptr;
+}
+
+bool GridView::markFailed(const QString &fileName)
+{
+    const auto cell = m_images.indexOf(fileName);
+    if (cell < 0)
+        return false;
+
+    m_failed |= 1u << cell;
+    return true;
+}
+
+bool GridView::update(const RenderContext &context,
+                      GpuTextureCache &textures,
+                      VkImageView placeholder)
+{
+    TRACE_FUNCTION();
+
+    if (m_descriptorSet != VK_NULL_HANDLE)
+        return true;
+
+    // Every element of the array needs a valid descriptor, cells without an image show the
+    // placeholder and are never drawn
+    std::array<VkDescriptorImageInfo, MAX_VIEWS> imageInfos{};
+    uint32_t shown = 0;
+    for (uint32_t cell = 0; cell < MAX_VIEWS; cell++) {
+        imageInfos[cell].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        imageInfos[cell].imageView = placeholder;
+        imageInfos[cell].sampler = context.textureSampler;
+        if (cell >= static_cast<uint32_t>(m_images.size()) || (m_failed & (1u << cell)))
+            continue;
+
+        const ResidentTexture *texture = textures.find(m_images[cell]);
+        if (!texture)
+            return false;
+
+        imageInfos[cell].imageView = texture->view;
+        shown |= 1u << cell;
+    }
+
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSize.descriptorCount = MAX_VIEWS;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = 1;
+
+    if (vkCreateDescriptorPool(context.device, &poolInfo, nullptr, &m_descriptorPool)
+        != VK_SUCCESS) {
+        throw std::runtime_error("failed to create grid descriptor pool!");
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = m_descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &context.gridDescriptorSetLayout;
+
+    if (vkAllocateDescriptorSets(context.device, &allocInfo, &m_descriptorSet) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate grid descriptor set!");
+    }
+
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = m_descriptorSet;
+    descriptorWrite.dstBinding = 1;
+    descriptorWrite.dstArrayElement = 0;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrite.descriptorCount = MAX_VIEWS;
+    descriptorWrite.pImageInfo = imageInfos.data();
+
+    vkUpdateDescriptorSets(context.device, 1, &descriptorWrite, 0, nullptr);
+    m_shown = shown;
+    return true;
+}
+
+void GridView::draw(VkCommandBuffer commandBuffer,
+                    const RenderContext &context,
+                    VkBuffer vertexBuffer,
+                    VkBuffer indexBuffer,
+                    uint32_t indexCount,
+                    const ViewTransform &view,
+                    VkOffset2D viewportOffset,
+                    VkExtent2D viewport,
+                    VkExtent2D extent) const
+{
+    // Nothing is bound until every image has loaded
+    if (m_descriptorSet == VK_NULL_HANDLE || indexCount == 0)
+        return;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, context.gridPipeline);
+
+    // One viewport for all cells, the shader maps each cell's view into it
+    VkViewport cellsViewport{};
+    cellsViewport.x = 0.0f;
+    cellsViewport.y = 0.0f;
+    cellsViewport.width = (float) extent.width;
+    cellsViewport.height = (float) extent.height;
+    cellsViewport.minDepth = 0.0f;
+    cellsViewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &cellsViewport);
+
+    VkBuffer vertexBuffers[] = {vertexBuffer};
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+    vkCmdBindIndexBuffer(commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+
+    vkCmdBindDescriptorSets(commandBuffer,
+                            VK_PIPELINE_BIND_POINT_GRAPHICS,
+                            context.gridPipelineLayout,
+                            0,
+                            1,
+                            &m_descriptorSet,
+                            0,
+                            nullptr);
+
+    const VkExtent2D cell = cellExtent(extent);
+    GridPushConstants constants{};
+    constants.view = view;
+    constants.viewportX = static_cast<float>(viewportOffset.x);
+    constants.viewportY = static_cast<float>(viewportOffset.y);
+    constants.viewportWidth = static_cast<float>(viewport.width);
+    constants.viewportHeight = static_cast<float>(viewport.height);
+    constants.cellWidth = static_cast<float>(cell.width);
+    constants.cellHeight = static_cast<float>(cell.height);
+    constants.extentWidth = static_cast<float>(extent.width);
+    constants.extentHeight = static_cast<float>(extent.height);
+    constants.columns = m_columns;
+    constants.shown = m_shown;
+    vkCmdPushConstants(commandBuffer,
+                       context.gridPipelineLayout,
+                       VK_SHADER_STAGE_VERTEX_BIT,
+                       0,
+                       sizeof(GridPushConstants),
+                       &constants);
+
+    vkCmdDrawIndexed(commandBuffer,
+                     indexCount,
+                     static_cast<uint32_t>(m_images.size()),
+                     0,
+                     0,
+                     0);
+}
+
+void GridView::destroy(VkDevice device)
+{
+    if (m_descriptorPool != VK_NULL_HANDLE)
+        vkDestroyDescriptorPool(device, m_descriptorPool, nullptr);
+    m_descriptorPool = VK_NULL_HANDLE;
+    m_descriptorSet = VK_NULL_HANDLE;
+}
@@ -0,0 +1,104 @@
+#ifndef GRIDVIEW_H
+#define GRIDVIEW_H
+
+#include "gputexturecache.h"
+#include "rendercontext.h"
+
+#include <vulkan/vulkan.h>
+
+#include <QString>
+#include <QStringList>
+
+#include <cstdint>
+
+// Push constants of shaders/gridcells.vert, the single view's transform and viewport with the
+// cell layout, all in pixels
+struct GridPushConstants
+{
+    ViewTransform view;
+    float viewportX;
+    float viewportY;
+    float viewportWidth;
+    float viewportHeight;
+    float cellWidth;
+    float cellHeight;
+    float extentWidth;
+    float extentHeight;
+    uint32_t columns;
+    // Bit per cell with an image to show
+    uint32_t shown;
+};
+
+// Images shown side by side in one window with one zoom and pan, in cell order by rows. All
+// cells are one instanced draw sampling one descriptor array, written once every image is
+// resident or has failed, so no frame in flight sees it change. The textures themselves live
+// in the GPU texture cache like browsed ones.
+class GridView
+{
+public:
+    // Cells of the grid, the size of the texture array in shaders/gridsample.frag
+    static const uint32_t MAX_VIEWS = 16;
+
+    GridView() = default;
+
+    // As square as it gets, columns first: two images side by side, sixteen four by four
+    explicit GridView(const QStringList &images);
+
+    bool isEmpty() const { return m_images.isEmpty(); }
+    const QStringList &images() const { return m_images; }
+    uint32_t columns() const { return m_columns; }
+    uint32_t rows() const { return m_rows; }
+
+    // Null until update() has written it
+    VkDescriptorSet descriptorSet() const { return m_descriptorSet; }
+
+    // What zoom and pan work in, what is left over from the division stays clear
+    VkExtent2D cellExtent(VkExtent2D extent) const;
+
+    // The file names of the cells, for the window title
+    QString title() const;
+
+    // Descriptor set layout and pipeline layout of the grid pipeline
+    static void createPipelineLayout(RenderContext &context);
+
+    // Why the grid cannot be drawn, null when it can. A shared context only has the grid
+    // pipeline when the window that set it up showed a grid.
+    const char *unavailableReason(const RenderContext &context,
+                                  bool firstImageTiled,
+                                  bool sharedContext) const;
+
+    // The cell of fileName stays clear, false when it is not in the grid
+    bool markFailed(const QString &fileName);
+
+    // Writes the descriptors once all images are resident or have failed to load and returns
+    // whether they are written. Cells without an image sample placeholder.
+    bool update(const RenderContext &context,
+                GpuTextureCache &textures,
+                VkImageView placeholder);
+
+    // Every cell as an instance of the image quad, placed and clipped by the vertex shader.
+    // view, viewportOffset and viewport are the single view's inside one cell.
+    void draw(VkCommandBuffer commandBuffer,
+              const RenderContext &context,
+              VkBuffer vertexBuffer,
+              VkBuffer indexBuffer,
+              uint32_t indexCount,
+              const ViewTransform &view,
+              VkOffset2D viewportOffset,
+              VkExtent2D viewport,
+              VkExtent2D extent) const;
+
+    // Frames that used the descriptor set must have completed
+    void destroy(VkDevice device);
+
+private:
+    QStringList m_images;
+    uint32_t m_columns = 1;
+    uint32_t m_rows = 1;
+    uint32_t m_shown = 0;
+    uint32_t m_failed = 0;
+    VkDescriptorPool m_descriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet m_descriptorSet = VK_NULL_HANDLE;
+};
+
+#endif // GRIDVIEW_H
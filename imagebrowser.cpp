@@ -0,0 +1,96 @@
+#include "imagebrowser.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QImageReader>
+
+#include <algorithm>
+
+ImageBrowser::ImageBrowser(const QString &fileName, int prefetchCount)
+    : m_prefetchCount(std::max(prefetchCount, 0))
+{
+    QStringList nameFilters;
+    for (const QByteArray &format : QImageReader::supportedImageFormats()) {
+        nameFilters << "*." + QString::fromLatin1(format);
+    }
+    const QFileInfo info(fileName);
+    const QDir directory = info.absoluteDir();
+    for (const QString &name :
+         directory.entryList(nameFilters, QDir::Files, QDir::Name | QDir::IgnoreCase)) {
+        m_images << directory.absoluteFilePath(name);
+    }
+
+    // Opened under a suffix the listing does not know, browse just that one
+    m_index = static_cast<int>(m_images.indexOf(info.absoluteFilePath()));
+    if (m_index < 0) {
+        m_images = QStringList{info.absoluteFilePath()};
+        m_index = 0;
+    }
+}
+
+QString ImageBrowser::current() const
+{
+    if (m_images.isEmpty())
+        return QString();
+    return m_images[m_index];
+}
+
+int ImageBrowser::indexForKey(int key) const
+{
+    switch (key) {
+    case Qt::Key_Right:
+    case Qt::Key_Down:
+    case Qt::Key_PageDown:
+    case Qt::Key_Space:
+        return m_index + 1;
+    case Qt::Key_Left:
+    case Qt::Key_Up:
+    case Qt::Key_PageUp:
+    case Qt::Key_Backspace:
+        return m_index - 1;
+    case Qt::Key_Home:
+        return 0;
+    case Qt::Key_End:
+        return size() - 1;
+    default:
+        return m_index;
+    }
+}
+
+bool ImageBrowser::moveTo(int index)
+{
+    if (m_images.isEmpty())
+        return false;
+
+    index = std::clamp(index, 0, size() - 1);
+    if (index == m_index)
+        return false;
+
+    m_index = index;
+    return true;
+}
+
+QStringList ImageBrowser::prefetchWindow() const
+{
+    if (m_images.isEmpty())
+        return QStringList();
+
+    // Nearest first, so the next image in either direction is loaded before the one after
+    QStringList window{m_images[m_index]};
+    for (int distance = 1; distance <= m_prefetchCount; distance++) {
+        if (m_index + distance < size())
+            window << m_images[m_index + distance];
+        if (m_index - distance >= 0)
+            window << m_images[m_index - distance];
+    }
+    return window;
+}
+
+bool ImageBrowser::takeWanted(const QString &fileName)
+{
+    if (m_wanted.isEmpty() || fileName != m_wanted)
+        return false;
+
+    m_wanted.clear();
+    return true;
+}
@@ -0,0 +1,50 @@
+#ifndef IMAGEBROWSER_H
+#define IMAGEBROWSER_H
+
+#include <QString>
+#include <QStringList>
+
+// Next and previous image in the directory of the opened one, sorted by name. The current
+// image and its neighbours make up the prefetch window, what a window keeps loaded ahead in
+// the GPU texture cache. Loading and showing the textures is up to the window.
+class ImageBrowser
+{
+public:
+    ImageBrowser() = default;
+
+    // Lists the images in the directory of fileName that Qt can read, fileName is current.
+    // prefetchCount neighbours each way are loaded ahead.
+    ImageBrowser(const QString &fileName, int prefetchCount);
+
+    bool isEmpty() const { return m_images.isEmpty(); }
+    int size() const { return static_cast<int>(m_images.size()); }
+    int index() const { return m_index; }
+    int prefetchCount() const { return m_prefetchCount; }
+
+    // The image moveTo() moved to last
+    QString current() const;
+
+    // Where a browsing key moves to, the current index for other keys
+    int indexForKey(int key) const;
+
+    // Clamps index to the list, false when it is already current
+    bool moveTo(int index);
+
+    // The current image and the neighbours that are loaded ahead, nearest first
+    QStringList prefetchWindow() const;
+
+    // Shown as soon as its load finishes, until then the previous image stays up. Empty when
+    // the current image is shown.
+    void setWanted(const QString &fileName) { m_wanted = fileName; }
+
+    // True once for the wanted image, which then no longer is
+    bool takeWanted(const QString &fileName);
+
+private:
+    QStringList m_images;
+    int m_index = 0;
+    int m_prefetchCount = 0;
+    QString m_wanted;
+};
+
+#endif // IMAGEBROWSER_H
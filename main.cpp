@@ -1,13 +1,94 @@
 #include "vulkanwindow.h"
 
 #include <QApplication>
+#include <QCommandLineParser>
 
 int main(int argc, char *argv[])
 {
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Vulkan image viewer");
+    parser.addHelpOption();
+    parser.addPositionalArgument("images",
+                                 "Images to open, each in its own window sharing one device. "
+                                 "Asks for one when omitted.",
+                                 "[images...]");
+
+    QCommandLineOption outputOption("output",
+                                    "Render one frame offscreen and write it to <file>.",
+                                    "file");
+    QCommandLineOption sizeOption("size", "Size of the offscreen frame.", "WxH", "800x600");
+    QCommandLineOption zoomOption("zoom",
+                                  "Initial zoom, snapped to the mouse wheel steps.",
+                                  "factor",
+                                  "1");
+    QCommandLineOption panOption("pan", "Initial pan in pixels.", "dx,dy", "0,0");
+    QCommandLineOption gridOption("grid",
+                                  "Show 2 to 16 images side by side in one window, zoomed and "
+                                  "panned together.");
+    parser.addOptions({outputOption, sizeOption, zoomOption, panOption, gridOption});
+
+    // The platform plugin is loaded by the application constructor, so this has to be known
+    // before it runs. The offscreen plugin needs no display server.
+    QStringList arguments;
+    for (int i = 0; i < argc; i++) {
+        arguments << QString::fromLocal8Bit(argv[i]);
+    }
+    if (parser.parse(arguments) && parser.isSet(outputOption)
+        && !qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
     QApplication a(argc, argv);
+    parser.process(a);
+
+    VulkanWindow::Options options;
+    options.outputFile = parser.value(outputOption);
+    QStringList images = parser.positionalArguments();
+    if (parser.isSet(gridOption)) {
+        if (images.size() < 2 || images.size() > 16)
+            qFatal("--grid takes 2 to 16 images!");
+        options.gridImages = images;
+    }
+    if (!images.isEmpty())
+        options.imageName = images.takeFirst();
+    if (options.gridImages.isEmpty())
+        options.windowImages = images;
+
+    bool widthOk = false;
+    bool heightOk = false;
+    const QStringList size = parser.value(sizeOption).split('x');
+    if (size.size() == 2)
+        options.outputSize = QSize(size[0].toInt(&widthOk), size[1].toInt(&heightOk));
+    if (!widthOk || !heightOk || options.outputSize.isEmpty())
+        qFatal("Invalid --size, expected WxH!");
+
+    bool zoomOk = false;
+    options.zoom = parser.value(zoomOption).toFloat(&zoomOk);
+    if (!zoomOk || options.zoom <= 0)
+        qFatal("Invalid --zoom!");
+
+    bool dxOk = false;
+    bool dyOk = false;
+    const QStringList pan = parser.value(panOption).split(',');
+    if (pan.size() == 2)
+        options.pan = QPoint(pan[0].toInt(&dxOk), pan[1].toInt(&dyOk));
+    if (!dxOk || !dyOk)
+        qFatal("Invalid --pan, expected dx,dy!");
+
+    if (!options.outputFile.isEmpty() && options.imageName.isEmpty())
+        qFatal("An image is required with --output!");
+    if (!options.outputFile.isEmpty()
+        && (!options.windowImages.isEmpty() || !options.gridImages.isEmpty())) {
+        qFatal("Only one image can be rendered with --output!");
+    }
+
+    Tracer::setThreadName("main");
 
-    VulkanWindow app;
-    app.show();
+    VulkanWindow app(options);
+    if (options.outputFile.isEmpty())
+        app.show();
 
-    return a.exec();
+    const int status = a.exec();
+    Tracer::write();
+    return status;
 }
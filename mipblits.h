@@ -0,0 +1,20 @@
+#ifndef MIPBLITS_H
+#define MIPBLITS_H
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+
+// Records the blit chain that fills levels 1 and up of image from level 0. Every level must
+// be in TRANSFER_DST_OPTIMAL on entry and ends in finalLayout, made visible to dstAccess at
+// dstStage. The format must support linear filtering with optimal tiling.
+void recordMipBlits(VkCommandBuffer commandBuffer,
+                    VkImage image,
+                    int32_t width,
+                    int32_t height,
+                    uint32_t levelCount,
+                    VkImageLayout finalLayout,
+                    VkPipelineStageFlags dstStage,
+                    VkAccessFlags dstAccess);
+
+#endif // MIPBLITS_H
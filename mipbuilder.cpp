@@ -0,0 +1,312 @@
+#include "mipbuilder.h"
+
+#include "threadpool.h"
+#include "tracer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#define MIP_X86
+#if defined(__GNUC__)
+#define MIP_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define MIP_TARGET_AVX2
+#endif
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+// Rows below this are cheaper to do on one thread than to hand out
+const uint32_t ROWS_PER_TASK = 16;
+
+struct ColorTables
+{
+    uint16_t toLinear[256];
+    uint8_t toSrgb[65536];
+
+    ColorTables()
+    {
+        for (int i = 0; i < 256; i++) {
+            const double c = i / 255.0;
+            const double linear = c <= 0.04045 ? c / 12.92 : std::pow((c + 0.055) / 1.055, 2.4);
+            toLinear[i] = static_cast<uint16_t>(std::lround(linear * 65535.0));
+        }
+        for (int i = 0; i < 65536; i++) {
+            const double linear = i / 65535.0;
+            const double c = linear <= 0.0031308 ? linear * 12.92
+                                                 : 1.055 * std::pow(linear, 1.0 / 2.4) - 0.055;
+            toSrgb[i] = static_cast<uint8_t>(std::lround(std::clamp(c, 0.0, 1.0) * 255.0));
+        }
+    }
+};
+
+const ColorTables &colorTables()
+{
+    static const ColorTables tables;
+    return tables;
+}
+
+// RGBA8 with sRGB colors to 16 bit linear RGBA
+void expandRow(const uint8_t *src, uint16_t *dst, uint32_t count, const ColorTables &tables)
+{
+    for (uint32_t i = 0; i < count * 4; i += 4) {
+        dst[i + 0] = tables.toLinear[src[i + 0]];
+        dst[i + 1] = tables.toLinear[src[i + 1]];
+        dst[i + 2] = tables.toLinear[src[i + 2]];
+        dst[i + 3] = static_cast<uint16_t>(src[i + 3] * 257);
+    }
+}
+
+void encodeRow(const uint16_t *src, uint8_t *dst, uint32_t count, const ColorTables &tables)
+{
+    for (uint32_t i = 0; i < count * 4; i += 4) {
+        dst[i + 0] = tables.toSrgb[src[i + 0]];
+        dst[i + 1] = tables.toSrgb[src[i + 1]];
+        dst[i + 2] = tables.toSrgb[src[i + 2]];
+        dst[i + 3] = static_cast<uint8_t>((src[i + 3] + 128) / 257);
+    }
+}
+
+// Averages 2x2 blocks of two linear rows, returns how many output texels were done
+uint32_t reduce2x2Scalar(const uint16_t *row0, const uint16_t *row1, uint16_t *dst, uint32_t count)
+{
+    for (uint32_t i = 0; i < count * 4; i++) {
+        const uint32_t p = (i / 4) * 8 + i % 4;
+        dst[i] = static_cast<uint16_t>((row0[p] + row0[p + 4] + row1[p] + row1[p + 4] + 2) >> 2);
+    }
+    return count;
+}
+
+#if defined(MIP_X86)
+bool hasAvx2()
+{
+#if defined(__GNUC__)
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+#else
+    return false;
+#endif
+}
+
+MIP_TARGET_AVX2 uint32_t reduce2x2Avx2(const uint16_t *row0,
+                                       const uint16_t *row1,
+                                       uint16_t *dst,
+                                       uint32_t count)
+{
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const __m256i *a = reinterpret_cast<const __m256i *>(row0 + i * 8);
+        const __m256i *b = reinterpret_cast<const __m256i *>(row1 + i * 8);
+
+        // Each 128 bit lane holds two texels
+        __m256i v0 = _mm256_avg_epu16(_mm256_loadu_si256(a), _mm256_loadu_si256(b));
+        __m256i v1 = _mm256_avg_epu16(_mm256_loadu_si256(a + 1), _mm256_loadu_si256(b + 1));
+        __m256i even = _mm256_unpacklo_epi64(v0, v1);
+        __m256i odd = _mm256_unpackhi_epi64(v0, v1);
+        // Results come out as texels 0, 2 | 1, 3
+        __m256i sum = _mm256_avg_epu16(even, odd);
+        sum = _mm256_permute4x64_epi64(sum, _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i * 4), sum);
+    }
+    return i;
+}
+
+uint32_t reduce2x2Sse2(const uint16_t *row0, const uint16_t *row1, uint16_t *dst, uint32_t count)
+{
+    uint32_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const __m128i *a = reinterpret_cast<const __m128i *>(row0 + i * 8);
+        const __m128i *b = reinterpret_cast<const __m128i *>(row1 + i * 8);
+
+        __m128i v0 = _mm_avg_epu16(_mm_loadu_si128(a), _mm_loadu_si128(b));
+        __m128i v1 = _mm_avg_epu16(_mm_loadu_si128(a + 1), _mm_loadu_si128(b + 1));
+        __m128i even = _mm_unpacklo_epi64(v0, v1);
+        __m128i odd = _mm_unpackhi_epi64(v0, v1);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i * 4), _mm_avg_epu16(even, odd));
+    }
+    return i;
+}
+#elif defined(__ARM_NEON)
+uint32_t reduce2x2Neon(const uint16_t *row0, const uint16_t *row1, uint16_t *dst, uint32_t count)
+{
+    uint32_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        uint16x8_t v0 = vrhaddq_u16(vld1q_u16(row0 + i * 8), vld1q_u16(row1 + i * 8));
+        uint16x8_t v1 = vrhaddq_u16(vld1q_u16(row0 + i * 8 + 8), vld1q_u16(row1 + i * 8 + 8));
+        uint16x8_t even = vcombine_u16(vget_low_u16(v0), vget_low_u16(v1));
+        uint16x8_t odd = vcombine_u16(vget_high_u16(v0), vget_high_u16(v1));
+        vst1q_u16(dst + i * 4, vrhaddq_u16(even, odd));
+    }
+    return i;
+}
+#endif
+
+void reduce2x2(const uint16_t *row0, const uint16_t *row1, uint16_t *dst, uint32_t count)
+{
+    uint32_t done = 0;
+#if defined(MIP_X86)
+    if (hasAvx2())
+        done = reduce2x2Avx2(row0, row1, dst, count);
+    done += reduce2x2Sse2(row0 + done * 8, row1 + done * 8, dst + done * 4, count - done);
+#elif defined(__ARM_NEON)
+    done = reduce2x2Neon(row0, row1, dst, count);
+#endif
+    reduce2x2Scalar(row0 + done * 8, row1 + done * 8, dst + done * 4, count - done);
+}
+
+// Source texels covered by one destination texel along one axis, with their coverage
+struct Footprint
+{
+    uint32_t first;
+    uint32_t count;
+    float weights[4];
+};
+
+std::vector<Footprint> footprints(uint32_t srcSize, uint32_t dstSize)
+{
+    const double scale = double(srcSize) / dstSize;
+
+    std::vector<Footprint> result(dstSize);
+    for (uint32_t i = 0; i < dstSize; i++) {
+        const double start = i * scale;
+        const double end = (i + 1) * scale;
+
+        Footprint &footprint = result[i];
+        footprint.first = static_cast<uint32_t>(start);
+        footprint.count = 0;
+        for (uint32_t texel = footprint.first; texel < end && footprint.count < 4; texel++) {
+            const double overlap = std::min<double>(texel + 1, end)
+                                   - std::max<double>(texel, start);
+            footprint.weights[footprint.count++] = static_cast<float>(overlap / scale);
+        }
+    }
+    return result;
+}
+
+void reduceLevel(const uint8_t *src,
+                 const MipLevel &srcLevel,
+                 uint8_t *dst,
+                 const MipLevel &dstLevel,
+                 ThreadPool &pool)
+{
+    const ColorTables &tables = colorTables();
+    const size_t srcStride = size_t(srcLevel.width) * 4;
+    const size_t dstStride = size_t(dstLevel.width) * 4;
+    const bool exactHalf = srcLevel.width == dstLevel.width * 2
+                           && srcLevel.height == dstLevel.height * 2;
+
+    if (exactHalf) {
+        pool.parallelFor(dstLevel.height, ROWS_PER_TASK, [&](size_t begin, size_t end) {
+            std::vector<uint16_t> row0(srcStride), row1(srcStride), reduced(dstStride);
+            for (size_t y = begin; y < end; y++) {
+                expandRow(src + (2 * y) * srcStride, row0.data(), srcLevel.width, tables);
+                expandRow(src + (2 * y + 1) * srcStride, row1.data(), srcLevel.width, tables);
+                reduce2x2(row0.data(), row1.data(), reduced.data(), dstLevel.width);
+                encodeRow(reduced.data(), dst + y * dstStride, dstLevel.width, tables);
+            }
+        });
+        return;
+    }
+
+    const auto columns = footprints(srcLevel.width, dstLevel.width);
+    const auto rows = footprints(srcLevel.height, dstLevel.height);
+
+    pool.parallelFor(dstLevel.height, ROWS_PER_TASK, [&](size_t begin, size_t end) {
+        std::vector<uint16_t> linear(srcStride), reduced(dstStride);
+        std::vector<float> accumulated(srcStride);
+
+        for (size_t y = begin; y < end; y++) {
+            // Rows are blended in float first, then each output texel blends its columns
+            std::fill(accumulated.begin(), accumulated.end(), 0.0f);
+            const Footprint &row = rows[y];
+            for (uint32_t j = 0; j < row.count; j++) {
+                expandRow(src + (row.first + j) * srcStride, linear.data(), srcLevel.width, tables);
+                for (size_t i = 0; i < srcStride; i++) {
+                    accumulated[i] += linear[i] * row.weights[j];
+                }
+            }
+
+            for (uint32_t x = 0; x < dstLevel.width; x++) {
+                const Footprint &column = columns[x];
+                for (int c = 0; c < 4; c++) {
+                    float sum = 0.0f;
+                    for (uint32_t k = 0; k < column.count; k++) {
+                        sum += accumulated[(column.first + k) * 4 + c] * column.weights[k];
+                    }
+                    reduced[x * 4 + c] = static_cast<uint16_t>(std::min(sum + 0.5f, 65535.0f));
+                }
+            }
+
+            encodeRow(reduced.data(), dst + y * dstStride, dstLevel.width, tables);
+        }
+    });
+}
+} // namespace
+
+std::vector<MipLevel> mipChainLayout(uint32_t width,
+                                     uint32_t height,
+                                     uint32_t levelCount,
+                                     uint32_t blockBytes)
+{
+    std::vector<MipLevel> levels(levelCount);
+    size_t offset = 0;
+    for (uint32_t i = 0; i < levelCount; i++) {
+        const size_t size = blockBytes ? size_t((width + 3) / 4) * ((height + 3) / 4) * blockBytes
+                                       : size_t(width) * height * 4;
+        levels[i] = {offset, width, height, size};
+        offset += size;
+        width = std::max(width / 2, 1u);
+        height = std::max(height / 2, 1u);
+    }
+    return levels;
+}
+
+size_t mipChainSize(const std::vector<MipLevel> &levels)
+{
+    if (levels.empty())
+        return 0;
+
+    return levels.back().offset + levels.back().size;
+}
+
+void buildMipChain(uint8_t *pixels, const std::vector<MipLevel> &levels, ThreadPool &pool)
+{
+    for (size_t i = 1; i < levels.size(); i++) {
+        TRACE_SCOPE("mip level");
+        reduceLevel(pixels + levels[i - 1].offset,
+                    levels[i - 1],
+                    pixels + levels[i].offset,
+                    levels[i],
+                    pool);
+    }
+}
+
+void halveRegion(const uint8_t *src,
+                 size_t srcStride,
+                 uint32_t width,
+                 uint32_t height,
+                 uint8_t *dst,
+                 size_t dstStride)
+{
+    const ColorTables &tables = colorTables();
+    const uint32_t dstWidth = (width + 1) / 2;
+
+    // Padded to an even width by repeating the last texel
+    std::vector<uint16_t> row0(size_t(dstWidth) * 8), row1(size_t(dstWidth) * 8);
+    std::vector<uint16_t> reduced(size_t(dstWidth) * 4);
+    auto expand = [&](uint32_t y, std::vector<uint16_t> &row) {
+        expandRow(src + y * srcStride, row.data(), width, tables);
+        if (width & 1)
+            std::copy_n(&row[size_t(width - 1) * 4], 4, &row[size_t(width) * 4]);
+    };
+
+    for (uint32_t y = 0; y * 2 < height; y++) {
+        expand(y * 2, row0);
+        expand(std::min(y * 2 + 1, height - 1), row1);
+        reduce2x2(row0.data(), row1.data(), reduced.data(), dstWidth);
+        encodeRow(reduced.data(), dst + y * dstStride, dstWidth, tables);
+    }
+}
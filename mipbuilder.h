@@ -0,0 +1,41 @@
+#ifndef MIPBUILDER_H
+#define MIPBUILDER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class ThreadPool;
+
+struct MipLevel
+{
+    size_t offset;
+    uint32_t width;
+    uint32_t height;
+    // Bytes of the level
+    size_t size;
+};
+
+// Tightly packed levels, one after the other, level 0 at offset 0. RGBA8 texels by default,
+// 4x4 blocks of blockBytes each for a block compressed format.
+std::vector<MipLevel> mipChainLayout(uint32_t width,
+                                     uint32_t height,
+                                     uint32_t levelCount,
+                                     uint32_t blockBytes = 0);
+
+size_t mipChainSize(const std::vector<MipLevel> &levels);
+
+// Fills levels 1 and up from level 0 with a box filter in linear light. Colors are sRGB
+// encoded, alpha is linear. Odd sizes blend three texels by their exact coverage.
+void buildMipChain(uint8_t *pixels, const std::vector<MipLevel> &levels, ThreadPool &pool);
+
+// Halves width x height RGBA8 texels the same way, into (width + 1) / 2 by (height + 1) / 2.
+// An odd last column or row only averages itself, for pyramids built a tile at a time.
+void halveRegion(const uint8_t *src,
+                 size_t srcStride,
+                 uint32_t width,
+                 uint32_t height,
+                 uint8_t *dst,
+                 size_t dstStride);
+
+#endif // MIPBUILDER_H
@@ -0,0 +1,156 @@
+#include "pipelinecache.h"
+
+#include "tracer.h"
+
+#include <QByteArray>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+const char MAGIC[4] = {'V', 'I', 'V', 'P'};
+const uint32_t VERSION = 1;
+
+// Followed by dataSize bytes of vkGetPipelineCacheData output
+struct FileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint32_t reserved;
+    uint64_t dataSize;
+    uint64_t checksum;
+};
+static_assert(sizeof(FileHeader) == 56, "pipeline cache header must stay 56 bytes");
+
+// FNV-1a, only meant to catch truncated or corrupted files, which some drivers crash on
+uint64_t checksum(const uint8_t *data, size_t size)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+} // namespace
+
+PipelineCache::PipelineCache(VkDevice device, VkPhysicalDevice physicalDevice)
+    : m_device(device)
+{
+    TRACE_FUNCTION();
+
+    if (qgetenv("VIV_PIPELINE_CACHE") == "0")
+        return;
+
+    vkGetPhysicalDeviceProperties(physicalDevice, &m_properties);
+
+    m_directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+                  + "/pipelines";
+
+    QByteArray data;
+    QFile file(filePath());
+    if (file.open(QIODevice::ReadOnly) && file.size() >= qint64(sizeof(FileHeader)))
+        data = file.readAll();
+
+    FileHeader header{};
+    if (data.size() >= qint64(sizeof(header)))
+        memcpy(&header, data.constData(), sizeof(header));
+    const auto *payload = reinterpret_cast<const uint8_t *>(data.constData()) + sizeof(header);
+
+    // The driver checks its own header as well, this also catches driver updates that keep
+    // the UUID and files cut short by a crash
+    const bool valid = data.size() >= qint64(sizeof(header))
+                       && memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0
+                       && header.version == VERSION
+                       && header.vendorID == m_properties.vendorID
+                       && header.deviceID == m_properties.deviceID
+                       && header.driverVersion == m_properties.driverVersion
+                       && memcmp(header.pipelineCacheUUID,
+                                 m_properties.pipelineCacheUUID,
+                                 VK_UUID_SIZE)
+                              == 0
+                       && header.dataSize + sizeof(header) == uint64_t(data.size())
+                       && header.checksum == checksum(payload, size_t(header.dataSize));
+    if (!data.isEmpty() && !valid && Tracer::statsEnabled())
+        qDebug() << "pipeline cache" << filePath() << "does not match this device, ignored";
+
+    VkPipelineCacheCreateInfo cacheInfo{};
+    cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    if (valid) {
+        cacheInfo.initialDataSize = size_t(header.dataSize);
+        cacheInfo.pInitialData = payload;
+    }
+
+    if (vkCreatePipelineCache(m_device, &cacheInfo, nullptr, &m_cache) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline cache!");
+    }
+    m_loadedSize = cacheInfo.initialDataSize;
+}
+
+PipelineCache::~PipelineCache()
+{
+    if (m_cache != VK_NULL_HANDLE)
+        vkDestroyPipelineCache(m_device, m_cache, nullptr);
+}
+
+void PipelineCache::save()
+{
+    TRACE_FUNCTION();
+
+    if (m_cache == VK_NULL_HANDLE)
+        return;
+
+    size_t size = 0;
+    if (vkGetPipelineCacheData(m_device, m_cache, &size, nullptr) != VK_SUCCESS || size == 0)
+        return;
+
+    // Drivers only ever add to a cache, the same size means nothing new was compiled
+    if (size == m_loadedSize)
+        return;
+
+    std::vector<uint8_t> data(size);
+    if (vkGetPipelineCacheData(m_device, m_cache, &size, data.data()) != VK_SUCCESS)
+        return;
+
+    FileHeader header{};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.vendorID = m_properties.vendorID;
+    header.deviceID = m_properties.deviceID;
+    header.driverVersion = m_properties.driverVersion;
+    memcpy(header.pipelineCacheUUID, m_properties.pipelineCacheUUID, VK_UUID_SIZE);
+    header.dataSize = size;
+    header.checksum = checksum(data.data(), size);
+
+    QSaveFile file(filePath());
+    if (!QDir().mkpath(m_directory) || !file.open(QIODevice::WriteOnly)
+        || file.write(reinterpret_cast<const char *>(&header), sizeof(header))
+               != qint64(sizeof(header))
+        || file.write(reinterpret_cast<const char *>(data.data()), qint64(size)) != qint64(size)
+        || !file.commit()) {
+        qWarning() << "failed to write pipeline cache" << filePath();
+        return;
+    }
+    m_loadedSize = size;
+    if (Tracer::statsEnabled())
+        qDebug() << "pipeline cache saved," << size / 1024 << "KiB";
+}
+
+QString PipelineCache::filePath() const
+{
+    // One file per device, so switching GPUs does not keep discarding the other's cache
+    return m_directory
+           + QString("/%1-%2.vpc")
+                 .arg(m_properties.vendorID, 4, 16, QChar('0'))
+                 .arg(m_properties.deviceID, 4, 16, QChar('0'));
+}
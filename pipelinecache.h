@@ -0,0 +1,41 @@
+#ifndef PIPELINECACHE_H
+#define PIPELINECACHE_H
+
+#include <vulkan/vulkan.h>
+
+#include <QString>
+
+#include <cstddef>
+
+// VkPipelineCache kept on disk between runs, so drivers that compile shaders at pipeline
+// creation only do it once. The file is only loaded when its vendor, device, driver version
+// and pipelineCacheUUID match the running device, and when its checksum holds; anything
+// else starts with an empty cache that replaces the file on save.
+//
+// VIV_PIPELINE_CACHE=0 turns it off, handle() is then VK_NULL_HANDLE. The handle is
+// internally synchronized, so pipelines may be created with it from several threads.
+class PipelineCache
+{
+public:
+    PipelineCache(VkDevice device, VkPhysicalDevice physicalDevice);
+    ~PipelineCache();
+
+    VkPipelineCache handle() const { return m_cache; }
+
+    // Whether data from an earlier run was loaded
+    bool isWarm() const { return m_loadedSize > 0; }
+
+    // Writes the cache back when pipelines were added since it was loaded
+    void save();
+
+private:
+    QString filePath() const;
+
+    VkDevice m_device;
+    VkPhysicalDeviceProperties m_properties{};
+    VkPipelineCache m_cache = VK_NULL_HANDLE;
+    QString m_directory;
+    size_t m_loadedSize = 0;
+};
+
+#endif // PIPELINECACHE_H
@@ -0,0 +1,61 @@
+#include "rendercontext.h"
+
+namespace {
+std::weak_ptr<RenderContext> &sharedContext()
+{
+    static std::weak_ptr<RenderContext> context;
+    return context;
+}
+} // namespace
+
+RenderContext::~RenderContext()
+{
+    if (device != VK_NULL_HANDLE) {
+        // Textures and the pipeline cache go before the allocator and device they use
+        textures.reset();
+
+        vkDestroyPipeline(device, graphicsPipeline, nullptr);
+        vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+        vkDestroyPipeline(device, mipPipeline, nullptr);
+        vkDestroyPipelineLayout(device, mipPipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device, mipDescriptorSetLayout, nullptr);
+        vkDestroyPipeline(device, convertPipeline, nullptr);
+        vkDestroyPipelineLayout(device, convertPipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device, convertDescriptorSetLayout, nullptr);
+        vkDestroyPipeline(device, gridPipeline, nullptr);
+        vkDestroyPipelineLayout(device, gridPipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device, gridDescriptorSetLayout, nullptr);
+        vkDestroyRenderPass(device, renderPass, nullptr);
+        vkDestroyRenderPass(device, damageRenderPass, nullptr);
+        vkDestroySampler(device, textureSampler, nullptr);
+        vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+
+        if (pipelineCache) {
+            pipelineCache->save();
+            pipelineCache.reset();
+        }
+        allocator.reset();
+        vkDestroyDevice(device, nullptr);
+    }
+
+    if (instance == VK_NULL_HANDLE)
+        return;
+
+    if (debugMessenger != VK_NULL_HANDLE) {
+        auto destroyMessenger = (PFN_vkDestroyDebugUtilsMessengerEXT)
+            vkGetInstanceProcAddr(instance, "vkDestroyDebugUtilsMessengerEXT");
+        if (destroyMessenger != nullptr)
+            destroyMessenger(instance, debugMessenger, nullptr);
+    }
+    vkDestroyInstance(instance, nullptr);
+}
+
+std::shared_ptr<RenderContext> RenderContext::shared()
+{
+    return sharedContext().lock();
+}
+
+void RenderContext::share(const std::shared_ptr<RenderContext> &context)
+{
+    sharedContext() = context;
+}
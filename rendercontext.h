@@ -0,0 +1,88 @@
+#ifndef RENDERCONTEXT_H
+#define RENDERCONTEXT_H
+
+#include "deviceallocator.h"
+#include "gputexturecache.h"
+#include "pipelinecache.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <memory>
+
+// Push constants of the image pipeline's vertex shader, and of the grid's with the cell layout
+struct ViewTransform
+{
+    float scaleX;
+    float scaleY;
+    float offsetX;
+    float offsetY;
+};
+
+// What every viewer window on one device shares: the instance and device with their queues
+// and allocator, the graphics and compute pipelines with their layouts, the sampler and the
+// textures of browsed images. The first window creates them in it while it sets up Vulkan,
+// every window reads them from here, later ones only add their surface, swapchain and
+// frame state. Held by shared_ptr, the last
+// window to let go destroys it, after destroying its own surface.
+struct RenderContext
+{
+    // The device must be idle
+    ~RenderContext();
+
+    // The context the windows that are open share, null when there are none
+    static std::shared_ptr<RenderContext> shared();
+
+    // Makes context the one new windows share, offscreen contexts are never shared
+    static void share(const std::shared_ptr<RenderContext> &context);
+
+    VkInstance instance = VK_NULL_HANDLE;
+    VkDebugUtilsMessengerEXT debugMessenger = VK_NULL_HANDLE;
+    VkPhysicalDevice physicalDevice = VK_NULL_HANDLE;
+    VkDevice device = VK_NULL_HANDLE;
+
+    VkQueue graphicsQueue = VK_NULL_HANDLE;
+    VkQueue presentQueue = VK_NULL_HANDLE;
+    VkQueue transferQueue = VK_NULL_HANDLE;
+    uint32_t graphicsFamily = 0;
+    uint32_t presentFamily = 0;
+    uint32_t transferFamily = 0;
+
+    // Present regions let the compositor update only what changed
+    bool incrementalPresent = false;
+    // A single framebuffer takes the swapchain image view when the render pass begins, so
+    // only an extent change replaces it
+    bool imagelessFramebuffer = false;
+    bool pipelineStatistics = false;
+    // Grid cells index the texture array by instance, which is not dynamically uniform
+    bool nonUniformTextureIndexing = false;
+
+    std::unique_ptr<DeviceAllocator> allocator;
+    std::unique_ptr<PipelineCache> pipelineCache;
+
+    // Made for the swapchain format of the first window, later ones must present in it
+    VkFormat swapChainImageFormat = VK_FORMAT_UNDEFINED;
+    VkRenderPass renderPass = VK_NULL_HANDLE;
+    // Compatible with renderPass, but keeps the presented contents outside the render area
+    VkRenderPass damageRenderPass = VK_NULL_HANDLE;
+    VkDescriptorSetLayout descriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+    VkPipeline graphicsPipeline = VK_NULL_HANDLE;
+    VkSampler textureSampler = VK_NULL_HANDLE;
+
+    VkDescriptorSetLayout mipDescriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout mipPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline mipPipeline = VK_NULL_HANDLE;
+    VkDescriptorSetLayout convertDescriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout convertPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline convertPipeline = VK_NULL_HANDLE;
+    // Only made when the first window shows a grid
+    VkDescriptorSetLayout gridDescriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout gridPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline gridPipeline = VK_NULL_HANDLE;
+
+    // Null until a window browses, tiled and offscreen windows do not
+    std::unique_ptr<GpuTextureCache> textures;
+};
+
+#endif // RENDERCONTEXT_H
@@ -1,11 +1,11 @@
 #version 450
 
-layout(binding = 0) uniform UniformBufferObject {
+layout(push_constant) uniform ViewTransform {
     float scaleX;
     float scaleY;
     float offsetX;
     float offsetY;
-} ubo;
+} view;
 
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec2 inTexCoord;
@@ -14,8 +14,8 @@ layout(location = 0) out vec2 fragTexCoord;
 
 void main() {
     gl_Position = vec4(
-        inPosition.x * ubo.scaleX + ubo.offsetX,
-        inPosition.y * ubo.scaleY + ubo.offsetY,
+        inPosition.x * view.scaleX + view.offsetX,
+        inPosition.y * view.scaleY + view.offsetY,
         0.0,
         1.0
     );
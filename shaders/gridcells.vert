@@ -0,0 +1,66 @@
+#version 450
+
+// Draws the image quad once per grid cell, the instance is the cell. Every cell shows the
+// same view: the transform and viewport of the single view, taken relative to the cell.
+// All cells share one viewport, so each quad is clipped to its cell here. The quad is axis
+// aligned, clamping its corners clips it exactly.
+
+layout(push_constant) uniform GridTransform {
+    float scaleX;
+    float scaleY;
+    float offsetX;
+    float offsetY;
+    // Viewport of the single view inside a cell, in pixels
+    float viewportX;
+    float viewportY;
+    float viewportWidth;
+    float viewportHeight;
+    float cellWidth;
+    float cellHeight;
+    float extentWidth;
+    float extentHeight;
+    uint columns;
+    // Bit per cell with an image to show
+    uint shown;
+} grid;
+
+layout(location = 0) in vec2 inPosition;
+// Always inPosition mapped to 0..1, so it is derived from the clipped corner instead
+layout(location = 1) in vec2 inTexCoord;
+
+layout(location = 0) out vec2 fragTexCoord;
+layout(location = 1) flat out uint fragCell;
+
+void main() {
+    uint cell = uint(gl_InstanceIndex);
+    fragCell = cell;
+
+    // All corners on one point, nothing is rasterized and the cell stays clear
+    if ((grid.shown & (1u << cell)) == 0u) {
+        gl_Position = vec4(0.0, 0.0, 0.0, 1.0);
+        fragTexCoord = inTexCoord;
+        return;
+    }
+
+    vec2 scale = vec2(grid.scaleX, grid.scaleY);
+    vec2 offset = vec2(grid.offsetX, grid.offsetY);
+    vec2 viewportOrigin = vec2(grid.viewportX, grid.viewportY);
+    vec2 viewportSize = max(vec2(grid.viewportWidth, grid.viewportHeight), vec2(1.0));
+    vec2 cellSize = vec2(grid.cellWidth, grid.cellHeight);
+
+    // Where the single view puts this corner, in cell pixels
+    vec2 position = inPosition * scale + offset;
+    vec2 pixel = viewportOrigin + (position * 0.5 + 0.5) * viewportSize;
+
+    // Inside both the viewport and the cell, a quad outside either collapses to an edge
+    vec2 low = max(viewportOrigin, vec2(0.0));
+    vec2 high = min(viewportOrigin + viewportSize, cellSize);
+    vec2 clipped = min(max(pixel, low), high);
+
+    vec2 clippedPosition = (clipped - viewportOrigin) / viewportSize * 2.0 - 1.0;
+    fragTexCoord = (clippedPosition - offset) / scale * 0.5 + 0.5;
+
+    vec2 cellOrigin = vec2(cell % grid.columns, cell / grid.columns) * cellSize;
+    vec2 extent = vec2(grid.extentWidth, grid.extentHeight);
+    gl_Position = vec4((cellOrigin + clipped) / extent * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -0,0 +1,17 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// The cell's own texture. One draw covers every cell, so the index differs between
+// invocations of the draw and has to be marked non-uniform.
+
+// GridView::MAX_VIEWS in gridview.h
+layout(binding = 1) uniform sampler2D textures[16];
+
+layout(location = 0) in vec2 fragTexCoord;
+layout(location = 1) flat in uint fragCell;
+
+layout(location = 0) out vec4 outColor;
+
+void main() {
+    outColor = texture(textures[nonuniformEXT(fragCell)], fragTexCoord);
+}
@@ -0,0 +1,217 @@
+#include "texturecache.h"
+
+#include "mipbuilder.h"
+#include "tracer.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QSettings>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+const char MAGIC[4] = {'V', 'I', 'V', 'T'};
+const uint32_t VERSION = 1;
+const qint64 DEFAULT_MAX_MIB = 2048;
+
+// Pixels start right after the header, which keeps them 16 byte aligned in the mapping
+struct EntryHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levelCount;
+    // 0 for RGBA8 texels, else the bytes of a compressed 4x4 block
+    uint32_t blockBytes;
+    uint64_t size;
+};
+static_assert(sizeof(EntryHeader) == 32, "cache entry header must stay 32 bytes");
+
+uint32_t fullLevelCount(uint32_t width, uint32_t height)
+{
+    uint32_t levels = 1;
+    for (uint32_t size = std::max(width, height); size > 1; size /= 2) {
+        levels++;
+    }
+    return levels;
+}
+} // namespace
+
+TextureCache::TextureCache()
+{
+    m_enabled = qgetenv("VIV_TEXTURE_CACHE") != "0";
+
+    m_directory = qEnvironmentVariable("VIV_TEXTURE_CACHE_DIR");
+    if (m_directory.isEmpty()) {
+        m_directory = QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+                      + "/textures";
+    }
+
+    bool ok = false;
+    const qint64 maxMiB = qgetenv("VIV_TEXTURE_CACHE_SIZE").toULongLong(&ok);
+    m_maxBytes = (ok ? maxMiB : DEFAULT_MAX_MIB) * 1024 * 1024;
+
+    if (m_enabled && !QDir().mkpath(m_directory)) {
+        qWarning() << "texture cache disabled, cannot create" << m_directory;
+        m_enabled = false;
+    }
+}
+
+TextureCache::~TextureCache()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    saveStats();
+}
+
+QString TextureCache::key(const QString &fileName, const QString &format) const
+{
+    QFileInfo info(fileName);
+    if (!m_enabled || !info.isFile())
+        return {};
+
+    QCryptographicHash hash(QCryptographicHash::Sha256);
+    hash.addData(info.canonicalFilePath().toUtf8());
+    hash.addData(QByteArray::number(info.size()));
+    hash.addData(QByteArray::number(info.lastModified().toMSecsSinceEpoch()));
+    hash.addData(format.toUtf8());
+    return QString::fromLatin1(hash.result().toHex());
+}
+
+std::unique_ptr<CachedTexture> TextureCache::find(const QString &key)
+{
+    if (key.isEmpty())
+        return nullptr;
+
+    auto entry = std::make_unique<CachedTexture>();
+    entry->file.setFileName(entryPath(key));
+
+    bool hit = false;
+    if (entry->file.open(QIODevice::ReadOnly)
+        && entry->file.size() >= qint64(sizeof(EntryHeader))) {
+        const uchar *mapped = entry->file.map(0, entry->file.size());
+
+        EntryHeader header;
+        if (mapped)
+            memcpy(&header, mapped, sizeof(header));
+
+        // Anything truncated or written by another version counts as a miss
+        hit = mapped && memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0
+              && header.version == VERSION
+              && header.size + sizeof(header) == uint64_t(entry->file.size())
+              && header.width > 0 && header.height > 0
+              && header.levelCount == fullLevelCount(header.width, header.height)
+              && (header.blockBytes == 0 || header.blockBytes == 8 || header.blockBytes == 16)
+              && header.size
+                     == mipChainSize(mipChainLayout(header.width,
+                                                    header.height,
+                                                    header.levelCount,
+                                                    header.blockBytes));
+        if (hit) {
+            entry->pixels = mapped + sizeof(header);
+            entry->size = static_cast<size_t>(header.size);
+            entry->width = header.width;
+            entry->height = header.height;
+            entry->levelCount = header.levelCount;
+            entry->blockBytes = header.blockBytes;
+
+            // Modification time doubles as the last use for eviction
+            entry->file.setFileTime(QDateTime::currentDateTime(),
+                                    QFileDevice::FileModificationTime);
+        }
+    }
+
+    // Written to stats.ini by store() and at exit, a lookup stays off the disk
+    std::atomic<uint64_t> &counter = hit ? m_hits : m_misses;
+    counter++;
+    if (Tracer::statsEnabled()) {
+        qDebug() << "texture cache" << (hit ? "hit" : "miss") << "hits:" << m_hits.load()
+                 << "misses:" << m_misses.load() << "this run";
+    }
+
+    if (!hit)
+        return nullptr;
+    return entry;
+}
+
+bool TextureCache::store(const QString &key,
+                         uint32_t width,
+                         uint32_t height,
+                         uint32_t levelCount,
+                         const uint8_t *pixels,
+                         size_t size,
+                         uint32_t blockBytes)
+{
+    TRACE_FUNCTION();
+
+    if (key.isEmpty())
+        return false;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    EntryHeader header{};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.width = width;
+    header.height = height;
+    header.levelCount = levelCount;
+    header.blockBytes = blockBytes;
+    header.size = size;
+
+    // QSaveFile renames into place on commit, so readers never see half an entry
+    QSaveFile file(entryPath(key));
+    if (!file.open(QIODevice::WriteOnly)
+        || file.write(reinterpret_cast<const char *>(&header), sizeof(header))
+               != qint64(sizeof(header))
+        || file.write(reinterpret_cast<const char *>(pixels), qint64(size)) != qint64(size)
+        || !file.commit()) {
+        qWarning() << "failed to write texture cache entry" << key;
+        return false;
+    }
+
+    evict();
+    saveStats();
+    return true;
+}
+
+QString TextureCache::entryPath(const QString &key) const
+{
+    return m_directory + "/" + key + ".vtex";
+}
+
+void TextureCache::saveStats()
+{
+    const uint64_t hits = m_hits.load();
+    const uint64_t misses = m_misses.load();
+    if (!m_enabled || (hits == m_savedHits && misses == m_savedMisses))
+        return;
+
+    QSettings stats(m_directory + "/stats.ini", QSettings::IniFormat);
+    stats.setValue("hits", stats.value("hits", 0).toULongLong() + hits - m_savedHits);
+    stats.setValue("misses", stats.value("misses", 0).toULongLong() + misses - m_savedMisses);
+    m_savedHits = hits;
+    m_savedMisses = misses;
+}
+
+void TextureCache::evict()
+{
+    QDir directory(m_directory);
+    auto entries = directory.entryInfoList(QStringList{"*.vtex"}, QDir::Files, QDir::Time);
+
+    // Newest first, keep whatever fits and drop the rest
+    qint64 total = 0;
+    for (const QFileInfo &entry : entries) {
+        total += entry.size();
+        if (total > m_maxBytes) {
+            if (Tracer::statsEnabled())
+                qDebug() << "texture cache evicting" << entry.fileName();
+            QFile::remove(entry.absoluteFilePath());
+        }
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <QFile>
+#include <QString>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+// A finished mip chain mapped straight from the cache, valid while the object lives.
+struct CachedTexture
+{
+    QFile file;
+    const uint8_t *pixels = nullptr;
+    size_t size = 0;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint32_t levelCount = 0;
+    // 0 for RGBA8 texels, else the bytes of a compressed 4x4 block
+    uint32_t blockBytes = 0;
+};
+
+// Content addressed store of decoded, mipmapped textures. Entries are keyed by the source
+// file's path, size and modification time plus the texture format, and hold the levels in
+// the layout of mipChainLayout, compressed ones included, so a hit can be copied to staging
+// as is.
+//
+// VIV_TEXTURE_CACHE=0 turns it off, VIV_TEXTURE_CACHE_DIR moves it and
+// VIV_TEXTURE_CACHE_SIZE sets the size limit in MiB. Least recently used entries are
+// evicted once the limit is exceeded. Hits and misses add up across runs in stats.ini next
+// to the entries.
+class TextureCache
+{
+public:
+    TextureCache();
+    ~TextureCache();
+
+    bool isEnabled() const { return m_enabled; }
+
+    // Empty when the cache is off or the source file cannot be read
+    QString key(const QString &fileName, const QString &format) const;
+
+    // Counts a hit or a miss, returns null on a miss or when the entry is unusable. Safe to
+    // call from a worker thread.
+    std::unique_ptr<CachedTexture> find(const QString &key);
+
+    // Safe to call from a worker thread, also saves the counts of find()
+    bool store(const QString &key,
+               uint32_t width,
+               uint32_t height,
+               uint32_t levelCount,
+               const uint8_t *pixels,
+               size_t size,
+               uint32_t blockBytes);
+
+private:
+    QString entryPath(const QString &key) const;
+    void evict();
+
+    // Adds the counts since the last save to stats.ini, m_mutex must be held
+    void saveStats();
+
+    bool m_enabled = true;
+    QString m_directory;
+    qint64 m_maxBytes;
+    // Guards the entries, stats.ini and the saved counts
+    std::mutex m_mutex;
+    std::atomic<uint64_t> m_hits{0};
+    std::atomic<uint64_t> m_misses{0};
+    uint64_t m_savedHits = 0;
+    uint64_t m_savedMisses = 0;
+};
+
+#endif // TEXTURECACHE_H
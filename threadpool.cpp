@@ -0,0 +1,161 @@
+#include "threadpool.h"
+
+#include "tracer.h"
+
+#include <algorithm>
+
+namespace {
+// The pool and queue of the worker running on this thread, if any
+thread_local const ThreadPool *currentPool = nullptr;
+thread_local unsigned currentWorker = 0;
+} // namespace
+
+ThreadPool::ThreadPool(unsigned threadCount)
+{
+    threadCount = std::max(threadCount, 1u);
+    for (unsigned i = 0; i < threadCount; i++) {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+
+    m_threads.reserve(threadCount);
+    for (unsigned i = 0; i < threadCount; i++) {
+        m_threads.emplace_back(&ThreadPool::run, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    for (auto &thread : m_threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+    const unsigned index = currentPool == this
+                               ? currentWorker
+                               : m_nextWorker++ % static_cast<unsigned>(m_workers.size());
+
+    // Counted before it is queued, so a worker taking it right away never sees m_pending at 0
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_pending++;
+    }
+    {
+        Worker &worker = *m_workers[index];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+    }
+    m_condition.notify_one();
+}
+
+bool ThreadPool::takeTask(unsigned index, std::function<void()> &task)
+{
+    {
+        Worker &own = *m_workers[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    const size_t count = m_workers.size();
+    for (size_t offset = 1; offset < count; offset++) {
+        Worker &victim = *m_workers[(index + offset) % count];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::parallelFor(size_t count,
+                             size_t grain,
+                             const std::function<void(size_t, size_t)> &fn)
+{
+    grain = std::max<size_t>(grain, 1);
+    const size_t chunkCount = (count + grain - 1) / grain;
+    if (chunkCount == 0)
+        return;
+
+    // Helpers can start after the caller has done every chunk, for example when the caller
+    // is itself a worker and its helpers wait in its own queue. The caller only waits for
+    // helpers that are running, and one that starts after that leaves fn alone, so the
+    // state it touches is shared.
+    struct State
+    {
+        std::atomic<size_t> nextChunk{0};
+        std::mutex mutex;
+        std::condition_variable done;
+        size_t active = 0;
+        bool closed = false;
+    };
+    auto state = std::make_shared<State>();
+
+    auto work = [state, chunkCount, grain, count, &fn] {
+        for (size_t chunk = state->nextChunk++; chunk < chunkCount;
+             chunk = state->nextChunk++) {
+            TRACE_SCOPE("parallelFor chunk");
+            const size_t begin = chunk * grain;
+            fn(begin, std::min(begin + grain, count));
+        }
+    };
+
+    const size_t helperCount = std::min<size_t>(chunkCount - 1, m_threads.size());
+    for (size_t i = 0; i < helperCount; i++) {
+        submit([state, work] {
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                if (state->closed)
+                    return;
+                state->active++;
+            }
+            work();
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (--state->active == 0)
+                state->done.notify_one();
+        });
+    }
+
+    work();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->closed = true;
+    state->done.wait(lock, [&] { return state->active == 0; });
+}
+
+void ThreadPool::run(unsigned index)
+{
+    Tracer::setThreadName("pool worker");
+    currentPool = this;
+    currentWorker = index;
+
+    std::function<void()> task;
+    while (true) {
+        if (takeTask(index, task)) {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_pending--;
+            }
+            task();
+            task = nullptr;
+            continue;
+        }
+
+        // A task counted in m_pending but not found is still being queued, so look again
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condition.wait(lock, [this] { return m_stop || m_pending > 0; });
+        if (m_stop && m_pending == 0)
+            return;
+    }
+}
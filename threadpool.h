@@ -0,0 +1,58 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for CPU-side image processing.
+//
+// Every worker has its own queue. A task submitted from a worker goes to that worker's queue
+// and is run newest first, which keeps nested work like parallelFor on hot caches; idle
+// workers steal the oldest task of another queue. Tasks from other threads are spread
+// round robin over the queues.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threadCount = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    unsigned threadCount() const { return static_cast<unsigned>(m_threads.size()); }
+
+    void submit(std::function<void()> task);
+
+    // Calls fn(begin, end) on chunks of at most grain items covering [0, count). The calling
+    // thread works too, and the call returns once every chunk is done.
+    void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)> &fn);
+
+private:
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    // Own queue from the back, then the other queues from the front
+    bool takeTask(unsigned index, std::function<void()> &task);
+
+    void run(unsigned index);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<unsigned> m_nextWorker{0};
+
+    // Guards the sleep of idle workers, m_pending counts tasks queued anywhere
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    size_t m_pending = 0;
+    bool m_stop = false;
+
+    std::vector<std::thread> m_threads;
+};
+
+#endif // THREADPOOL_H
@@ -0,0 +1,882 @@
+#include "thumbnailer.h"
+
+#include "bmpreader.h"
+#include "mipblits.h"
+#include "tracer.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QImage>
+#include <QImageReader>
+#include <QImageWriter>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <set>
+#include <stdexcept>
+
+namespace {
+const qint64 REPORT_INTERVAL_MS = 2000;
+
+int deviceRank(VkPhysicalDeviceType type)
+{
+    switch (type) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+        return 4;
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+        return 3;
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+        return 2;
+    case VK_PHYSICAL_DEVICE_TYPE_CPU:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+const char *deviceTypeName(VkPhysicalDeviceType type)
+{
+    switch (type) {
+    case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+        return "discrete";
+    case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+        return "integrated";
+    case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+        return "virtual";
+    case VK_PHYSICAL_DEVICE_TYPE_CPU:
+        return "software";
+    default:
+        return "other";
+    }
+}
+
+uint32_t levelSize(uint32_t size, uint32_t level)
+{
+    return std::max(size >> level, 1u);
+}
+} // namespace
+
+Thumbnailer::Thumbnailer(const Options &options)
+    : m_options(options)
+{
+    TRACE_FUNCTION();
+
+    m_options.inFlight = std::max(m_options.inFlight, 1u);
+
+    createInstance();
+    pickPhysicalDevice();
+    createLogicalDevice();
+    chooseFormat();
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+    poolInfo.queueFamilyIndex = m_queueFamily;
+
+    if (vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create command pool!");
+    }
+
+    m_threadPool = std::make_unique<ThreadPool>(std::max(m_options.threads, 1u));
+}
+
+Thumbnailer::~Thumbnailer()
+{
+    // Finishes the queued decodes and writes, which use the device
+    m_threadPool.reset();
+
+    if (m_device != VK_NULL_HANDLE) {
+        vkDeviceWaitIdle(m_device);
+
+        for (auto &job : m_inFlight) {
+            destroyJob(*job);
+        }
+        for (auto &job : m_decoded) {
+            destroyJob(*job);
+        }
+        for (VkFence fence : m_freeFences) {
+            vkDestroyFence(m_device, fence, nullptr);
+        }
+
+        if (m_commandPool != VK_NULL_HANDLE)
+            vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+
+        m_allocator.reset();
+        vkDestroyDevice(m_device, nullptr);
+    }
+
+    if (m_instance != VK_NULL_HANDLE)
+        vkDestroyInstance(m_instance, nullptr);
+}
+
+void Thumbnailer::createInstance()
+{
+    TRACE_FUNCTION();
+
+    VkApplicationInfo appInfo{};
+    appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+    appInfo.pApplicationName = "Vulkan Thumbnailer";
+    appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+    appInfo.pEngineName = "No Engine";
+    appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+    appInfo.apiVersion = VK_API_VERSION_1_0;
+
+    // Nothing is presented, so no extensions are needed
+    VkInstanceCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+    createInfo.pApplicationInfo = &appInfo;
+
+    if (vkCreateInstance(&createInfo, nullptr, &m_instance) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create instance!");
+    }
+}
+
+void Thumbnailer::pickPhysicalDevice()
+{
+    TRACE_FUNCTION();
+
+    uint32_t deviceCount = 0;
+    vkEnumeratePhysicalDevices(m_instance, &deviceCount, nullptr);
+
+    std::vector<VkPhysicalDevice> devices(deviceCount);
+    vkEnumeratePhysicalDevices(m_instance, &deviceCount, devices.data());
+
+    // Any device with a graphics queue can blit, hardware ones are preferred
+    int bestRank = -1;
+    for (VkPhysicalDevice device : devices) {
+        uint32_t familyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> families(familyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &familyCount, families.data());
+
+        auto family = std::find_if(families.begin(), families.end(), [](const auto &properties) {
+            return properties.queueFlags & VK_QUEUE_GRAPHICS_BIT;
+        });
+        if (family == families.end())
+            continue;
+
+        VkPhysicalDeviceProperties properties{};
+        vkGetPhysicalDeviceProperties(device, &properties);
+
+        const int rank = deviceRank(properties.deviceType);
+        if (rank > bestRank) {
+            bestRank = rank;
+            m_physicalDevice = device;
+            m_queueFamily = static_cast<uint32_t>(family - families.begin());
+        }
+    }
+
+    if (m_physicalDevice == VK_NULL_HANDLE) {
+        throw std::runtime_error("failed to find a GPU with a graphics queue!");
+    }
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+    m_maxDimension = properties.limits.maxImageDimension2D;
+
+    qDebug() << "using" << properties.deviceName << deviceTypeName(properties.deviceType)
+             << "device";
+}
+
+void Thumbnailer::createLogicalDevice()
+{
+    TRACE_FUNCTION();
+
+    float queuePriority = 1.0f;
+    VkDeviceQueueCreateInfo queueCreateInfo{};
+    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueCreateInfo.queueFamilyIndex = m_queueFamily;
+    queueCreateInfo.queueCount = 1;
+    queueCreateInfo.pQueuePriorities = &queuePriority;
+
+    VkPhysicalDeviceFeatures deviceFeatures{};
+
+    VkDeviceCreateInfo createInfo{};
+    createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    createInfo.queueCreateInfoCount = 1;
+    createInfo.pQueueCreateInfos = &queueCreateInfo;
+    createInfo.pEnabledFeatures = &deviceFeatures;
+
+    if (vkCreateDevice(m_physicalDevice, &createInfo, nullptr, &m_device) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create logical device!");
+    }
+
+    vkGetDeviceQueue(m_device, m_queueFamily, 0, &m_queue);
+
+    m_allocator = std::make_unique<DeviceAllocator>(m_device, m_physicalDevice);
+}
+
+void Thumbnailer::chooseFormat()
+{
+    // sRGB blits filter in linear light, the UNORM fallback averages the encoded values
+    const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT
+                                          | VK_FORMAT_FEATURE_BLIT_DST_BIT
+                                          | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+    for (VkFormat format : {VK_FORMAT_R8G8B8A8_SRGB, VK_FORMAT_R8G8B8A8_UNORM}) {
+        VkFormatProperties properties{};
+        vkGetPhysicalDeviceFormatProperties(m_physicalDevice, format, &properties);
+        if ((properties.optimalTilingFeatures & required) == required) {
+            m_format = format;
+            return;
+        }
+    }
+
+    throw std::runtime_error("no RGBA format supports linear blitting!");
+}
+
+std::vector<Thumbnailer::Source> Thumbnailer::findSources()
+{
+    TRACE_FUNCTION();
+
+    QStringList nameFilters;
+    for (const QByteArray &format : QImageReader::supportedImageFormats()) {
+        nameFilters << "*." + QString::fromLatin1(format);
+    }
+
+    std::vector<Source> sources;
+    for (const QString &input : m_options.inputs) {
+        const QFileInfo info(input);
+        if (info.isFile()) {
+            sources.push_back({info.absoluteFilePath(), info.fileName()});
+            continue;
+        }
+        if (!info.isDir()) {
+            qWarning() << "skipping" << input << ", not a file or directory";
+            continue;
+        }
+
+        const QDir directory(info.absoluteFilePath());
+        QDirIterator it(directory.absolutePath(),
+                        nameFilters,
+                        QDir::Files,
+                        QDirIterator::Subdirectories);
+        while (it.hasNext()) {
+            const QString fileName = it.next();
+            sources.push_back({fileName, directory.relativeFilePath(fileName)});
+        }
+    }
+
+    std::sort(sources.begin(), sources.end(), [](const Source &a, const Source &b) {
+        return a.fileName < b.fileName;
+    });
+
+    // Inputs from different directories can still map to the same output, only the first
+    // one is thumbnailed and the others count as failed
+    std::set<QString> outputNames;
+    std::vector<Source> unique;
+    unique.reserve(sources.size());
+    for (Source &source : sources) {
+        if (outputNames.insert(source.outputName).second) {
+            unique.push_back(std::move(source));
+        } else {
+            qWarning() << "skipping" << source.fileName << ", its thumbnails would overwrite"
+                       << "those of another input named" << source.outputName;
+            m_failed++;
+        }
+    }
+    return unique;
+}
+
+int Thumbnailer::run()
+{
+    TRACE_FUNCTION();
+
+    const std::vector<Source> sources = findSources();
+    if (sources.empty()) {
+        qWarning() << "no images found";
+        return 0;
+    }
+
+    std::set<QString> outputDirectories;
+    for (const Source &source : sources) {
+        outputDirectories.insert(
+            QFileInfo(m_options.outputDirectory + "/" + source.outputName).path());
+    }
+    for (const QString &directory : outputDirectories) {
+        if (!QDir().mkpath(directory)) {
+            throw std::runtime_error("failed to create output directory!");
+        }
+    }
+
+    qDebug() << "thumbnailing" << sources.size() << "images on" << m_threadPool->threadCount()
+             << "threads," << m_options.inFlight << "in flight";
+    m_timer.start();
+
+    size_t next = 0;
+    while (true) {
+        // Decoding runs at most inFlight images ahead of the GPU, which bounds the staging memory
+        while (next < sources.size() && m_decodesOutstanding < m_options.inFlight) {
+            submitDecode(sources[next++]);
+        }
+
+        if (m_inFlight.size() >= m_options.inFlight) {
+            finishOldest();
+            continue;
+        }
+
+        std::unique_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(m_decodeMutex);
+            const auto decoded = [this] { return !m_decoded.empty(); };
+            // With work on the GPU the wait is short, so finished jobs are picked up promptly
+            if (!decoded() && m_decodesOutstanding > 0) {
+                if (m_inFlight.empty())
+                    m_decodeCondition.wait(lock, decoded);
+                else
+                    m_decodeCondition.wait_for(lock, std::chrono::milliseconds(1), decoded);
+            }
+            if (decoded()) {
+                job = std::move(m_decoded.front());
+                m_decoded.pop_front();
+            }
+        }
+
+        if (job) {
+            m_decodesOutstanding--;
+            if (job->failed) {
+                m_failed++;
+                destroyJob(*job);
+                continue;
+            }
+
+            // Queued first, so the destructor cleans up after a failed submission
+            m_inFlight.push_back(std::move(job));
+            record(*m_inFlight.back());
+            continue;
+        }
+
+        if (!m_inFlight.empty()) {
+            if (m_decodesOutstanding == 0
+                || vkGetFenceStatus(m_device, m_inFlight.front()->fence) == VK_SUCCESS) {
+                finishOldest();
+            }
+            continue;
+        }
+
+        if (next == sources.size() && m_decodesOutstanding == 0)
+            break;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(m_writeMutex);
+        m_writeCondition.wait(lock, [this] { return m_writesPending == 0; });
+    }
+
+    reportProgress(true);
+    return static_cast<int>(m_failed + m_writeFailures);
+}
+
+void Thumbnailer::submitDecode(const Source &source)
+{
+    auto job = std::make_shared<std::unique_ptr<Job>>(std::make_unique<Job>());
+    (*job)->source = source;
+    m_decodesOutstanding++;
+
+    m_threadPool->submit([this, job] {
+        try {
+            decode(**job);
+        } catch (const std::exception &e) {
+            qWarning() << "failed to decode" << (*job)->source.fileName << e.what();
+            (*job)->failed = true;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_decodeMutex);
+            m_decoded.push_back(std::move(*job));
+        }
+        m_decodeCondition.notify_one();
+    });
+}
+
+void Thumbnailer::decode(Job &job)
+{
+    TRACE_FUNCTION();
+
+    // BMPs are decoded straight into the staging buffer, other formats go through QImage
+    BmpReader bmp(job.source.fileName);
+    QImage image;
+    if (bmp.isValid()) {
+        job.width = bmp.width();
+        job.height = bmp.height();
+    } else {
+        image = QImage(job.source.fileName);
+        if (image.isNull()) {
+            qWarning() << "failed to decode" << job.source.fileName;
+            job.failed = true;
+            return;
+        }
+        image = image.convertToFormat(QImage::Format_RGBA8888);
+        job.width = static_cast<uint32_t>(image.width());
+        job.height = static_cast<uint32_t>(image.height());
+    }
+
+    if (job.width > m_maxDimension || job.height > m_maxDimension) {
+        qWarning() << job.source.fileName << "is larger than the device supports";
+        job.failed = true;
+        return;
+    }
+
+    const VkDeviceSize rowSize = VkDeviceSize(job.width) * 4;
+    job.staging = createBuffer(rowSize * job.height,
+                               VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                               VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                   | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                               job.stagingMemory);
+
+    auto *pixels = static_cast<uint8_t *>(job.stagingMemory.mapped);
+    if (bmp.isValid()) {
+        bmp.decode(pixels, *m_threadPool);
+    } else {
+        for (uint32_t y = 0; y < job.height; y++) {
+            memcpy(pixels + y * rowSize, image.constScanLine(static_cast<int>(y)), rowSize);
+        }
+    }
+}
+
+void Thumbnailer::record(Job &job)
+{
+    TRACE_FUNCTION();
+
+    // Each size blits from the smallest level that is still at least as large, so no blit
+    // shrinks by more than half and the chain only goes as deep as the smallest thumbnail
+    const uint32_t longest = std::max(job.width, job.height);
+    const uint32_t fullLevels = static_cast<uint32_t>(std::floor(std::log2(longest))) + 1;
+    job.mipLevels = 1;
+    for (uint32_t size : m_options.sizes) {
+        Thumbnail thumbnail;
+        thumbnail.size = size;
+        if (longest <= size) {
+            thumbnail.width = job.width;
+            thumbnail.height = job.height;
+        } else {
+            thumbnail.width = std::max(
+                static_cast<uint32_t>((uint64_t(job.width) * size + longest / 2) / longest), 1u);
+            thumbnail.height = std::max(
+                static_cast<uint32_t>((uint64_t(job.height) * size + longest / 2) / longest), 1u);
+        }
+
+        while (thumbnail.sourceLevel + 1 < fullLevels
+               && levelSize(job.width, thumbnail.sourceLevel + 1) >= thumbnail.width
+               && levelSize(job.height, thumbnail.sourceLevel + 1) >= thumbnail.height) {
+            thumbnail.sourceLevel++;
+        }
+        job.mipLevels = std::max(job.mipLevels, thumbnail.sourceLevel + 1);
+
+        thumbnail.image = createImage(thumbnail.width,
+                                      thumbnail.height,
+                                      1,
+                                      VK_IMAGE_USAGE_TRANSFER_SRC_BIT
+                                          | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                                      thumbnail.imageMemory);
+        thumbnail.buffer = createBuffer(VkDeviceSize(thumbnail.width) * thumbnail.height * 4,
+                                        VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
+                                            | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                        thumbnail.bufferMemory);
+        job.thumbnails.push_back(thumbnail);
+    }
+
+    job.image = createImage(job.width,
+                            job.height,
+                            job.mipLevels,
+                            VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+                            job.imageMemory);
+
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = m_commandPool;
+    allocInfo.commandBufferCount = 1;
+
+    if (vkAllocateCommandBuffers(m_device, &allocInfo, &job.commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate command buffer!");
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    if (vkBeginCommandBuffer(job.commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("failed to begin recording command buffer!");
+    }
+
+    // Every image starts out as a transfer destination
+    std::vector<VkImageMemoryBarrier> barriers;
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = job.mipLevels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.image = job.image;
+    barriers.push_back(barrier);
+
+    barrier.subresourceRange.levelCount = 1;
+    for (const Thumbnail &thumbnail : job.thumbnails) {
+        barrier.image = thumbnail.image;
+        barriers.push_back(barrier);
+    }
+
+    vkCmdPipelineBarrier(job.commandBuffer,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         static_cast<uint32_t>(barriers.size()),
+                         barriers.data());
+
+    VkBufferImageCopy region{};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {job.width, job.height, 1};
+
+    vkCmdCopyBufferToImage(job.commandBuffer,
+                           job.staging,
+                           job.image,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           1,
+                           &region);
+
+    recordMipBlits(job.commandBuffer,
+                   job.image,
+                   static_cast<int32_t>(job.width),
+                   static_cast<int32_t>(job.height),
+                   job.mipLevels,
+                   VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                   VK_PIPELINE_STAGE_TRANSFER_BIT,
+                   VK_ACCESS_TRANSFER_READ_BIT);
+
+    for (const Thumbnail &thumbnail : job.thumbnails) {
+        VkImageBlit blit{};
+        blit.srcOffsets[1] = {static_cast<int32_t>(levelSize(job.width, thumbnail.sourceLevel)),
+                              static_cast<int32_t>(levelSize(job.height, thumbnail.sourceLevel)),
+                              1};
+        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        blit.srcSubresource.mipLevel = thumbnail.sourceLevel;
+        blit.srcSubresource.baseArrayLayer = 0;
+        blit.srcSubresource.layerCount = 1;
+        blit.dstOffsets[1] = {static_cast<int32_t>(thumbnail.width),
+                              static_cast<int32_t>(thumbnail.height),
+                              1};
+        blit.dstSubresource = blit.srcSubresource;
+        blit.dstSubresource.mipLevel = 0;
+
+        vkCmdBlitImage(job.commandBuffer,
+                       job.image,
+                       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                       thumbnail.image,
+                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                       1,
+                       &blit,
+                       VK_FILTER_LINEAR);
+    }
+
+    barriers.clear();
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    for (const Thumbnail &thumbnail : job.thumbnails) {
+        barrier.image = thumbnail.image;
+        barriers.push_back(barrier);
+    }
+
+    vkCmdPipelineBarrier(job.commandBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         static_cast<uint32_t>(barriers.size()),
+                         barriers.data());
+
+    for (const Thumbnail &thumbnail : job.thumbnails) {
+        region.imageExtent = {thumbnail.width, thumbnail.height, 1};
+        vkCmdCopyImageToBuffer(job.commandBuffer,
+                               thumbnail.image,
+                               VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                               thumbnail.buffer,
+                               1,
+                               &region);
+    }
+
+    // The readback buffers are coherent, this makes the copies visible to the host
+    VkMemoryBarrier hostBarrier{};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+
+    vkCmdPipelineBarrier(job.commandBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT,
+                         0,
+                         1,
+                         &hostBarrier,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr);
+
+    if (vkEndCommandBuffer(job.commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
+    }
+
+    if (m_freeFences.empty()) {
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+        if (vkCreateFence(m_device, &fenceInfo, nullptr, &job.fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create fence!");
+        }
+    } else {
+        job.fence = m_freeFences.back();
+        m_freeFences.pop_back();
+    }
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &job.commandBuffer;
+
+    if (vkQueueSubmit(m_queue, 1, &submitInfo, job.fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit thumbnail command buffer!");
+    }
+}
+
+void Thumbnailer::finishOldest()
+{
+    TRACE_FUNCTION();
+
+    std::shared_ptr<Job> job = std::move(m_inFlight.front());
+    m_inFlight.pop_front();
+
+    vkWaitForFences(m_device, 1, &job->fence, VK_TRUE, UINT64_MAX);
+    vkResetFences(m_device, 1, &job->fence);
+    m_freeFences.push_back(job->fence);
+    job->fence = VK_NULL_HANDLE;
+
+    vkFreeCommandBuffers(m_device, m_commandPool, 1, &job->commandBuffer);
+    job->commandBuffer = VK_NULL_HANDLE;
+
+    releaseUploadResources(*job);
+
+    m_images++;
+    m_thumbnails += job->thumbnails.size();
+
+    {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        m_writesPending++;
+    }
+    m_threadPool->submit([this, job] {
+        writeThumbnails(*job);
+        releaseReadbackBuffers(*job);
+
+        {
+            std::lock_guard<std::mutex> lock(m_writeMutex);
+            m_writesPending--;
+        }
+        m_writeCondition.notify_all();
+    });
+
+    reportProgress(false);
+}
+
+void Thumbnailer::writeThumbnails(Job &job)
+{
+    TRACE_FUNCTION();
+
+    bool failed = false;
+    for (const Thumbnail &thumbnail : job.thumbnails) {
+        // Wraps the mapped buffer, which stays alive until the write has finished
+        const QImage image(static_cast<const uchar *>(thumbnail.bufferMemory.mapped),
+                           static_cast<int>(thumbnail.width),
+                           static_cast<int>(thumbnail.height),
+                           static_cast<qsizetype>(thumbnail.width) * 4,
+                           QImage::Format_RGBA8888);
+
+        const QString fileName = QString("%1/%2_%3.%4")
+                                     .arg(m_options.outputDirectory,
+                                          job.source.outputName,
+                                          QString::number(thumbnail.size),
+                                          m_options.format);
+        QImageWriter writer(fileName, m_options.format.toLatin1());
+        if (!writer.write(image)) {
+            qWarning() << "failed to write" << fileName << writer.errorString();
+            failed = true;
+        }
+    }
+
+    if (failed) {
+        std::lock_guard<std::mutex> lock(m_writeMutex);
+        m_writeFailures++;
+    }
+}
+
+void Thumbnailer::reportProgress(bool final)
+{
+    const qint64 elapsedMs = m_timer.elapsed();
+    if (final) {
+        const double seconds = std::max<qint64>(elapsedMs, 1) / 1000.0;
+        qDebug() << "wrote" << m_thumbnails << "thumbnails of" << m_images << "images in"
+                 << seconds << "s," << m_images / seconds << "images/s,"
+                 << m_failed + m_writeFailures << "failed";
+        return;
+    }
+
+    if (elapsedMs - m_lastReportMs < REPORT_INTERVAL_MS)
+        return;
+
+    const double seconds = (elapsedMs - m_lastReportMs) / 1000.0;
+    qDebug() << m_images << "images," << (m_images - m_lastReportImages) / seconds
+             << "images/s";
+    m_lastReportMs = elapsedMs;
+    m_lastReportImages = m_images;
+}
+
+VkBuffer Thumbnailer::createBuffer(VkDeviceSize size,
+                                   VkBufferUsageFlags usage,
+                                   VkMemoryPropertyFlags properties,
+                                   DeviceAllocation &memory)
+{
+    VkBufferCreateInfo bufferInfo{};
+    bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferInfo.size = size;
+    bufferInfo.usage = usage;
+    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VkBuffer buffer;
+    if (vkCreateBuffer(m_device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create buffer!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(m_device, buffer, &memRequirements);
+
+    memory = m_allocator->allocate(memRequirements,
+                                   findMemoryType(memRequirements.memoryTypeBits, properties),
+                                   true);
+
+    vkBindBufferMemory(m_device, buffer, memory.memory, memory.offset);
+    return buffer;
+}
+
+VkImage Thumbnailer::createImage(uint32_t width,
+                                 uint32_t height,
+                                 uint32_t mipLevels,
+                                 VkImageUsageFlags usage,
+                                 DeviceAllocation &memory)
+{
+    VkImageCreateInfo imageInfo{};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width = width;
+    imageInfo.extent.height = height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = mipLevels;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = m_format;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = usage;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VkImage image;
+    if (vkCreateImage(m_device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create image!");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(m_device, image, &memRequirements);
+
+    memory = m_allocator->allocate(memRequirements,
+                                   findMemoryType(memRequirements.memoryTypeBits,
+                                                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT),
+                                   false);
+
+    vkBindImageMemory(m_device, image, memory.memory, memory.offset);
+    return image;
+}
+
+uint32_t Thumbnailer::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const
+{
+    VkPhysicalDeviceMemoryProperties memProperties;
+    vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &memProperties);
+
+    for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
+        if ((typeFilter & (1 << i))
+            && (memProperties.memoryTypes[i].propertyFlags & properties) == properties) {
+            return i;
+        }
+    }
+
+    throw std::runtime_error("failed to find suitable memory type!");
+}
+
+void Thumbnailer::releaseUploadResources(Job &job)
+{
+    if (job.staging != VK_NULL_HANDLE) {
+        vkDestroyBuffer(m_device, job.staging, nullptr);
+        job.staging = VK_NULL_HANDLE;
+    }
+    m_allocator->free(job.stagingMemory);
+
+    if (job.image != VK_NULL_HANDLE) {
+        vkDestroyImage(m_device, job.image, nullptr);
+        job.image = VK_NULL_HANDLE;
+    }
+    m_allocator->free(job.imageMemory);
+
+    for (Thumbnail &thumbnail : job.thumbnails) {
+        if (thumbnail.image != VK_NULL_HANDLE) {
+            vkDestroyImage(m_device, thumbnail.image, nullptr);
+            thumbnail.image = VK_NULL_HANDLE;
+        }
+        m_allocator->free(thumbnail.imageMemory);
+    }
+}
+
+void Thumbnailer::releaseReadbackBuffers(Job &job)
+{
+    for (Thumbnail &thumbnail : job.thumbnails) {
+        if (thumbnail.buffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(m_device, thumbnail.buffer, nullptr);
+            thumbnail.buffer = VK_NULL_HANDLE;
+        }
+        m_allocator->free(thumbnail.bufferMemory);
+    }
+}
+
+void Thumbnailer::destroyJob(Job &job)
+{
+    if (job.commandBuffer != VK_NULL_HANDLE) {
+        vkFreeCommandBuffers(m_device, m_commandPool, 1, &job.commandBuffer);
+        job.commandBuffer = VK_NULL_HANDLE;
+    }
+    if (job.fence != VK_NULL_HANDLE) {
+        vkDestroyFence(m_device, job.fence, nullptr);
+        job.fence = VK_NULL_HANDLE;
+    }
+
+    releaseUploadResources(job);
+    releaseReadbackBuffers(job);
+}
@@ -0,0 +1,156 @@
+#ifndef THUMBNAILER_H
+#define THUMBNAILER_H
+
+#include "deviceallocator.h"
+#include "threadpool.h"
+
+#include <QElapsedTimer>
+#include <QString>
+#include <QStringList>
+
+#include <vulkan/vulkan.h>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Writes thumbnails of every image below a set of directories, without a window.
+//
+// Images are decoded on the thread pool straight into staging buffers. The main thread
+// records the upload, the same blit mip chain the viewer builds and one blit per thumbnail
+// size from the nearest level, then a copy into host visible memory. Up to inFlight images
+// are on the GPU at once, and their thumbnails are encoded on the pool while the next ones
+// are decoded and blitted. Any Vulkan device works, including software ones.
+class Thumbnailer
+{
+public:
+    struct Options
+    {
+        QStringList inputs;
+        QString outputDirectory;
+        // Longest side of each thumbnail, smaller images are not scaled up
+        std::vector<uint32_t> sizes{256};
+        unsigned threads = std::thread::hardware_concurrency();
+        uint32_t inFlight = 8;
+        QString format = "png";
+    };
+
+    explicit Thumbnailer(const Options &options);
+    ~Thumbnailer();
+
+    // Returns the number of images that could not be thumbnailed
+    int run();
+
+private:
+    struct Source
+    {
+        QString fileName;
+        // Output path relative to the output directory. It keeps the source suffix, so that
+        // a.jpg and a.png get thumbnails of their own
+        QString outputName;
+    };
+
+    struct Thumbnail
+    {
+        uint32_t size = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        // Mip level the thumbnail is blitted from
+        uint32_t sourceLevel = 0;
+        VkImage image = VK_NULL_HANDLE;
+        DeviceAllocation imageMemory;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        DeviceAllocation bufferMemory;
+    };
+
+    struct Job
+    {
+        Source source;
+        bool failed = false;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t mipLevels = 1;
+        VkBuffer staging = VK_NULL_HANDLE;
+        DeviceAllocation stagingMemory;
+        VkImage image = VK_NULL_HANDLE;
+        DeviceAllocation imageMemory;
+        std::vector<Thumbnail> thumbnails;
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+    };
+
+    void createInstance();
+    void pickPhysicalDevice();
+    void createLogicalDevice();
+    void chooseFormat();
+
+    std::vector<Source> findSources();
+
+    // Run on the pool
+    void decode(Job &job);
+    void writeThumbnails(Job &job);
+
+    void submitDecode(const Source &source);
+    void record(Job &job);
+    void finishOldest();
+    void reportProgress(bool final);
+
+    VkBuffer createBuffer(VkDeviceSize size,
+                          VkBufferUsageFlags usage,
+                          VkMemoryPropertyFlags properties,
+                          DeviceAllocation &memory);
+    VkImage createImage(uint32_t width,
+                        uint32_t height,
+                        uint32_t mipLevels,
+                        VkImageUsageFlags usage,
+                        DeviceAllocation &memory);
+    uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
+
+    // Staging buffer and images, no longer needed once the job's fence has signaled
+    void releaseUploadResources(Job &job);
+    void releaseReadbackBuffers(Job &job);
+    void destroyJob(Job &job);
+
+    Options m_options;
+
+    VkInstance m_instance = VK_NULL_HANDLE;
+    VkPhysicalDevice m_physicalDevice = VK_NULL_HANDLE;
+    VkDevice m_device = VK_NULL_HANDLE;
+    VkQueue m_queue = VK_NULL_HANDLE;
+    uint32_t m_queueFamily = 0;
+    VkCommandPool m_commandPool = VK_NULL_HANDLE;
+    VkFormat m_format = VK_FORMAT_R8G8B8A8_SRGB;
+    uint32_t m_maxDimension = 0;
+    std::unique_ptr<DeviceAllocator> m_allocator;
+    std::vector<VkFence> m_freeFences;
+
+    // Decoded jobs waiting for the main thread, failed decodes included
+    std::mutex m_decodeMutex;
+    std::condition_variable m_decodeCondition;
+    std::deque<std::unique_ptr<Job>> m_decoded;
+    // Submitted decodes that the main thread has not taken yet
+    size_t m_decodesOutstanding = 0;
+
+    // Jobs on the GPU, oldest first
+    std::deque<std::unique_ptr<Job>> m_inFlight;
+
+    std::mutex m_writeMutex;
+    std::condition_variable m_writeCondition;
+    size_t m_writesPending = 0;
+    size_t m_writeFailures = 0;
+
+    size_t m_failed = 0;
+    size_t m_images = 0;
+    size_t m_thumbnails = 0;
+    QElapsedTimer m_timer;
+    qint64 m_lastReportMs = 0;
+    size_t m_lastReportImages = 0;
+
+    std::unique_ptr<ThreadPool> m_threadPool;
+};
+
+#endif // THUMBNAILER_H
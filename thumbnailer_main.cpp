@@ -0,0 +1,74 @@
+#include "thumbnailer.h"
+#include "tracer.h"
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDebug>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Writes thumbnails of all images below directories");
+    parser.addHelpOption();
+    parser.addPositionalArgument("inputs", "Directories or images to thumbnail.", "inputs...");
+
+    QCommandLineOption outputOption("output",
+                                    "Directory the thumbnails are written to.",
+                                    "dir",
+                                    "thumbnails");
+    QCommandLineOption sizesOption("sizes",
+                                   "Longest side of each thumbnail size.",
+                                   "n,n,...",
+                                   "256");
+    QCommandLineOption threadsOption("threads",
+                                     "Decode and encode threads, all cores when omitted.",
+                                     "n");
+    QCommandLineOption inFlightOption("in-flight", "Images on the GPU at once.", "n", "8");
+    QCommandLineOption formatOption("format", "Thumbnail file format.", "format", "png");
+    parser.addOptions({outputOption, sizesOption, threadsOption, inFlightOption, formatOption});
+    parser.process(a);
+
+    Thumbnailer::Options options;
+    options.inputs = parser.positionalArguments();
+    options.outputDirectory = parser.value(outputOption);
+    options.format = parser.value(formatOption);
+    if (options.inputs.isEmpty())
+        qFatal("At least one input directory is required!");
+
+    options.sizes.clear();
+    for (const QString &size : parser.value(sizesOption).split(',')) {
+        bool ok = false;
+        const uint value = size.toUInt(&ok);
+        if (!ok || value == 0)
+            qFatal("Invalid --sizes, expected a list of positive numbers!");
+        options.sizes.push_back(value);
+    }
+
+    if (parser.isSet(threadsOption)) {
+        bool ok = false;
+        options.threads = parser.value(threadsOption).toUInt(&ok);
+        if (!ok || options.threads == 0)
+            qFatal("Invalid --threads!");
+    }
+
+    bool inFlightOk = false;
+    options.inFlight = parser.value(inFlightOption).toUInt(&inFlightOk);
+    if (!inFlightOk || options.inFlight == 0)
+        qFatal("Invalid --in-flight!");
+
+    Tracer::setThreadName("main");
+
+    int failed = 0;
+    try {
+        Thumbnailer thumbnailer(options);
+        failed = thumbnailer.run();
+    } catch (const std::exception &e) {
+        qWarning() << e.what();
+        failed = 1;
+    }
+
+    Tracer::write();
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,295 @@
+#include "tilestreamer.h"
+
+#include "mipbuilder.h"
+#include "tracer.h"
+
+#include <algorithm>
+#include <cstring>
+
+TileSource::TileSource(const QString &fileName, uint32_t tileSize)
+    : m_reader(fileName)
+    , m_tileSize(tileSize)
+{
+    if (!isValid())
+        return;
+
+    while ((std::max(width(), height()) >> (m_levelCount - 1)) > m_tileSize) {
+        m_levelCount++;
+    }
+}
+
+uint32_t TileSource::tilesX(uint32_t level) const
+{
+    const uint64_t span = static_cast<uint64_t>(m_tileSize) << level;
+    return static_cast<uint32_t>((width() + span - 1) / span);
+}
+
+uint32_t TileSource::tilesY(uint32_t level) const
+{
+    const uint64_t span = static_cast<uint64_t>(m_tileSize) << level;
+    return static_cast<uint32_t>((height() + span - 1) / span);
+}
+
+uint32_t TileSource::levelWidth(uint32_t level) const
+{
+    return static_cast<uint32_t>((uint64_t(width()) + (uint64_t(1) << level) - 1) >> level);
+}
+
+uint32_t TileSource::levelHeight(uint32_t level) const
+{
+    return static_cast<uint32_t>((uint64_t(height()) + (uint64_t(1) << level) - 1) >> level);
+}
+
+void TileSource::readTile(const TileKey &key, uint8_t *rgba) const
+{
+    if (key.level == 0) {
+        readFileTile(key, rgba);
+        return;
+    }
+
+    const Pixels pixels = coarseTile(key);
+    memcpy(rgba, pixels->data(), pixels->size());
+}
+
+void TileSource::readFileTile(const TileKey &key, uint8_t *rgba) const
+{
+    memset(rgba, 0, static_cast<size_t>(m_tileSize) * m_tileSize * 4);
+
+    const uint64_t x0 = static_cast<uint64_t>(key.x) * m_tileSize;
+    const uint64_t y0 = static_cast<uint64_t>(key.y) * m_tileSize;
+    const uint32_t count = static_cast<uint32_t>(std::min<uint64_t>(m_tileSize, width() - x0));
+    const uint32_t rows = static_cast<uint32_t>(std::min<uint64_t>(m_tileSize, height() - y0));
+    for (uint32_t j = 0; j < rows; j++) {
+        m_reader.decodeRow(static_cast<uint32_t>(y0) + j,
+                           static_cast<uint32_t>(x0),
+                           count,
+                           rgba + static_cast<size_t>(j) * m_tileSize * 4);
+    }
+}
+
+TileSource::Pixels TileSource::coarseTile(const TileKey &key) const
+{
+    {
+        std::lock_guard<std::mutex> lock(m_cacheMutex);
+        auto it = m_cache.find(key);
+        if (it != m_cache.end()) {
+            m_lru.splice(m_lru.end(), m_lru, it->second.lruPosition);
+            return it->second.pixels;
+        }
+    }
+
+    TRACE_FUNCTION();
+
+    // Each child tile covers one quadrant, tiles past the right or bottom edge are missing
+    const size_t tileBytes = static_cast<size_t>(m_tileSize) * m_tileSize * 4;
+    const size_t stride = static_cast<size_t>(m_tileSize) * 4;
+    const uint32_t half = m_tileSize / 2;
+    const uint32_t childLevel = key.level - 1;
+    std::vector<uint8_t> pixels(tileBytes, 0);
+    std::vector<uint8_t> fileTile;
+    for (uint32_t cy = 0; cy < 2; cy++) {
+        for (uint32_t cx = 0; cx < 2; cx++) {
+            const TileKey child{childLevel, key.x * 2 + cx, key.y * 2 + cy};
+            if (child.x >= tilesX(childLevel) || child.y >= tilesY(childLevel))
+                continue;
+
+            Pixels cached;
+            const uint8_t *src;
+            if (childLevel == 0) {
+                fileTile.resize(tileBytes);
+                readFileTile(child, fileTile.data());
+                src = fileTile.data();
+            } else {
+                cached = coarseTile(child);
+                src = cached->data();
+            }
+
+            const uint32_t columns = static_cast<uint32_t>(
+                std::min<uint64_t>(m_tileSize,
+                                   levelWidth(childLevel) - uint64_t(child.x) * m_tileSize));
+            const uint32_t rows = static_cast<uint32_t>(
+                std::min<uint64_t>(m_tileSize,
+                                   levelHeight(childLevel) - uint64_t(child.y) * m_tileSize));
+            uint8_t *dst = pixels.data()
+                           + (static_cast<size_t>(cy) * half * m_tileSize + cx * half) * 4;
+            halveRegion(src, stride, columns, rows, dst, stride);
+        }
+    }
+
+    Pixels result = std::make_shared<const std::vector<uint8_t>>(std::move(pixels));
+
+    std::lock_guard<std::mutex> lock(m_cacheMutex);
+    if (m_cache.count(key) != 0)
+        return result;
+
+    m_lru.push_back(key);
+    m_cache.emplace(key, CachedTile{result, std::prev(m_lru.end())});
+
+    // The finest level goes first, it is the cheapest to build again and the coarse levels
+    // are what every zoom out and the pinned top level come back to
+    const size_t maxTiles = std::max<size_t>(COARSE_CACHE_BYTES / tileBytes, 1);
+    while (m_cache.size() > maxTiles) {
+        auto victim = m_lru.begin();
+        for (auto it = m_lru.begin(); it != m_lru.end(); ++it) {
+            if (it->level < victim->level)
+                victim = it;
+        }
+        m_cache.erase(*victim);
+        m_lru.erase(victim);
+    }
+    return result;
+}
+
+TileCache::TileCache(uint32_t slotCount)
+{
+    m_freeSlots.reserve(slotCount);
+    for (uint32_t i = slotCount; i > 0; i--) {
+        m_freeSlots.push_back(static_cast<int32_t>(i - 1));
+    }
+}
+
+int32_t TileCache::find(const TileKey &key) const
+{
+    auto it = m_entries.find(key);
+    return it == m_entries.end() ? -1 : it->second.slot;
+}
+
+void TileCache::touch(const TileKey &key, uint64_t frame)
+{
+    auto it = m_entries.find(key);
+    if (it == m_entries.end())
+        return;
+
+    it->second.lastUsedFrame = frame;
+    m_lru.splice(m_lru.end(), m_lru, it->second.lruPosition);
+}
+
+void TileCache::pin(const TileKey &key)
+{
+    auto it = m_entries.find(key);
+    if (it != m_entries.end())
+        it->second.pinned = true;
+}
+
+int32_t TileCache::insert(const TileKey &key, uint64_t frame)
+{
+    auto existing = m_entries.find(key);
+    if (existing != m_entries.end()) {
+        touch(key, frame);
+        return existing->second.slot;
+    }
+
+    int32_t slot;
+    if (!m_freeSlots.empty()) {
+        slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    } else {
+        auto victim = std::find_if(m_lru.begin(), m_lru.end(), [&](const TileKey &candidate) {
+            const Entry &entry = m_entries.at(candidate);
+            return !entry.pinned && entry.lastUsedFrame != frame;
+        });
+        if (victim == m_lru.end())
+            return -1;
+
+        slot = m_entries.at(*victim).slot;
+        m_entries.erase(*victim);
+        m_lru.erase(victim);
+    }
+
+    m_lru.push_back(key);
+    m_entries.emplace(key, Entry{slot, frame, false, std::prev(m_lru.end())});
+    return slot;
+}
+
+TileLoader::TileLoader(const TileSource &source,
+                       size_t maxCompletedTiles,
+                       std::function<void()> onTileLoaded)
+    : m_source(source)
+    , m_maxCompletedTiles(maxCompletedTiles)
+    , m_onTileLoaded(std::move(onTileLoaded))
+    , m_thread(&TileLoader::run, this)
+{}
+
+TileLoader::~TileLoader()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_condition.notify_all();
+    m_thread.join();
+}
+
+void TileLoader::request(const std::vector<TileKey> &keys)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // Tiles that scrolled out of view before being loaded are dropped.
+        for (const auto &key : m_pending) {
+            m_queued.erase(key);
+        }
+        m_pending.clear();
+
+        for (const auto &key : keys) {
+            if (m_queued.insert(key).second)
+                m_pending.push_back(key);
+        }
+    }
+    m_condition.notify_all();
+}
+
+std::vector<TileLoader::LoadedTile> TileLoader::takeCompleted(size_t maxCount)
+{
+    std::vector<LoadedTile> tiles;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        while (!m_completed.empty() && tiles.size() < maxCount) {
+            m_queued.erase(m_completed.front().key);
+            tiles.push_back(std::move(m_completed.front()));
+            m_completed.pop_front();
+        }
+    }
+    m_condition.notify_all();
+    return tiles;
+}
+
+bool TileLoader::isQueued(const TileKey &key)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_queued.count(key) != 0;
+}
+
+void TileLoader::run()
+{
+    Tracer::setThreadName("tile loader");
+
+    const size_t tileBytes = static_cast<size_t>(m_source.tileSize()) * m_source.tileSize() * 4;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_condition.wait(lock, [this] {
+            return m_stop || (!m_pending.empty() && m_completed.size() < m_maxCompletedTiles);
+        });
+        if (m_stop)
+            return;
+
+        LoadedTile tile;
+        tile.key = m_pending.front();
+        m_pending.pop_front();
+
+        lock.unlock();
+        {
+            TRACE_SCOPE("read tile");
+            tile.pixels.resize(tileBytes);
+            m_source.readTile(tile.key, tile.pixels.data());
+        }
+        lock.lock();
+
+        m_completed.push_back(std::move(tile));
+
+        lock.unlock();
+        m_onTileLoaded();
+        lock.lock();
+    }
+}
@@ -0,0 +1,168 @@
+#ifndef TILESTREAMER_H
+#define TILESTREAMER_H
+
+#include "bmpreader.h"
+
+#include <QString>
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+struct TileKey
+{
+    uint32_t level;
+    uint32_t x;
+    uint32_t y;
+
+    bool operator==(const TileKey &other) const
+    {
+        return level == other.level && x == other.x && y == other.y;
+    }
+};
+
+struct TileKeyHash
+{
+    size_t operator()(const TileKey &key) const
+    {
+        return (size_t(key.level) << 48) ^ (size_t(key.y) << 24) ^ size_t(key.x);
+    }
+};
+
+// Reads fixed-size RGBA tiles of any pyramid level straight out of an
+// uncompressed BMP file, without ever decoding the whole image.
+//
+// Level 0 tiles come straight from the file. Coarser ones are halved from the four tiles of
+// the level below in linear light, like the mip chain of a whole texture, and the coarse
+// tiles are kept in a CPU cache. Building a tile thus reads each texel under it once, and
+// zooming out or in again reuses the levels that were built on the way.
+class TileSource
+{
+public:
+    TileSource(const QString &fileName, uint32_t tileSize);
+
+    // Tiles read single texels, which needs a 24 or 32 bit file
+    bool isValid() const { return m_reader.isValid() && m_reader.hasDirectPixels(); }
+
+    uint32_t width() const { return m_reader.width(); }
+    uint32_t height() const { return m_reader.height(); }
+    uint32_t tileSize() const { return m_tileSize; }
+    uint32_t levelCount() const { return m_levelCount; }
+
+    uint32_t tilesX(uint32_t level) const;
+    uint32_t tilesY(uint32_t level) const;
+
+    // Writes tileSize * tileSize RGBA texels, zero outside the image. Thread safe.
+    void readTile(const TileKey &key, uint8_t *rgba) const;
+
+private:
+    using Pixels = std::shared_ptr<const std::vector<uint8_t>>;
+
+    struct CachedTile
+    {
+        Pixels pixels;
+        std::list<TileKey>::iterator lruPosition;
+    };
+
+    // Bound on the coarse tiles kept, 512 of 256 x 256
+    static const size_t COARSE_CACHE_BYTES = size_t(128) << 20;
+
+    // Texels of the level, rounded up
+    uint32_t levelWidth(uint32_t level) const;
+    uint32_t levelHeight(uint32_t level) const;
+
+    void readFileTile(const TileKey &key, uint8_t *rgba) const;
+
+    // A tile of level 1 or up, cached or built from the level below and cached
+    Pixels coarseTile(const TileKey &key) const;
+
+    BmpReader m_reader;
+    uint32_t m_tileSize;
+    uint32_t m_levelCount = 1;
+
+    mutable std::mutex m_cacheMutex;
+    mutable std::unordered_map<TileKey, CachedTile, TileKeyHash> m_cache;
+    // Least recently used first
+    mutable std::list<TileKey> m_lru;
+};
+
+// Slot bookkeeping for the GPU tile atlas with least-recently-used eviction.
+class TileCache
+{
+public:
+    explicit TileCache(uint32_t slotCount);
+
+    // Returns the atlas slot of a resident tile, or -1.
+    int32_t find(const TileKey &key) const;
+
+    void touch(const TileKey &key, uint64_t frame);
+
+    void pin(const TileKey &key);
+
+    // Returns a slot for the new tile, evicting the least recently used one that was
+    // not touched in the current frame. Returns -1 when everything is in use.
+    int32_t insert(const TileKey &key, uint64_t frame);
+
+    uint32_t residentCount() const { return static_cast<uint32_t>(m_entries.size()); }
+
+private:
+    struct Entry
+    {
+        int32_t slot;
+        uint64_t lastUsedFrame;
+        bool pinned;
+        std::list<TileKey>::iterator lruPosition;
+    };
+
+    std::unordered_map<TileKey, Entry, TileKeyHash> m_entries;
+    std::list<TileKey> m_lru;
+    std::vector<int32_t> m_freeSlots;
+};
+
+// Background thread filling tile cache misses from a TileSource.
+class TileLoader
+{
+public:
+    struct LoadedTile
+    {
+        TileKey key;
+        std::vector<uint8_t> pixels;
+    };
+
+    TileLoader(const TileSource &source,
+               size_t maxCompletedTiles,
+               std::function<void()> onTileLoaded);
+    ~TileLoader();
+
+    // Replaces the pending queue; keys are loaded in the given order.
+    void request(const std::vector<TileKey> &keys);
+
+    std::vector<LoadedTile> takeCompleted(size_t maxCount);
+
+    bool isQueued(const TileKey &key);
+
+private:
+    void run();
+
+    const TileSource &m_source;
+    size_t m_maxCompletedTiles;
+    std::function<void()> m_onTileLoaded;
+
+    std::mutex m_mutex;
+    std::condition_variable m_condition;
+    std::deque<TileKey> m_pending;
+    std::unordered_set<TileKey, TileKeyHash> m_queued;
+    std::deque<LoadedTile> m_completed;
+    bool m_stop = false;
+    std::thread m_thread;
+};
+
+#endif // TILESTREAMER_H
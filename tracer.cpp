@@ -0,0 +1,191 @@
+#include "tracer.h"
+
+#include <QByteArray>
+#include <QDebug>
+#include <QSaveFile>
+#include <QString>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+// Beyond this a thread stops recording, about 24 MiB of events
+const size_t MAX_EVENTS_PER_THREAD = size_t(1) << 20;
+const size_t EVENTS_PER_CHUNK = 4096;
+
+struct Event
+{
+    const char *name;
+    uint64_t start;
+    uint64_t duration;
+};
+
+// Filled by its thread only. Readers see events up to count, and chunks through next,
+// both published with release stores.
+struct Chunk
+{
+    Event events[EVENTS_PER_CHUNK];
+    std::atomic<size_t> count{0};
+    std::atomic<Chunk *> next{nullptr};
+};
+
+struct ThreadBuffer
+{
+    uint32_t id = 0;
+    std::atomic<const char *> name{nullptr};
+    Chunk head;
+    Chunk *tail = &head;
+    size_t total = 0;
+
+    ~ThreadBuffer()
+    {
+        Chunk *chunk = head.next.load();
+        while (chunk) {
+            Chunk *next = chunk->next.load();
+            delete chunk;
+            chunk = next;
+        }
+    }
+};
+
+struct Registry
+{
+    const QString fileName = qEnvironmentVariable("VIV_TRACE");
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+    std::mutex mutex;
+    // Buffers are kept after their thread exits so its events still get written
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+};
+
+Registry &registry()
+{
+    static Registry instance;
+    return instance;
+}
+
+ThreadBuffer &threadBuffer()
+{
+    thread_local std::shared_ptr<ThreadBuffer> buffer = [] {
+        auto created = std::make_shared<ThreadBuffer>();
+        Registry &reg = registry();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        created->id = static_cast<uint32_t>(reg.buffers.size() + 1);
+        reg.buffers.push_back(created);
+        return created;
+    }();
+    return *buffer;
+}
+
+// Scope names are identifiers or short phrases, this only guards the JSON syntax
+QByteArray escaped(const char *text)
+{
+    QByteArray result;
+    for (const char *c = text; *c; c++) {
+        if (*c == '"' || *c == '\\')
+            result += '\\';
+        result += *c;
+    }
+    return result;
+}
+} // namespace
+
+bool Tracer::isEnabled()
+{
+    static const bool enabled = !registry().fileName.isEmpty();
+    return enabled;
+}
+
+bool Tracer::statsEnabled()
+{
+    static const bool enabled = qEnvironmentVariableIntValue("VIV_FRAME_STATS") != 0;
+    return enabled;
+}
+
+uint64_t Tracer::now()
+{
+    const auto elapsed = std::chrono::steady_clock::now() - registry().epoch;
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+}
+
+void Tracer::record(const char *name, uint64_t start, uint64_t end)
+{
+    ThreadBuffer &buffer = threadBuffer();
+    if (buffer.total >= MAX_EVENTS_PER_THREAD)
+        return;
+
+    Chunk *chunk = buffer.tail;
+    size_t count = chunk->count.load(std::memory_order_relaxed);
+    if (count == EVENTS_PER_CHUNK) {
+        Chunk *next = new Chunk;
+        chunk->next.store(next, std::memory_order_release);
+        buffer.tail = chunk = next;
+        count = 0;
+    }
+
+    chunk->events[count] = {name, start, end - start};
+    chunk->count.store(count + 1, std::memory_order_release);
+    buffer.total++;
+}
+
+void Tracer::setThreadName(const char *name)
+{
+    if (isEnabled())
+        threadBuffer().name.store(name, std::memory_order_release);
+}
+
+void Tracer::write()
+{
+    if (!isEnabled())
+        return;
+
+    Registry &reg = registry();
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        buffers = reg.buffers;
+    }
+
+    QByteArray json = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    auto append = [&](const QByteArray &event) {
+        if (!first)
+            json += ",\n";
+        json += event;
+        first = false;
+    };
+
+    size_t eventCount = 0;
+    for (const auto &buffer : buffers) {
+        const QByteArray tid = QByteArray::number(buffer->id);
+        if (const char *name = buffer->name.load(std::memory_order_acquire)) {
+            append("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" + tid
+                   + ",\"args\":{\"name\":\"" + escaped(name) + "\"}}");
+        }
+
+        // Timestamps are in microseconds, fractions keep the nanoseconds
+        for (const Chunk *chunk = &buffer->head; chunk;
+             chunk = chunk->next.load(std::memory_order_acquire)) {
+            const size_t count = chunk->count.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; i++) {
+                const Event &event = chunk->events[i];
+                append("{\"name\":\"" + escaped(event.name) + "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                       + tid + ",\"ts\":" + QByteArray::number(event.start / 1e3, 'f', 3)
+                       + ",\"dur\":" + QByteArray::number(event.duration / 1e3, 'f', 3) + "}");
+            }
+            eventCount += count;
+        }
+    }
+    json += "\n]}\n";
+
+    QSaveFile file(reg.fileName);
+    if (!file.open(QIODevice::WriteOnly) || file.write(json) != json.size() || !file.commit()) {
+        qWarning() << "failed to write trace" << reg.fileName;
+        return;
+    }
+    qDebug() << "wrote" << eventCount << "trace events to" << reg.fileName;
+}
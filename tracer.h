@@ -0,0 +1,62 @@
+#ifndef TRACER_H
+#define TRACER_H
+
+#include <cstdint>
+
+// CPU scope tracing written as a Chrome trace (chrome://tracing, ui.perfetto.dev).
+//
+// VIV_TRACE=<file> turns it on, the file is written by Tracer::write() at exit. Every thread
+// appends complete events to its own buffer, so recording takes no locks; only a thread's
+// first event registers its buffer. Scope names must outlive the process, string literals
+// and __func__ both do.
+class Tracer
+{
+public:
+    static bool isEnabled();
+
+    // VIV_FRAME_STATS=1, which also prints the timings and cache decisions made per load,
+    // lookup or eviction that the trace scopes cover otherwise
+    static bool statsEnabled();
+
+    // Nanoseconds since the tracer was first used
+    static uint64_t now();
+
+    static void record(const char *name, uint64_t start, uint64_t end);
+
+    // Shown in the viewer instead of the thread id
+    static void setThreadName(const char *name);
+
+    // Safe while other threads are still recording, their newest events may be left out
+    static void write();
+};
+
+class TraceScope
+{
+public:
+    explicit TraceScope(const char *name)
+        : m_name(name)
+        , m_enabled(Tracer::isEnabled())
+        , m_start(m_enabled ? Tracer::now() : 0)
+    {}
+
+    ~TraceScope()
+    {
+        if (m_enabled)
+            Tracer::record(m_name, m_start, Tracer::now());
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    TraceScope &operator=(const TraceScope &) = delete;
+
+private:
+    const char *m_name;
+    bool m_enabled;
+    uint64_t m_start;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_FUNCTION() TRACE_SCOPE(__func__)
+
+#endif // TRACER_H
@@ -0,0 +1,282 @@
+#include "uploadqueue.h"
+
+#include "tracer.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+UploadQueue::UploadQueue(const RenderContext &context,
+                         GpuProfiler &profiler,
+                         VkCommandPool commandPool,
+                         VkCommandPool transferCommandPool)
+    : m_context(context)
+    , m_profiler(profiler)
+    , m_commandPool(commandPool)
+    , m_transferCommandPool(transferCommandPool)
+{}
+
+UploadQueue::~UploadQueue()
+{
+    retire(true);
+    for (auto fence : m_freeFences) {
+        vkDestroyFence(m_context.device, fence, nullptr);
+    }
+    for (auto semaphore : m_freeSemaphores) {
+        vkDestroySemaphore(m_context.device, semaphore, nullptr);
+    }
+}
+
+VkCommandBuffer UploadQueue::beginCommands(VkDevice device, VkCommandPool pool)
+{
+    VkCommandBufferAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandPool = pool;
+    allocInfo.commandBufferCount = 1;
+
+    VkCommandBuffer commandBuffer;
+    if (vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate upload command buffer!");
+    }
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    return commandBuffer;
+}
+
+VkCommandBuffer UploadQueue::commandBuffer()
+{
+    if (m_commandBuffer == VK_NULL_HANDLE) {
+        m_commandBuffer = beginCommands(m_context.device, m_commandPool);
+
+        m_querySet = m_profiler.acquireSet();
+        m_profiler.resetSet(m_commandBuffer, m_querySet);
+        m_profiler.beginScope(m_commandBuffer, m_querySet, GpuScope::Upload);
+    }
+
+    return m_commandBuffer;
+}
+
+VkCommandBuffer UploadQueue::transferCommandBuffer()
+{
+    if (m_context.transferQueue == VK_NULL_HANDLE)
+        return commandBuffer();
+
+    if (m_transferCommandBuffer == VK_NULL_HANDLE)
+        m_transferCommandBuffer = beginCommands(m_context.device, m_transferCommandPool);
+
+    return m_transferCommandBuffer;
+}
+
+void UploadQueue::timeMips(uint32_t levels, const char *filter)
+{
+    // Timestamp and statistics queries can only be written once between resets
+    if (m_mips.textures == 0) {
+        m_profiler.beginScope(commandBuffer(), m_querySet, GpuScope::MipGeneration);
+        m_mips.filter = filter;
+    } else if (std::strcmp(m_mips.filter, filter) != 0) {
+        m_mips.filter = "mixed";
+    }
+    m_mips.textures++;
+    m_mips.levels = std::max(m_mips.levels, levels);
+}
+
+void UploadQueue::releaseAfterUpload(VkBuffer buffer, DeviceAllocation &memory)
+{
+    m_pendingStagingBuffers.push_back({buffer, memory});
+    memory = DeviceAllocation{};
+}
+
+void UploadQueue::releaseAfterUpload(VkImageView imageView)
+{
+    m_pendingImageViews.push_back(imageView);
+}
+
+void UploadQueue::releaseAfterUpload(VkDescriptorPool descriptorPool)
+{
+    m_pendingDescriptorPools.push_back(descriptorPool);
+}
+
+uint64_t UploadQueue::submit()
+{
+    TRACE_FUNCTION();
+
+    if (m_commandBuffer == VK_NULL_HANDLE && m_transferCommandBuffer == VK_NULL_HANDLE)
+        return m_serial;
+
+    Batch batch{};
+
+    // The transfer part goes first and the graphics part waits for it, so the graphics fence
+    // also covers the copies
+    if (m_transferCommandBuffer != VK_NULL_HANDLE) {
+        if (vkEndCommandBuffer(m_transferCommandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record transfer command buffer!");
+        }
+
+        batch.transferCommandBuffer = m_transferCommandBuffer;
+        m_transferCommandBuffer = VK_NULL_HANDLE;
+
+        if (m_freeSemaphores.empty()) {
+            VkSemaphoreCreateInfo semaphoreInfo{};
+            semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+            if (vkCreateSemaphore(m_context.device,
+                                  &semaphoreInfo,
+                                  nullptr,
+                                  &batch.transferSemaphore)
+                != VK_SUCCESS) {
+                throw std::runtime_error("failed to create upload semaphore!");
+            }
+        } else {
+            batch.transferSemaphore = m_freeSemaphores.back();
+            m_freeSemaphores.pop_back();
+        }
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &batch.transferCommandBuffer;
+        submitInfo.signalSemaphoreCount = 1;
+        submitInfo.pSignalSemaphores = &batch.transferSemaphore;
+
+        if (vkQueueSubmit(m_context.transferQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit transfer command buffer!");
+        }
+
+        // The ownership acquire barriers live in the graphics part
+        commandBuffer();
+    }
+
+    // Buffer copies have to land before any later submission reads them as vertices or indices,
+    // image copies are already covered by their layout transitions
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT;
+
+    vkCmdPipelineBarrier(m_commandBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+                         0,
+                         1,
+                         &barrier,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr);
+
+    if (m_mips.textures > 0)
+        m_profiler.endScope(m_commandBuffer, m_querySet, GpuScope::MipGeneration);
+
+    // Only the graphics part is timed, copies on the transfer queue are not included
+    m_profiler.endScope(m_commandBuffer, m_querySet, GpuScope::Upload);
+
+    if (vkEndCommandBuffer(m_commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record upload command buffer!");
+    }
+
+    batch.serial = ++m_serial;
+    batch.commandBuffer = m_commandBuffer;
+    batch.querySet = m_querySet;
+    batch.mips = m_mips;
+    m_mips = MipTiming{};
+    batch.stagingBuffers = std::move(m_pendingStagingBuffers);
+    batch.imageViews = std::move(m_pendingImageViews);
+    batch.descriptorPools = std::move(m_pendingDescriptorPools);
+    m_commandBuffer = VK_NULL_HANDLE;
+    m_pendingStagingBuffers.clear();
+    m_pendingImageViews.clear();
+    m_pendingDescriptorPools.clear();
+
+    if (m_freeFences.empty()) {
+        VkFenceCreateInfo fenceInfo{};
+        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+        if (vkCreateFence(m_context.device, &fenceInfo, nullptr, &batch.fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create upload fence!");
+        }
+    } else {
+        batch.fence = m_freeFences.back();
+        m_freeFences.pop_back();
+    }
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch.commandBuffer;
+
+    const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    if (batch.transferSemaphore != VK_NULL_HANDLE) {
+        submitInfo.waitSemaphoreCount = 1;
+        submitInfo.pWaitSemaphores = &batch.transferSemaphore;
+        submitInfo.pWaitDstStageMask = &waitStage;
+    }
+
+    if (vkQueueSubmit(m_context.graphicsQueue, 1, &submitInfo, batch.fence) != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit upload command buffer!");
+    }
+    m_profiler.submitted(batch.querySet);
+
+    m_inFlight.push_back(std::move(batch));
+    return m_serial;
+}
+
+UploadQueue::MipTiming UploadQueue::retire(bool wait)
+{
+    TRACE_FUNCTION();
+
+    MipTiming mips;
+    while (!m_inFlight.empty()) {
+        auto &batch = m_inFlight.front();
+        if (wait) {
+            vkWaitForFences(m_context.device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+        } else if (vkGetFenceStatus(m_context.device, batch.fence) != VK_SUCCESS) {
+            break;
+        }
+
+        for (auto &staging : batch.stagingBuffers) {
+            vkDestroyBuffer(m_context.device, staging.buffer, nullptr);
+            m_context.allocator->free(staging.memory);
+        }
+        for (auto imageView : batch.imageViews) {
+            vkDestroyImageView(m_context.device, imageView, nullptr);
+        }
+        for (auto descriptorPool : batch.descriptorPools) {
+            vkDestroyDescriptorPool(m_context.device, descriptorPool, nullptr);
+        }
+
+        m_profiler.collect(batch.querySet);
+        m_profiler.releaseSet(batch.querySet);
+        if (batch.mips.textures > 0)
+            mips = batch.mips;
+        vkFreeCommandBuffers(m_context.device, m_commandPool, 1, &batch.commandBuffer);
+        if (batch.transferCommandBuffer != VK_NULL_HANDLE) {
+            vkFreeCommandBuffers(m_context.device,
+                                 m_transferCommandPool,
+                                 1,
+                                 &batch.transferCommandBuffer);
+            m_freeSemaphores.push_back(batch.transferSemaphore);
+        }
+        vkResetFences(m_context.device, 1, &batch.fence);
+        m_freeFences.push_back(batch.fence);
+
+        m_completedSerial = batch.serial;
+        m_inFlight.pop_front();
+    }
+    return mips;
+}
+
+void UploadQueue::waitFor(uint64_t serial)
+{
+    // Batches are in serial order
+    for (const Batch &batch : m_inFlight) {
+        if (batch.serial > serial)
+            break;
+        vkWaitForFences(m_context.device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+    }
+}
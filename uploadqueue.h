@@ -0,0 +1,115 @@
+#ifndef UPLOADQUEUE_H
+#define UPLOADQUEUE_H
+
+#include "deviceallocator.h"
+#include "gpuprofiler.h"
+#include "rendercontext.h"
+
+#include <vulkan/vulkan.h>
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Batches a window's uploads into one submission tracked by a fence. Everything recorded
+// between two submit() calls goes out together and gets the next serial; what the commands
+// read is released once that serial has completed. With a dedicated transfer queue the copies
+// run there and the graphics part of the batch waits for them.
+class UploadQueue
+{
+public:
+    struct StagingBuffer
+    {
+        VkBuffer buffer;
+        DeviceAllocation memory;
+    };
+
+    // What the mip generation of a completed batch built, textures is zero when it built none
+    struct MipTiming
+    {
+        uint32_t textures = 0;
+        uint32_t levels = 0;
+        const char *filter = nullptr;
+    };
+
+    // commandPool is on the graphics family, transferCommandPool on the transfer family or
+    // null without a transfer queue
+    UploadQueue(const RenderContext &context,
+                GpuProfiler &profiler,
+                VkCommandPool commandPool,
+                VkCommandPool transferCommandPool);
+
+    // Waits for every batch in flight
+    ~UploadQueue();
+
+    // A one time submit command buffer from pool, already begun
+    static VkCommandBuffer beginCommands(VkDevice device, VkCommandPool pool);
+
+    // Returns the command buffer of the batch being recorded, starting one if needed
+    VkCommandBuffer commandBuffer();
+
+    // Same for the dedicated transfer queue, falls back to the graphics batch without one
+    VkCommandBuffer transferCommandBuffer();
+
+    // Called before recording a texture's mip generation. The first one in a batch opens its
+    // MipGeneration scope and submit() closes it, so all textures of the batch are timed
+    // together, along with whatever else is recorded after the first. The largest levels
+    // count is reported, and a filter that differs between textures as mixed.
+    void timeMips(uint32_t levels, const char *filter);
+
+    // Destroys a staging buffer once the batch it was recorded into has completed
+    void releaseAfterUpload(VkBuffer buffer, DeviceAllocation &memory);
+    void releaseAfterUpload(VkImageView imageView);
+    void releaseAfterUpload(VkDescriptorPool descriptorPool);
+
+    // Submits the recorded batch without waiting and returns its serial
+    uint64_t submit();
+
+    // Releases what completed batches held, waiting for all of them with wait. Returns what
+    // the last of them that generated mips built.
+    MipTiming retire(bool wait);
+
+    // Waits until the batch with serial has completed, retire() releases what it held
+    void waitFor(uint64_t serial);
+
+    // The last submitted batch, the one being recorded gets nextSerial()
+    uint64_t serial() const { return m_serial; }
+    uint64_t nextSerial() const { return m_serial + 1; }
+    uint64_t completedSerial() const { return m_completedSerial; }
+
+private:
+    struct Batch
+    {
+        uint64_t serial;
+        VkCommandBuffer commandBuffer;
+        VkFence fence;
+        VkCommandBuffer transferCommandBuffer;
+        VkSemaphore transferSemaphore;
+        uint32_t querySet;
+        MipTiming mips;
+        std::vector<VkImageView> imageViews;
+        std::vector<VkDescriptorPool> descriptorPools;
+        std::vector<StagingBuffer> stagingBuffers;
+    };
+
+    const RenderContext &m_context;
+    GpuProfiler &m_profiler;
+    VkCommandPool m_commandPool;
+    VkCommandPool m_transferCommandPool;
+
+    VkCommandBuffer m_commandBuffer = VK_NULL_HANDLE;
+    uint32_t m_querySet = 0;
+    MipTiming m_mips;
+    VkCommandBuffer m_transferCommandBuffer = VK_NULL_HANDLE;
+    std::vector<VkImageView> m_pendingImageViews;
+    std::vector<VkDescriptorPool> m_pendingDescriptorPools;
+    std::vector<StagingBuffer> m_pendingStagingBuffers;
+
+    std::deque<Batch> m_inFlight;
+    std::vector<VkFence> m_freeFences;
+    std::vector<VkSemaphore> m_freeSemaphores;
+    uint64_t m_serial = 0;
+    uint64_t m_completedSerial = 0;
+};
+
+#endif // UPLOADQUEUE_H
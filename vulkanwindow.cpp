@@ -1,23 +1,150 @@
 #include "vulkanwindow.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <set>
 #include <stdexcept>
 
-VulkanWindow::VulkanWindow()
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+// Peak resident set size of the process in bytes
+size_t peakResidentSetSize()
+{
+#ifdef Q_OS_WIN
+    PROCESS_MEMORY_COUNTERS counters{};
+    GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+    return counters.PeakWorkingSetSize;
+#else
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef Q_OS_MACOS
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+// GPU overlay bars in the top left corner, one per scope
+const int32_t OVERLAY_MARGIN = 8;
+const int32_t OVERLAY_BAR_HEIGHT = 6;
+const int32_t OVERLAY_BAR_SPACING = 4;
+const float OVERLAY_BAR_WIDTH = 200;
+
+const int ACTIVITY_REPORT_MS = 60 * 1000;
+
+const char *presentModeName(VkPresentModeKHR mode)
+{
+    switch (mode) {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR:
+        return "immediate";
+    case VK_PRESENT_MODE_MAILBOX_KHR:
+        return "mailbox";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+        return "fifo relaxed";
+    default:
+        return "fifo";
+    }
+}
+
+VkRect2D unite(const VkRect2D &a, const VkRect2D &b)
 {
-    auto imageName = openImage();
+    if (a.extent.width == 0 || a.extent.height == 0)
+        return b;
+    if (b.extent.width == 0 || b.extent.height == 0)
+        return a;
+
+    const int32_t left = std::min(a.offset.x, b.offset.x);
+    const int32_t top = std::min(a.offset.y, b.offset.y);
+    const int64_t right = std::max(int64_t(a.offset.x) + a.extent.width,
+                                   int64_t(b.offset.x) + b.extent.width);
+    const int64_t bottom = std::max(int64_t(a.offset.y) + a.extent.height,
+                                    int64_t(b.offset.y) + b.extent.height);
+    return {{left, top}, {uint32_t(right - left), uint32_t(bottom - top)}};
+}
+
+// Empty rects keep the offset of a
+VkRect2D intersect(const VkRect2D &a, const VkRect2D &b)
+{
+    const int64_t left = std::max(a.offset.x, b.offset.x);
+    const int64_t top = std::max(a.offset.y, b.offset.y);
+    const int64_t right = std::min(int64_t(a.offset.x) + a.extent.width,
+                                   int64_t(b.offset.x) + b.extent.width);
+    const int64_t bottom = std::min(int64_t(a.offset.y) + a.extent.height,
+                                    int64_t(b.offset.y) + b.extent.height);
+    if (right <= left || bottom <= top)
+        return {a.offset, {0, 0}};
+    return {{int32_t(left), int32_t(top)}, {uint32_t(right - left), uint32_t(bottom - top)}};
+}
+} // namespace
+
+VulkanWindow::VulkanWindow(const Options &options)
+{
+    m_options = options;
+    m_offscreen = !options.outputFile.isEmpty();
+
+    // Windows after the first one share its device
+    if (!m_offscreen)
+        m_context = RenderContext::shared();
+    const bool sharedContext = m_context != nullptr;
+    if (!sharedContext)
+        m_context = std::make_shared<RenderContext>();
+
+    // Loading the driver needs nothing from the user, so it overlaps the file dialog
+    std::future<void> instance;
+    if (!sharedContext)
+        instance = std::async(std::launch::async, [this] { createInstance(); });
+
+    auto imageName = options.imageName.isEmpty() ? openImage() : options.imageName;
     if (imageName == "")
         qFatal("Invalid input file!");
+    m_options.imageName = imageName;
+
+    if (options.gridImages.size() > 1)
+        m_grid = GridView(options.gridImages);
+
+    m_startupTimer.start();
+    m_frameStatsEnabled = Tracer::statsEnabled();
+    m_alwaysRecord = qEnvironmentVariableIntValue("VIV_RERECORD") != 0;
+    m_gpuOverlay = qEnvironmentVariableIntValue("VIV_GPU_OVERLAY") != 0;
+    m_cacheReadback = qEnvironmentVariableIntValue("VIV_TEXTURE_CACHE_READBACK") != 0;
+    choosePresentProfile(requestedPresentProfile());
+
+    if (m_frameStatsEnabled)
+        QTimer::singleShot(ACTIVITY_REPORT_MS, this, [this] { reportActivity(); });
+
+    // Reading the file overlaps device setup, the filter the device ends up with is only a
+    // guess here and openTextureSource runs again when it differs. An image another window
+    // already shows is not read at all.
+    if (!m_context->textures
+        || !m_context->textures->find(QFileInfo(imageName).absoluteFilePath())) {
+        m_textureSource = std::async(std::launch::async, [this, imageName] {
+            return openTextureSource(imageName, requestedMipFilter(), requestedCompression());
+        });
+    }
 
     this->resize(800, 600);
 
     this->setTitle(imageName);
+    if (instance.valid())
+        instance.get();
     initVulkan(imageName);
+    applyStartupView();
+
+    // Deferred so the exit status is reported from inside the event loop
+    if (m_offscreen)
+        QTimer::singleShot(0, this, [this] { renderOffscreen(); });
 }
 
 bool VulkanWindow::event(QEvent *e)
 {
-    bool redraw = false;
+    bool inputRedraw = false;
     QEvent::Type type = e->type();
 
     if (type == QEvent::MouseButtonPress) {
@@ -37,7 +164,7 @@ bool VulkanWindow::event(QEvent *e)
             imagePan(dY, dX);
 
             m_panStart = pos;
-            redraw = true;
+            inputRedraw = true;
         }
     }
 
@@ -52,31 +179,243 @@ bool VulkanWindow::event(QEvent *e)
         auto zoomIn = scroll->angleDelta().y() > 0;
         auto pos = QWindow::mapFromGlobal(QCursor::pos());
 
+        // Every cell zooms around the same point of its image
+        if (!m_grid.isEmpty()) {
+            const VkExtent2D cell = viewExtent();
+            pos = QPoint(pos.x() % int(cell.width), pos.y() % int(cell.height));
+        }
         onZoomToPixel(pos.x(), pos.y(), zoomIn);
-        redraw = true;
+        inputRedraw = true;
     }
-    if (type == QEvent::Close) {
-        vkDeviceWaitIdle(m_device);
+    if (type == QEvent::Close && m_vulkanInitDone) {
+        if (m_frameStatsEnabled) {
+            for (size_t i = 0; i < m_profileLatency.size(); i++) {
+                if (m_profileLatency[i].samples > 0)
+                    reportPresentProfile(static_cast<PresentProfile>(i));
+            }
+        }
+        waitForSubmittedWork();
         cleanup();
-        qApp->quit();
+        // An UpdateRequest may still be queued behind the close
+        m_vulkanInitDone = false;
+        if (!RenderContext::shared())
+            qApp->quit();
+        if (m_deleteOnClose)
+            deleteLater();
     }
 
     if (type == QEvent::Resize) {
         m_framebufferResized = true;
-        redraw = true;
     }
 
-    if (type == QEvent::Show || type == QEvent::Expose) {
-        redraw = true;
+    // The swapchain is clipped, so pixels that were covered are undefined once uncovered.
+    // The damage render pass would keep them, every image is drawn in full instead.
+    bool exposed = false;
+    if (type == QEvent::Expose && isExposed() && m_vulkanInitDone) {
+        exposed = true;
+        m_recordedFrames.assign(m_recordedFrames.size(), RecordedFrame{});
+        m_presentedFrame = RecordedFrame{};
+    }
+
+    if (type == QEvent::KeyPress && m_vulkanInitDone
+        && reinterpret_cast<QKeyEvent *>(e)->key() == Qt::Key_P) {
+        cyclePresentProfile();
+    }
+    if (type == QEvent::KeyPress && m_vulkanInitDone && !m_offscreen
+        && reinterpret_cast<QKeyEvent *>(e)->key() == Qt::Key_N) {
+        openWindow(m_displayedImage.isEmpty() ? m_options.imageName : m_displayedImage);
+    }
+
+    if (type == QEvent::KeyPress && !m_browser.isEmpty())
+        showImage(m_browser.indexForKey(reinterpret_cast<QKeyEvent *>(e)->key()));
+
+    if (inputRedraw) {
+        scheduleRedraw(true);
+    } else if (exposed || type == QEvent::Resize) {
+        scheduleRedraw(false);
     }
 
-    if (m_vulkanInitDone && redraw) {
-        drawFrame();
+    if (type == QEvent::UpdateRequest && m_redrawPending && m_vulkanInitDone) {
+        m_redrawPending = false;
+        m_activityStats.wakeups++;
+        if (m_frameDamaged || !(m_presentedFrame == currentFrameState())) {
+            drawFrame();
+        } else {
+            m_activityStats.skippedFrames++;
+            m_inputTimer.invalidate();
+        }
     }
 
     return false;
 }
 
+void VulkanWindow::scheduleRedraw(bool fromInput)
+{
+    if (m_offscreen)
+        return;
+
+    if (fromInput) {
+        m_frameStats.inputEvents++;
+        if (!m_inputTimer.isValid())
+            m_inputTimer.start();
+    } else {
+        m_frameDamaged = true;
+    }
+
+    if (m_redrawPending)
+        return;
+
+    m_redrawPending = true;
+    m_redrawRequestedMs = m_presentTimer.isValid() ? m_presentTimer.nsecsElapsed() / 1e6 : 0;
+    requestUpdate();
+}
+
+void VulkanWindow::recordFramePresented()
+{
+    const double refreshRate = screen() ? screen()->refreshRate() : 60.0;
+    const double refreshMs = 1000.0 / (refreshRate > 0 ? refreshRate : 60.0);
+
+    // A redraw asked for within one refresh of the last present should have made the next
+    // vblank, every whole interval beyond that is a frame the display did not get
+    if (m_presentTimer.isValid()) {
+        const double intervalMs = m_presentTimer.nsecsElapsed() / 1e6;
+        if (m_redrawRequestedMs <= refreshMs) {
+            const long missed = std::lround(intervalMs / refreshMs) - 1;
+            m_frameStats.droppedFrames += static_cast<uint64_t>(std::max(missed, 0L));
+        }
+    }
+    m_presentTimer.start();
+
+    if (m_inputTimer.isValid()) {
+        const double latencyMs = m_inputTimer.nsecsElapsed() / 1e6;
+        m_frameStats.latencySamples++;
+        m_frameStats.latencySumMs += latencyMs;
+        m_frameStats.latencyMaxMs = std::max(m_frameStats.latencyMaxMs, latencyMs);
+
+        LatencyStats &latency = m_profileLatency[size_t(m_presentProfile)];
+        latency.samples++;
+        latency.sumMs += latencyMs;
+        latency.maxMs = std::max(latency.maxMs, latencyMs);
+        if (latency.historyMs.size() < LATENCY_HISTORY) {
+            latency.historyMs.push_back(static_cast<float>(latencyMs));
+        } else {
+            latency.historyMs[latency.next] = static_cast<float>(latencyMs);
+            latency.next = (latency.next + 1) % LATENCY_HISTORY;
+        }
+        m_inputTimer.invalidate();
+    }
+    m_frameStats.frames++;
+
+    if (!m_frameStatsEnabled)
+        return;
+
+    if (!m_frameStatsTimer.isValid()) {
+        m_frameStatsTimer.start();
+    } else if (m_frameStatsTimer.elapsed() >= 2000) {
+        const FrameStats &stats = m_frameStats;
+        qDebug() << "profile:" << presentProfileName(m_presentProfile)
+                 << "frames:" << stats.frames << "input events:" << stats.inputEvents
+                 << "dropped:" << stats.droppedFrames << "input to present avg:"
+                 << (stats.latencySamples ? stats.latencySumMs / stats.latencySamples : 0)
+                 << "ms, max:" << stats.latencyMaxMs << "ms, cpu per frame:"
+                 << (stats.frames ? stats.cpuSumUs / stats.frames : 0)
+                 << "us, recorded:" << stats.recordedFrames << "partial:" << stats.partialFrames
+                 << "record avg:"
+                 << (stats.recordedFrames ? stats.recordSumUs / stats.recordedFrames : 0)
+                 << "us, view changes replayed:" << stats.replayedViewChanges;
+        if (m_gpuProfiler->isEnabled()) {
+            const auto draw = gpuStats(GpuScope::Draw);
+            qDebug() << "gpu draw min:" << draw.minMs << "ms, avg:" << draw.avgMs
+                     << "ms, p99:" << draw.p99Ms << "ms, fragment invocations:"
+                     << draw.fragmentInvocations;
+        }
+        m_frameStats = FrameStats{};
+        m_frameStatsTimer.start();
+    }
+}
+
+void VulkanWindow::reportActivity()
+{
+    const ActivityStats &stats = m_activityStats;
+    qDebug() << "last minute, wakeups:" << stats.wakeups << "frames drawn:" << stats.drawnFrames
+             << "skipped:" << stats.skippedFrames << "gpu busy:" << stats.gpuBusyMs << "ms";
+    m_activityStats = ActivityStats{};
+
+    QTimer::singleShot(ACTIVITY_REPORT_MS, this, [this] { reportActivity(); });
+}
+
+VulkanWindow::PresentProfile VulkanWindow::requestedPresentProfile()
+{
+    const QByteArray profile = qgetenv("VIV_PRESENT");
+    if (profile == "low-latency")
+        return PresentProfile::LowLatency;
+    if (profile == "power-saving")
+        return PresentProfile::PowerSaving;
+    return PresentProfile::TearFree;
+}
+
+void VulkanWindow::choosePresentProfile(PresentProfile profile)
+{
+    m_presentProfile = profile;
+
+    // Every frame queued ahead of the GPU is a frame of input lag, tear free keeps a second
+    // one so a slow frame on the CPU does not leave the GPU idle
+    m_framesInFlight = profile == PresentProfile::TearFree ? 2 : 1;
+
+    bool ok = false;
+    const int framesInFlight = qEnvironmentVariableIntValue("VIV_FRAMES_IN_FLIGHT", &ok);
+    if (ok)
+        m_framesInFlight = uint32_t(std::clamp(framesInFlight, 1, int(MAX_FRAMES_IN_FLIGHT)));
+}
+
+void VulkanWindow::cyclePresentProfile()
+{
+    if (m_offscreen)
+        return;
+
+    reportPresentProfile(m_presentProfile);
+
+    const auto next = static_cast<PresentProfile>((int(m_presentProfile) + 1)
+                                                  % int(PresentProfile::Count));
+    choosePresentProfile(next);
+    m_currentFrame %= m_framesInFlight;
+
+    recreateSwapChain();
+    reportPresentProfile(m_presentProfile);
+    scheduleRedraw(false);
+}
+
+void VulkanWindow::reportPresentProfile(PresentProfile profile) const
+{
+    if (profile == m_presentProfile) {
+        qDebug() << "present profile:" << presentProfileName(profile)
+                 << "mode:" << presentModeName(m_presentMode)
+                 << "images:" << m_swapChainImages.size()
+                 << "frames in flight:" << m_framesInFlight;
+    }
+
+    const LatencyStats &latency = m_profileLatency[size_t(profile)];
+    if (latency.samples == 0)
+        return;
+
+    std::vector<float> history = latency.historyMs;
+    auto percentile = [&history](double fraction) {
+        auto nth = history.begin() + static_cast<ptrdiff_t>(fraction * (history.size() - 1));
+        std::nth_element(history.begin(), nth, history.end());
+        return *nth;
+    };
+    qDebug() << presentProfileName(profile) << "input to present over" << latency.samples
+             << "frames, avg:" << latency.sumMs / latency.samples << "ms, p50:" << percentile(0.5)
+             << "ms, p99:" << percentile(0.99) << "ms, max:" << latency.maxMs << "ms";
+}
+
+GpuProfiler::ScopeStats VulkanWindow::gpuStats(GpuScope scope) const
+{
+    if (!m_gpuProfiler)
+        return {};
+    return m_gpuProfiler->stats(scope);
+}
+
 VkResult VulkanWindow::CreateDebugUtilsMessengerEXT(
     VkInstance instance,
     const VkDebugUtilsMessengerCreateInfoEXT *pCreateInfo,
@@ -159,101 +498,285 @@ VkSurfaceKHR VulkanWindow::createSurface(QWindow *window, VkInstance instance)
 
 void VulkanWindow::initVulkan(const QString &imageName)
 {
-    createInstance();
-    setupDebugMessenger();
-    createSurface();
-    pickPhysicalDevice();
-    createLogicalDevice();
-    createSwapChain();
+    TRACE_FUNCTION();
+
+    // The instance was created by the constructor while the image was being picked
+    const bool sharedContext = m_context->device != VK_NULL_HANDLE;
+    if (sharedContext) {
+        adoptRenderContext();
+    } else {
+        setupDebugMessenger();
+        if (!m_offscreen)
+            createSurface();
+        pickPhysicalDevice();
+        createLogicalDevice();
+    }
+    chooseMipFilter();
+    chooseCompression();
+
+    // Shown by another window, so it is on the GPU already
+    ResidentTexture *resident = m_gpuTextures
+                                    ? m_gpuTextures->find(QFileInfo(imageName).absoluteFilePath())
+                                    : nullptr;
+    if (!resident)
+        startTextureFill(imageName);
+    chooseGridView(sharedContext);
+    if (m_offscreen)
+        createOffscreenTarget();
+    else
+        createSwapChain();
+    if (!m_offscreen)
+        reportPresentProfile(m_presentProfile);
     createImageViews();
-    createRenderPass();
-    createDescriptorSetLayout();
-    createGraphicsPipeline();
+
+    // Pipeline compilation is the slowest part of device setup on many drivers. Nothing
+    // before the first record needs the graphics pipeline, and only GPU mip generation and
+    // pixel conversion need the compute ones.
+    std::future<void> graphicsPipeline;
+    if (!sharedContext) {
+        createRenderPass();
+        createDescriptorSetLayout();
+        graphicsPipeline = std::async(std::launch::async, [this] {
+            createGraphicsPipeline();
+            if (!m_grid.isEmpty())
+                createGridPipeline();
+        });
+        m_mipPipelineReady = std::async(std::launch::async, [this] { createMipPipeline(); });
+    }
+
     createFramebuffers();
     createCommandPool();
-    createTextureImage(imageName);
-    createTextureImageView();
-    createTextureSampler();
+    m_uploads = std::make_unique<UploadQueue>(*m_context,
+                                              *m_gpuProfiler,
+                                              m_commandPool,
+                                              m_transferCommandPool);
+    if (resident) {
+        displayTexture(QFileInfo(imageName).absoluteFilePath(), *resident);
+    } else {
+        createTextureImage(imageName);
+        createTextureImageView();
+    }
+    if (!sharedContext)
+        createTextureSampler();
     createVertexBuffer();
     createIndexBuffer();
-    createUniformBuffers();
-    createDescriptorPool();
-    createDescriptorSets();
+    if (!resident) {
+        createDescriptorPool();
+        createDescriptorSets();
+    }
     createCommandBuffers();
     createSyncObjects();
+    initBrowsing(imageName);
+    if (m_mipPipelineReady.valid())
+        m_mipPipelineReady.get();
+
+    if (!sharedContext) {
+        graphicsPipeline.get();
+
+        // Compare against a run with an empty cache directory to see what the cache saves
+        if (Tracer::statsEnabled()) {
+            qDebug() << "pipelines created with a"
+                     << (m_context->pipelineCache->isWarm() ? "warm" : "cold")
+                     << "cache, graphics:" << m_graphicsPipelineMs << "ms, mip:"
+                     << m_mipPipelineMs << "ms";
+        }
+        shareRenderContext();
+    }
+
+    for (const QString &imageName : m_options.windowImages) {
+        openWindow(imageName);
+    }
+    // The grid layout and pipeline are there now, the images may be too
+    if (!m_grid.isEmpty())
+        updateGrid();
+
+    // Every upload recorded above goes out in one submission, the first frame waits for it
+    // through queue ordering rather than on the CPU
+    m_uploads->submit();
 
     m_vulkanInitDone = true;
+    scheduleRedraw(false);
 }
 
 void VulkanWindow::cleanupSwapChain()
 {
     for (auto framebuffer : m_swapChainFramebuffers) {
-        vkDestroyFramebuffer(m_device, framebuffer, nullptr);
+        vkDestroyFramebuffer(m_context->device, framebuffer, nullptr);
     }
 
     for (auto imageView : m_swapChainImageViews) {
-        vkDestroyImageView(m_device, imageView, nullptr);
+        vkDestroyImageView(m_context->device, imageView, nullptr);
+    }
+
+    if (m_offscreen) {
+        vkDestroyImage(m_context->device, m_offscreenImage, nullptr);
+        m_context->allocator->free(m_offscreenImageMemory);
+    } else {
+        vkDestroySwapchainKHR(m_context->device, m_swapChain, nullptr);
+    }
+}
+
+void VulkanWindow::waitForSubmittedWork()
+{
+    TRACE_FUNCTION();
+
+    // The last window takes the device down with the context, which needs it idle, and
+    // stalls no one by waiting for it
+    if (m_context.use_count() == 1) {
+        vkDeviceWaitIdle(m_context->device);
+        return;
     }
 
-    vkDestroySwapchainKHR(m_device, m_swapChain, nullptr);
+    // Other windows keep drawing on the shared queues, only this window's frames and
+    // uploads have to be done before its resources go
+    vkWaitForFences(m_context->device,
+                    static_cast<uint32_t>(m_inFlightFences.size()),
+                    m_inFlightFences.data(),
+                    VK_TRUE,
+                    UINT64_MAX);
+    m_uploads->waitFor(m_uploads->serial());
 }
 
 void VulkanWindow::cleanup()
 {
+    m_tileLoader.reset();
+
+    for (auto &load : m_textureLoads) {
+        destroyTextureLoad(*load);
+    }
+    m_textureLoads.clear();
+
+    retireUploads(true);
+    m_uploads.reset();
+
+    retireSwapChains(true);
     cleanupSwapChain();
 
-    vkDestroyPipeline(m_device, m_graphicsPipeline, nullptr);
-    vkDestroyPipelineLayout(m_device, m_pipelineLayout, nullptr);
-    vkDestroyRenderPass(m_device, m_renderPass, nullptr);
+    vkDestroyBuffer(m_context->device, m_viewQuadBuffer, nullptr);
+    m_context->allocator->free(m_viewQuadBufferMemory);
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        vkDestroyBuffer(m_device, m_uniformBuffers[i], nullptr);
-        vkFreeMemory(m_device, m_uniformBuffersMemory[i], nullptr);
+    if (m_readbackBuffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(m_context->device, m_readbackBuffer, nullptr);
+        m_context->allocator->free(m_readbackBufferMemory);
     }
 
-    vkDestroyDescriptorPool(m_device, m_descriptorPool, nullptr);
+    m_grid.destroy(m_context->device);
 
-    vkDestroySampler(m_device, m_textureSampler, nullptr);
-    vkDestroyImageView(m_device, m_textureImageView, nullptr);
+    // Browsing hands the opened image's texture to the shared cache along with the others
+    if (m_gpuTextures) {
+        m_displayedTexture = nullptr;
+        m_gpuTextures->release(this);
+        m_gpuTextures = nullptr;
+    } else {
+        vkDestroyDescriptorPool(m_context->device, m_descriptorPool, nullptr);
+        vkDestroyImageView(m_context->device, m_textureImageView, nullptr);
+        vkDestroyImage(m_context->device, m_textureImage, nullptr);
+        m_context->allocator->free(m_textureImageMemory);
+    }
 
-    vkDestroyImage(m_device, m_textureImage, nullptr);
-    vkFreeMemory(m_device, m_textureImageMemory, nullptr);
+    vkDestroyBuffer(m_context->device, m_indexBuffer, nullptr);
+    m_context->allocator->free(m_indexBufferMemory);
 
-    vkDestroyDescriptorSetLayout(m_device, m_descriptorSetLayout, nullptr);
+    vkDestroyBuffer(m_context->device, m_vertexBuffer, nullptr);
+    m_context->allocator->free(m_vertexBufferMemory);
+
+    if (m_tiledMode) {
+        for (uint32_t i = 0; i < TILE_STAGING_BUFFERS; i++) {
+            vkDestroyBuffer(m_context->device, m_tileStagingBuffers[i], nullptr);
+            m_context->allocator->free(m_tileStagingBuffersMemory[i]);
+        }
 
-    vkDestroyBuffer(m_device, m_indexBuffer, nullptr);
-    vkFreeMemory(m_device, m_indexBufferMemory, nullptr);
+        for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+            vkDestroyBuffer(m_context->device, m_tileVertexBuffers[i], nullptr);
+            m_context->allocator->free(m_tileVertexBuffersMemory[i]);
+        }
 
-    vkDestroyBuffer(m_device, m_vertexBuffer, nullptr);
-    vkFreeMemory(m_device, m_vertexBufferMemory, nullptr);
+        vkDestroyBuffer(m_context->device, m_tileIndexBuffer, nullptr);
+        m_context->allocator->free(m_tileIndexBufferMemory);
+    }
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        vkDestroySemaphore(m_device, m_renderFinishedSemaphores[i], nullptr);
-        vkDestroySemaphore(m_device, m_imageAvailableSemaphores[i], nullptr);
-        vkDestroyFence(m_device, m_inFlightFences[i], nullptr);
+        vkDestroySemaphore(m_context->device, m_renderFinishedSemaphores[i], nullptr);
+        vkDestroySemaphore(m_context->device, m_imageAvailableSemaphores[i], nullptr);
+        vkDestroyFence(m_context->device, m_inFlightFences[i], nullptr);
     }
 
-    vkDestroyCommandPool(m_device, m_commandPool, nullptr);
+    vkDestroyCommandPool(m_context->device, m_commandPool, nullptr);
+    if (m_transferCommandPool != VK_NULL_HANDLE)
+        vkDestroyCommandPool(m_context->device, m_transferCommandPool, nullptr);
 
-    vkDestroyDevice(m_device, nullptr);
+    m_gpuProfiler.reset();
 
-    if (enableValidationLayers) {
-        DestroyDebugUtilsMessengerEXT(m_instance, m_debugMessenger, nullptr);
-    }
+    if (m_surface != VK_NULL_HANDLE)
+        vkDestroySurfaceKHR(m_context->instance, m_surface, nullptr);
 
-    vkDestroySurfaceKHR(m_instance, m_surface, nullptr);
-    vkDestroyInstance(m_instance, nullptr);
+    // Pipelines, layouts, the sampler, the device and the instance go with the last window
+    m_context.reset();
 }
 
 void VulkanWindow::recreateSwapChain()
 {
-    vkDeviceWaitIdle(m_device);
-
-    cleanupSwapChain();
-
+    TRACE_FUNCTION();
+
+    // Frames in flight keep using what they were recorded with, the old swapchain only
+    // hands its images over to the new one
+    RetiredSwapChain retired{};
+    retired.swapChain = m_swapChain;
+    retired.imageViews = std::move(m_swapChainImageViews);
+    retired.commandBuffers = std::move(m_commandBuffers);
+    retired.querySets = std::move(m_frameQuerySets);
+    retired.viewQuadBuffer = m_viewQuadBuffer;
+    retired.viewQuadBufferMemory = m_viewQuadBufferMemory;
+    retired.frameSerial = m_frameSerial;
+    m_viewQuadBuffer = VK_NULL_HANDLE;
+    m_swapChainImageViews.clear();
+    m_commandBuffers.clear();
+    m_frameQuerySets.clear();
+
+    const VkExtent2D oldExtent = m_swapChainExtent;
     createSwapChain();
     createImageViews();
-    createFramebuffers();
+    if (!m_context->imagelessFramebuffer || m_swapChainExtent.width != oldExtent.width
+        || m_swapChainExtent.height != oldExtent.height) {
+        retired.framebuffers = std::move(m_swapChainFramebuffers);
+        m_swapChainFramebuffers.clear();
+        createFramebuffers();
+    }
+    createCommandBuffers();
+
+    m_retiredSwapChains.push_back(std::move(retired));
+}
+
+void VulkanWindow::retireSwapChains(bool wait)
+{
+    auto it = m_retiredSwapChains.begin();
+    while (it != m_retiredSwapChains.end()) {
+        if (!wait && it->frameSerial > m_completedFrameSerial) {
+            ++it;
+            continue;
+        }
+
+        for (auto framebuffer : it->framebuffers) {
+            vkDestroyFramebuffer(m_context->device, framebuffer, nullptr);
+        }
+        for (auto imageView : it->imageViews) {
+            vkDestroyImageView(m_context->device, imageView, nullptr);
+        }
+        if (!it->commandBuffers.empty()) {
+            vkFreeCommandBuffers(m_context->device,
+                                 m_commandPool,
+                                 static_cast<uint32_t>(it->commandBuffers.size()),
+                                 it->commandBuffers.data());
+        }
+        for (auto set : it->querySets) {
+            m_gpuProfiler->releaseSet(set);
+        }
+        vkDestroyBuffer(m_context->device, it->viewQuadBuffer, nullptr);
+        m_context->allocator->free(it->viewQuadBufferMemory);
+        vkDestroySwapchainKHR(m_context->device, it->swapChain, nullptr);
+
+        it = m_retiredSwapChains.erase(it);
+    }
 }
 
 void VulkanWindow::populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT &createInfo)
@@ -271,13 +794,18 @@ void VulkanWindow::populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateI
 
 void VulkanWindow::setupDebugMessenger()
 {
+    TRACE_FUNCTION();
+
     if (!enableValidationLayers)
         return;
 
     VkDebugUtilsMessengerCreateInfoEXT createInfo;
     populateDebugMessengerCreateInfo(createInfo);
 
-    if (CreateDebugUtilsMessengerEXT(m_instance, &createInfo, nullptr, &m_debugMessenger)
+    if (CreateDebugUtilsMessengerEXT(m_context->instance,
+                                     &createInfo,
+                                     nullptr,
+                                     &m_context->debugMessenger)
         != VK_SUCCESS) {
         throw std::runtime_error("failed to set up debug messenger!");
     }
@@ -285,6 +813,8 @@ void VulkanWindow::setupDebugMessenger()
 
 void VulkanWindow::createInstance()
 {
+    TRACE_FUNCTION();
+
     if (enableValidationLayers && !checkValidationLayerSupport()) {
         throw std::runtime_error("validation layers requested, but not available!");
     }
@@ -317,7 +847,7 @@ void VulkanWindow::createInstance()
 
         createInfo.pNext = nullptr;
     }
-    auto result = vkCreateInstance(&createInfo, nullptr, &m_instance);
+    auto result = vkCreateInstance(&createInfo, nullptr, &m_context->instance);
     if (result != VK_SUCCESS) {
         throw std::runtime_error("failed to create instance!");
     }
@@ -325,40 +855,51 @@ void VulkanWindow::createInstance()
 
 void VulkanWindow::createSurface()
 {
-    m_surface = createSurface(this, m_instance);
+    TRACE_FUNCTION();
+
+    m_surface = createSurface(this, m_context->instance);
 }
 
 void VulkanWindow::pickPhysicalDevice()
 {
+    TRACE_FUNCTION();
+
     uint32_t deviceCount = 0;
-    vkEnumeratePhysicalDevices(m_instance, &deviceCount, nullptr);
+    vkEnumeratePhysicalDevices(m_context->instance, &deviceCount, nullptr);
 
     if (deviceCount == 0) {
         throw std::runtime_error("failed to find GPUs with Vulkan support!");
     }
 
     std::vector<VkPhysicalDevice> devices(deviceCount);
-    vkEnumeratePhysicalDevices(m_instance, &deviceCount, devices.data());
+    vkEnumeratePhysicalDevices(m_context->instance, &deviceCount, devices.data());
 
     for (const auto &device : devices) {
         if (isDeviceSuitable(device)) {
-            m_physicalDevice = device;
+            m_context->physicalDevice = device;
             break;
         }
     }
 
-    if (m_physicalDevice == VK_NULL_HANDLE) {
+    if (m_context->physicalDevice == VK_NULL_HANDLE) {
         throw std::runtime_error("failed to find a suitable GPU!");
     }
 }
 
 void VulkanWindow::createLogicalDevice()
 {
-    QueueFamilyIndices indices = findQueueFamilies(m_physicalDevice);
+    TRACE_FUNCTION();
+
+    QueueFamilyIndices indices = findQueueFamilies(m_context->physicalDevice);
+
+    if (qgetenv("VIV_TRANSFER_QUEUE") == "0")
+        indices.transferFamily.reset();
 
     std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
     std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(),
                                               indices.presentFamily.value()};
+    if (indices.transferFamily.has_value())
+        uniqueQueueFamilies.insert(indices.transferFamily.value());
 
     float queuePriority = 1.0f;
     for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -370,9 +911,22 @@ void VulkanWindow::createLogicalDevice()
         queueCreateInfos.push_back(queueCreateInfo);
     }
 
+    VkPhysicalDeviceFeatures supportedFeatures{};
+    vkGetPhysicalDeviceFeatures(m_context->physicalDevice, &supportedFeatures);
+
     VkPhysicalDeviceFeatures deviceFeatures{};
     deviceFeatures.samplerAnisotropy = VK_FALSE;
 
+    // Statistics queries cost more than timestamps, so they are opt in
+    const bool pipelineStatistics = qEnvironmentVariableIntValue("VIV_GPU_STATS") != 0
+                                    && supportedFeatures.pipelineStatisticsQuery;
+    deviceFeatures.pipelineStatisticsQuery = pipelineStatistics ? VK_TRUE : VK_FALSE;
+
+    // chooseCompression checks the formats themselves, the feature promises all of them
+    deviceFeatures.textureCompressionBC = requestedCompression() != Compression::None
+                                              ? supportedFeatures.textureCompressionBC
+                                              : VK_FALSE;
+
     VkDeviceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
 
@@ -381,8 +935,76 @@ void VulkanWindow::createLogicalDevice()
 
     createInfo.pEnabledFeatures = &deviceFeatures;
 
-    createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-    createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    VkPhysicalDeviceImagelessFramebufferFeaturesKHR imagelessFeatures{};
+    imagelessFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGELESS_FRAMEBUFFER_FEATURES_KHR;
+    imagelessFeatures.imagelessFramebuffer = VK_TRUE;
+
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures{};
+    indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+
+    // Nothing is presented offscreen, so the device runs without the swapchain extension
+    std::vector<const char *> extensions = deviceExtensions;
+    if (!m_offscreen) {
+        uint32_t extensionCount = 0;
+        vkEnumerateDeviceExtensionProperties(m_context->physicalDevice,
+                                             nullptr,
+                                             &extensionCount,
+                                             nullptr);
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateDeviceExtensionProperties(m_context->physicalDevice,
+                                             nullptr,
+                                             &extensionCount,
+                                             availableExtensions.data());
+        auto available = [&availableExtensions](const char *name) {
+            return std::any_of(availableExtensions.begin(),
+                               availableExtensions.end(),
+                               [name](const VkExtensionProperties &extension) {
+                                   return strcmp(extension.extensionName, name) == 0;
+                               });
+        };
+
+        m_context->incrementalPresent = available(VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME);
+        if (m_context->incrementalPresent)
+            extensions.push_back(VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME);
+
+        // Every device with the extension supports the feature
+        m_context->imagelessFramebuffer = m_physicalDeviceProperties2
+                                          && available(VK_KHR_IMAGELESS_FRAMEBUFFER_EXTENSION_NAME)
+                                          && available(VK_KHR_MAINTENANCE2_EXTENSION_NAME)
+                                          && available(VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME);
+        if (m_context->imagelessFramebuffer) {
+            extensions.push_back(VK_KHR_IMAGELESS_FRAMEBUFFER_EXTENSION_NAME);
+            extensions.push_back(VK_KHR_MAINTENANCE2_EXTENSION_NAME);
+            extensions.push_back(VK_KHR_IMAGE_FORMAT_LIST_EXTENSION_NAME);
+            createInfo.pNext = &imagelessFeatures;
+        }
+
+        if (!m_grid.isEmpty() && m_physicalDeviceProperties2
+            && available(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME)
+            && available(VK_KHR_MAINTENANCE3_EXTENSION_NAME)) {
+            auto getFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2KHR)
+                vkGetInstanceProcAddr(m_context->instance, "vkGetPhysicalDeviceFeatures2KHR");
+            VkPhysicalDeviceDescriptorIndexingFeaturesEXT supported{};
+            supported.sType = indexingFeatures.sType;
+            VkPhysicalDeviceFeatures2KHR features2{};
+            features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+            features2.pNext = &supported;
+            if (getFeatures2 != nullptr)
+                getFeatures2(m_context->physicalDevice, &features2);
+            m_context->nonUniformTextureIndexing
+                = supported.shaderSampledImageArrayNonUniformIndexing;
+        }
+        if (m_context->nonUniformTextureIndexing) {
+            extensions.push_back(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+            extensions.push_back(VK_KHR_MAINTENANCE3_EXTENSION_NAME);
+            indexingFeatures.pNext = m_context->imagelessFramebuffer ? &imagelessFeatures : nullptr;
+            createInfo.pNext = &indexingFeatures;
+        }
+
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+        createInfo.ppEnabledExtensionNames = extensions.data();
+    }
 
     if (enableValidationLayers) {
         createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -391,23 +1013,125 @@ void VulkanWindow::createLogicalDevice()
         createInfo.enabledLayerCount = 0;
     }
 
-    if (vkCreateDevice(m_physicalDevice, &createInfo, nullptr, &m_device) != VK_SUCCESS) {
+    if (vkCreateDevice(m_context->physicalDevice, &createInfo, nullptr, &m_context->device)
+        != VK_SUCCESS) {
         throw std::runtime_error("failed to create logical device!");
     }
 
-    vkGetDeviceQueue(m_device, indices.graphicsFamily.value(), 0, &m_graphicsQueue);
-    vkGetDeviceQueue(m_device, indices.presentFamily.value(), 0, &m_presentQueue);
+    vkGetDeviceQueue(m_context->device,
+                     indices.graphicsFamily.value(),
+                     0,
+                     &m_context->graphicsQueue);
+    vkGetDeviceQueue(m_context->device, indices.presentFamily.value(), 0, &m_context->presentQueue);
+
+    m_context->graphicsFamily = indices.graphicsFamily.value();
+    if (indices.transferFamily.has_value()) {
+        m_context->transferFamily = indices.transferFamily.value();
+        vkGetDeviceQueue(m_context->device,
+                         m_context->transferFamily,
+                         0,
+                         &m_context->transferQueue);
+    }
+
+    m_context->presentFamily = indices.presentFamily.value();
+    m_context->pipelineStatistics = pipelineStatistics;
+    m_context->allocator = std::make_unique<DeviceAllocator>(m_context->device,
+                                                             m_context->physicalDevice);
+
+    // Timestamps are cheap enough to stay on, VIV_GPU_PROFILE=0 still turns them off
+    m_gpuProfiler = std::make_unique<GpuProfiler>(m_context->device,
+                                                  m_context->physicalDevice,
+                                                  m_context->graphicsFamily,
+                                                  qgetenv("VIV_GPU_PROFILE") != "0",
+                                                  pipelineStatistics);
+
+    m_context->pipelineCache = std::make_unique<PipelineCache>(m_context->device,
+                                                               m_context->physicalDevice);
+}
+
+void VulkanWindow::adoptRenderContext()
+{
+    TRACE_FUNCTION();
+
+    const RenderContext &context = *m_context;
+    m_gpuTextures = context.textures.get();
+    if (m_gpuTextures)
+        m_texturesDestroyedGeneration = m_gpuTextures->destroyedGeneration();
+
+    createSurface();
+    VkBool32 presentSupport = VK_FALSE;
+    vkGetPhysicalDeviceSurfaceSupportKHR(m_context->physicalDevice,
+                                         context.presentFamily,
+                                         m_surface,
+                                         &presentSupport);
+
+    // The shared render pass fixes the format. Nothing else of the window exists yet, so only
+    // the surface has to go when it cannot be shown, the other windows are not affected.
+    const auto formats = querySwapChainSupport(m_context->physicalDevice).formats;
+    const bool sharedFormat = std::any_of(formats.begin(),
+                                          formats.end(),
+                                          [&context](const VkSurfaceFormatKHR &format) {
+                                              return format.format == context.swapChainImageFormat;
+                                          });
+    if (!presentSupport || !sharedFormat) {
+        vkDestroySurfaceKHR(m_context->instance, m_surface, nullptr);
+        m_surface = VK_NULL_HANDLE;
+    }
+    if (!presentSupport) {
+        throw std::runtime_error("failed to present to a new window from the shared device!");
+    }
+    if (!sharedFormat) {
+        throw std::runtime_error("failed to find the shared swap chain format!");
+    }
+
+    m_gpuProfiler = std::make_unique<GpuProfiler>(m_context->device,
+                                                  m_context->physicalDevice,
+                                                  m_context->graphicsFamily,
+                                                  qgetenv("VIV_GPU_PROFILE") != "0",
+                                                  context.pipelineStatistics);
+}
+
+void VulkanWindow::shareRenderContext()
+{
+    // An offscreen device has no swapchain extension and renders into a transfer source
+    if (!m_offscreen)
+        RenderContext::share(m_context);
+}
+
+void VulkanWindow::openWindow(const QString &imageName)
+{
+    TRACE_FUNCTION();
+
+    Options options;
+    options.imageName = imageName;
+
+    // A window the shared device cannot present to fails on its own
+    VulkanWindow *window = nullptr;
+    try {
+        window = new VulkanWindow(options);
+    } catch (const std::exception &e) {
+        qWarning() << "cannot open" << imageName << "in a new window:" << e.what();
+        return;
+    }
+    window->m_deleteOnClose = true;
+    window->show();
 }
 
 void VulkanWindow::createSwapChain()
 {
-    SwapChainSupportDetails swapChainSupport = querySwapChainSupport(m_physicalDevice);
+    TRACE_FUNCTION();
+
+    SwapChainSupportDetails swapChainSupport = querySwapChainSupport(m_context->physicalDevice);
 
     VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
     VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
     VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
 
-    uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
+    // Mailbox needs a spare image to replace a queued frame instead of waiting for one, tear
+    // free keeps it with fifo too so a late frame does not stall the next
+    uint32_t imageCount = swapChainSupport.capabilities.minImageCount;
+    if (m_presentProfile == PresentProfile::TearFree || presentMode == VK_PRESENT_MODE_MAILBOX_KHR)
+        imageCount++;
     if (swapChainSupport.capabilities.maxImageCount > 0
         && imageCount > swapChainSupport.capabilities.maxImageCount) {
         imageCount = swapChainSupport.capabilities.maxImageCount;
@@ -424,7 +1148,7 @@ void VulkanWindow::createSwapChain()
     createInfo.imageArrayLayers = 1;
     createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
-    QueueFamilyIndices indices = findQueueFamilies(m_physicalDevice);
+    QueueFamilyIndices indices = findQueueFamilies(m_context->physicalDevice);
     uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(), indices.presentFamily.value()};
 
     if (indices.graphicsFamily != indices.presentFamily) {
@@ -439,41 +1163,71 @@ void VulkanWindow::createSwapChain()
     createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
     createInfo.presentMode = presentMode;
     createInfo.clipped = VK_TRUE;
+    // Lets the driver hand resources over, the old swapchain is destroyed by retireSwapChains
+    createInfo.oldSwapchain = m_swapChain;
 
-    if (vkCreateSwapchainKHR(m_device, &createInfo, nullptr, &m_swapChain) != VK_SUCCESS) {
+    if (vkCreateSwapchainKHR(m_context->device, &createInfo, nullptr, &m_swapChain) != VK_SUCCESS) {
         throw std::runtime_error("failed to create swap chain!");
     }
 
-    vkGetSwapchainImagesKHR(m_device, m_swapChain, &imageCount, nullptr);
+    vkGetSwapchainImagesKHR(m_context->device, m_swapChain, &imageCount, nullptr);
     m_swapChainImages.resize(imageCount);
-    vkGetSwapchainImagesKHR(m_device, m_swapChain, &imageCount, m_swapChainImages.data());
+    vkGetSwapchainImagesKHR(m_context->device, m_swapChain, &imageCount, m_swapChainImages.data());
 
-    m_swapChainImageFormat = surfaceFormat.format;
+    m_context->swapChainImageFormat = surfaceFormat.format;
     m_swapChainExtent = extent;
+    m_presentMode = presentMode;
+}
+
+void VulkanWindow::createOffscreenTarget()
+{
+    TRACE_FUNCTION();
+
+    // Same bytes as QImage::Format_RGBA8888, sRGB encoded like the usual swapchain format
+    m_context->swapChainImageFormat = VK_FORMAT_R8G8B8A8_SRGB;
+    m_swapChainExtent = {static_cast<uint32_t>(m_options.outputSize.width()),
+                         static_cast<uint32_t>(m_options.outputSize.height())};
+
+    createImage(m_swapChainExtent.width,
+                m_swapChainExtent.height,
+                1,
+                m_context->swapChainImageFormat,
+                VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                m_offscreenImage,
+                m_offscreenImageMemory);
+
+    m_swapChainImages = {m_offscreenImage};
 }
 
 void VulkanWindow::createImageViews()
 {
+    TRACE_FUNCTION();
+
     m_swapChainImageViews.resize(m_swapChainImages.size());
 
     for (size_t i = 0; i < m_swapChainImages.size(); i++) {
         m_swapChainImageViews[i] = createImageView(m_swapChainImages[i],
-                                                   m_swapChainImageFormat,
-                                                   m_mipLevels);
+                                                   m_context->swapChainImageFormat,
+                                                   1);
     }
 }
 
 void VulkanWindow::createRenderPass()
 {
+    TRACE_FUNCTION();
+
     VkAttachmentDescription colorAttachment{};
-    colorAttachment.format = m_swapChainImageFormat;
+    colorAttachment.format = m_context->swapChainImageFormat;
     colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
     colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
     colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    colorAttachment.finalLayout = m_offscreen ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                             : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
     VkAttachmentReference colorAttachmentRef{};
     colorAttachmentRef.attachment = 0;
@@ -492,29 +1246,51 @@ void VulkanWindow::createRenderPass()
     dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
     dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 
+    // The offscreen image is copied out right after the pass
+    VkSubpassDependency readbackDependency{};
+    readbackDependency.srcSubpass = 0;
+    readbackDependency.dstSubpass = VK_SUBPASS_EXTERNAL;
+    readbackDependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    readbackDependency.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    readbackDependency.dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    readbackDependency.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    VkSubpassDependency dependencies[] = {dependency, readbackDependency};
+
     VkRenderPassCreateInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
     renderPassInfo.attachmentCount = 1;
     renderPassInfo.pAttachments = &colorAttachment;
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.dependencyCount = m_offscreen ? 2 : 1;
+    renderPassInfo.pDependencies = dependencies;
 
-    if (vkCreateRenderPass(m_device, &renderPassInfo, nullptr, &m_renderPass) != VK_SUCCESS) {
+    if (vkCreateRenderPass(m_context->device, &renderPassInfo, nullptr, &m_context->renderPass)
+        != VK_SUCCESS) {
         throw std::runtime_error("failed to create render pass!");
     }
+
+    if (m_offscreen)
+        return;
+
+    // Clears only the render area and starts from the image as it was presented, which
+    // leaves everything outside the damage untouched
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    if (vkCreateRenderPass(m_context->device,
+                           &renderPassInfo,
+                           nullptr,
+                           &m_context->damageRenderPass)
+        != VK_SUCCESS) {
+        throw std::runtime_error("failed to create damage render pass!");
+    }
 }
 
 void VulkanWindow::createDescriptorSetLayout()
 {
-    VkDescriptorSetLayoutBinding uboLayoutBinding{};
-    uboLayoutBinding.binding = 0;
-    uboLayoutBinding.descriptorCount = 1;
-    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    uboLayoutBinding.pImmutableSamplers = nullptr;
-    uboLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    TRACE_FUNCTION();
 
+    // The view transform is a push constant, only the texture goes through a descriptor
     VkDescriptorSetLayoutBinding samplerLayoutBinding{};
     samplerLayoutBinding.binding = 1;
     samplerLayoutBinding.descriptorCount = 1;
@@ -522,13 +1298,15 @@ void VulkanWindow::createDescriptorSetLayout()
     samplerLayoutBinding.pImmutableSamplers = nullptr;
     samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-    std::array<VkDescriptorSetLayoutBinding, 2> bindings = {uboLayoutBinding, samplerLayoutBinding};
     VkDescriptorSetLayoutCreateInfo layoutInfo{};
     layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
-    layoutInfo.pBindings = bindings.data();
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &samplerLayoutBinding;
 
-    if (vkCreateDescriptorSetLayout(m_device, &layoutInfo, nullptr, &m_descriptorSetLayout)
+    if (vkCreateDescriptorSetLayout(m_context->device,
+                                    &layoutInfo,
+                                    nullptr,
+                                    &m_context->descriptorSetLayout)
         != VK_SUCCESS) {
         throw std::runtime_error("failed to create descriptor set layout!");
     }
@@ -536,8 +1314,46 @@ void VulkanWindow::createDescriptorSetLayout()
 
 void VulkanWindow::createGraphicsPipeline()
 {
-    auto vertShaderCode = readFile(":/shaders/vert.spv");
-    auto fragShaderCode = readFile(":/shaders/frag.spv");
+    TRACE_FUNCTION();
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(ViewTransform);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &m_context->descriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(m_context->device,
+                               &pipelineLayoutInfo,
+                               nullptr,
+                               &m_context->pipelineLayout)
+        != VK_SUCCESS) {
+        throw std::runtime_error("failed to create pipeline layout!");
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    m_context->graphicsPipeline = createImagePipeline(":/shaders/vert.spv",
+                                                      ":/shaders/frag.spv",
+                                                      m_context->pipelineLayout);
+    m_graphicsPipelineMs = timer.nsecsElapsed() / 1e6;
+
+    // Command buffers recorded against an older pipeline must not be replayed
+    m_pipelineGeneration++;
+}
+
+VkPipeline VulkanWindow::createImagePipeline(const QString &vertShader,
+                                             const QString &fragShader,
+                                             VkPipelineLayout layout)
+{
+    auto vertShaderCode = readFile(vertShader.toStdString());
+    auto fragShaderCode = readFile(fragShader.toStdString());
 
     VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
     VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
@@ -616,16 +1432,6 @@ void VulkanWindow::createGraphicsPipeline()
     dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
     dynamicState.pDynamicStates = dynamicStates.data();
 
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 1;
-    pipelineLayoutInfo.pSetLayouts = &m_descriptorSetLayout;
-
-    if (vkCreatePipelineLayout(m_device, &pipelineLayoutInfo, nullptr, &m_pipelineLayout)
-        != VK_SUCCESS) {
-        throw std::runtime_error("failed to create pipeline layout!");
-    }
-
     VkGraphicsPipelineCreateInfo pipelineInfo{};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
     pipelineInfo.stageCount = 2;
@@ -637,64 +1443,441 @@ void VulkanWindow::createGraphicsPipeline()
     pipelineInfo.pMultisampleState = &multisampling;
     pipelineInfo.pColorBlendState = &colorBlending;
     pipelineInfo.pDynamicState = &dynamicState;
-    pipelineInfo.layout = m_pipelineLayout;
-    pipelineInfo.renderPass = m_renderPass;
+    pipelineInfo.layout = layout;
+    pipelineInfo.renderPass = m_context->renderPass;
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-    if (vkCreateGraphicsPipelines(m_device,
-                                  VK_NULL_HANDLE,
+    VkPipeline pipeline;
+    if (vkCreateGraphicsPipelines(m_context->device,
+                                  m_context->pipelineCache->handle(),
                                   1,
                                   &pipelineInfo,
                                   nullptr,
-                                  &m_graphicsPipeline)
+                                  &pipeline)
         != VK_SUCCESS) {
         throw std::runtime_error("failed to create graphics pipeline!");
     }
 
-    vkDestroyShaderModule(m_device, fragShaderModule, nullptr);
-    vkDestroyShaderModule(m_device, vertShaderModule, nullptr);
+    vkDestroyShaderModule(m_context->device, fragShaderModule, nullptr);
+    vkDestroyShaderModule(m_context->device, vertShaderModule, nullptr);
+    return pipeline;
 }
 
-void VulkanWindow::createFramebuffers()
+void VulkanWindow::createGridPipeline()
 {
-    m_swapChainFramebuffers.resize(m_swapChainImageViews.size());
+    TRACE_FUNCTION();
 
-    for (size_t i = 0; i < m_swapChainImageViews.size(); i++) {
-        VkImageView attachments[] = {m_swapChainImageViews[i]};
+    GridView::createPipelineLayout(*m_context);
+    m_context->gridPipeline = createImagePipeline(":/shaders/gridcells.spv",
+                                                  ":/shaders/gridsample.spv",
+                                                  m_context->gridPipelineLayout);
+}
 
-        VkFramebufferCreateInfo framebufferInfo{};
-        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebufferInfo.renderPass = m_renderPass;
-        framebufferInfo.attachmentCount = 1;
-        framebufferInfo.pAttachments = attachments;
-        framebufferInfo.width = m_swapChainExtent.width;
-        framebufferInfo.height = m_swapChainExtent.height;
-        framebufferInfo.layers = 1;
+void VulkanWindow::chooseGridView(bool sharedContext)
+{
+    const char *reason = m_grid.unavailableReason(*m_context,
+                                                  m_pendingTexture.tiled,
+                                                  sharedContext);
+    if (!reason)
+        return;
 
-        if (vkCreateFramebuffer(m_device, &framebufferInfo, nullptr, &m_swapChainFramebuffers[i])
-            != VK_SUCCESS) {
-            throw std::runtime_error("failed to create framebuffer!");
-        }
-    }
+    // The windows open once the device is shared, see initVulkan
+    qWarning("grid view is not available, %s, opening a window per image", reason);
+    m_options.windowImages = m_grid.images().mid(1);
+    m_grid = GridView();
 }
 
-void VulkanWindow::createCommandPool()
+void VulkanWindow::updateGrid()
 {
-    QueueFamilyIndices queueFamilyIndices = findQueueFamilies(m_physicalDevice);
-
-    VkCommandPoolCreateInfo poolInfo{};
-    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+    if (m_grid.descriptorSet() != VK_NULL_HANDLE)
+        return;
 
-    if (vkCreateCommandPool(m_device, &poolInfo, nullptr, &m_commandPool) != VK_SUCCESS) {
-        throw std::runtime_error("failed to create graphics command pool!");
+    if (!m_grid.update(*m_context, *m_gpuTextures, m_displayedTexture->view)) {
+        setTitle(QString::number(m_grid.images().size()) + " images (loading)");
+        return;
     }
+
+    setTitle(m_grid.title());
+    scheduleRedraw(false);
 }
 
-void VulkanWindow::initializeScaling(uint32_t imageWidth,
-                                     uint32_t imageHeight,
+VulkanWindow::MipFilter VulkanWindow::requestedMipFilter()
+{
+    const QByteArray filter = qgetenv("VIV_MIP_FILTER");
+    if (filter == "cpu")
+        return MipFilter::Cpu;
+    if (filter == "blit")
+        return MipFilter::Blit;
+    if (filter == "kaiser")
+        return MipFilter::Kaiser;
+    if (filter == "lanczos")
+        return MipFilter::Lanczos;
+    return MipFilter::Box;
+}
+
+void VulkanWindow::chooseMipFilter()
+{
+    // Blits need linear filtering of the sRGB format, the CPU path works on any device
+    auto useBlits = [this] {
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(m_context->physicalDevice,
+                                            VK_FORMAT_R8G8B8A8_SRGB,
+                                            &formatProperties);
+        m_mipFilter = (formatProperties.optimalTilingFeatures
+                       & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)
+                          ? MipFilter::Blit
+                          : MipFilter::Cpu;
+    };
+
+    m_mipFilter = requestedMipFilter();
+    if (m_mipFilter == MipFilter::Cpu) {
+        return;
+    } else if (m_mipFilter == MipFilter::Blit) {
+        useBlits();
+        return;
+    }
+
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(m_context->physicalDevice, &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(m_context->physicalDevice,
+                                             &queueFamilyCount,
+                                             queueFamilies.data());
+
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(m_context->physicalDevice,
+                                        VK_FORMAT_R8G8B8A8_UNORM,
+                                        &formatProperties);
+
+    if (!(queueFamilies[m_context->graphicsFamily].queueFlags & VK_QUEUE_COMPUTE_BIT)
+        || !(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT)
+        || !QFile::exists(":/shaders/mipmap.spv")) {
+        useBlits();
+        qWarning("compute mip generation is not available, using %s",
+                 m_mipFilter == MipFilter::Blit ? "blits" : "the CPU");
+        return;
+    }
+
+    // The conversion writes level 0 through the same UNORM views as the mip shader, so it is
+    // only used along with it. VIV_GPU_CONVERT=0 keeps the conversion on the CPU.
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(m_context->physicalDevice, &properties);
+    m_maxStorageBufferRange = properties.limits.maxStorageBufferRange;
+    m_gpuConvert = qgetenv("VIV_GPU_CONVERT") != "0" && QFile::exists(":/shaders/convert.spv");
+}
+
+VulkanWindow::Compression VulkanWindow::requestedCompression()
+{
+    const QByteArray compression = qgetenv("VIV_COMPRESS");
+    if (compression == "bc1")
+        return Compression::Bc1;
+    if (compression == "bc7")
+        return Compression::Bc7;
+    if (compression == "auto")
+        return Compression::Auto;
+    return Compression::None;
+}
+
+BcQuality VulkanWindow::requestedBcQuality()
+{
+    const QByteArray quality = qgetenv("VIV_COMPRESS_QUALITY");
+    if (quality == "fast")
+        return BcQuality::Fast;
+    if (quality == "high")
+        return BcQuality::High;
+    return BcQuality::Normal;
+}
+
+void VulkanWindow::chooseCompression()
+{
+    m_compression = requestedCompression();
+    if (m_compression == Compression::None)
+        return;
+
+    // Levels are only ever copied into, never blitted or stored to
+    auto supported = [this](VkFormat format) {
+        const VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT
+                                              | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(m_context->physicalDevice, format, &formatProperties);
+        return (formatProperties.optimalTilingFeatures & required) == required;
+    };
+    const bool bc1 = supported(VK_FORMAT_BC1_RGB_SRGB_BLOCK);
+    const bool bc7 = supported(VK_FORMAT_BC7_SRGB_BLOCK);
+
+    if ((m_compression == Compression::Bc1 && !bc1) || (m_compression == Compression::Bc7 && !bc7)
+        || (m_compression == Compression::Auto && !(bc1 && bc7))) {
+        qWarning("%s texture compression is not supported by the device, using RGBA8",
+                 compressionName(m_compression));
+        m_compression = Compression::None;
+    }
+}
+
+void VulkanWindow::createMipPipeline()
+{
+    TRACE_FUNCTION();
+
+    if (m_mipFilter == MipFilter::Blit || m_mipFilter == MipFilter::Cpu)
+        return;
+
+    std::array<VkDescriptorSetLayoutBinding, 3> bindings{};
+    for (uint32_t i = 0; i < bindings.size(); i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorCount = 1;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    if (vkCreateDescriptorSetLayout(m_context->device,
+                                    &layoutInfo,
+                                    nullptr,
+                                    &m_context->mipDescriptorSetLayout)
+        != VK_SUCCESS) {
+        throw std::runtime_error("failed to create mip descriptor set layout!");
+    }
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(MipPushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &m_context->mipDescriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(m_context->device,
+                               &pipelineLayoutInfo,
+                               nullptr,
+                               &m_context->mipPipelineLayout)
+        != VK_SUCCESS) {
+        throw std::runtime_error("failed to create mip pipeline layout!");
+    }
+
+    VkShaderModule shaderModule = createShaderModule(readFile(":/shaders/mipmap.spv"));
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = shaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = m_context->mipPipelineLayout;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if (vkCreateComputePipelines(m_context->device,
+                                 m_context->pipelineCache->handle(),
+                                 1,
+                                 &pipelineInfo,
+                                 nullptr,
+                                 &m_context->mipPipeline)
+        != VK_SUCCESS) {
+        throw std::runtime_error("failed to create mip pipeline!");
+    }
+    m_mipPipelineMs = timer.nsecsElapsed() / 1e6;
+
+    vkDestroyShaderModule(m_context->device, shaderModule, nullptr);
+
+    if (m_gpuConvert)
+        createConvertPipeline();
+}
+
+void VulkanWindow::createConvertPipeline()
+{
+    TRACE_FUNCTION();
+
+    std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+    bindings[0].binding = 0;
+    bindings[0].descriptorCount = 1;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[1].binding = 1;
+    bindings[1].descriptorCount = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo{};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    if (vkCreateDescriptorSetLayout(m_context->device,
+                                    &layoutInfo,
+                                    nullptr,
+                                    &m_context->convertDescriptorSetLayout)
+        != VK_SUCCESS) {
+        throw std::runtime_error("failed to create convert descriptor set layout!");
+    }
+
+    VkPushConstantRange pushConstantRange{};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(ConvertPushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &m_context->convertDescriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(m_context->device,
+                               &pipelineLayoutInfo,
+                               nullptr,
+                               &m_context->convertPipelineLayout)
+        != VK_SUCCESS) {
+        throw std::runtime_error("failed to create convert pipeline layout!");
+    }
+
+    VkShaderModule shaderModule = createShaderModule(readFile(":/shaders/convert.spv"));
+
+    VkComputePipelineCreateInfo pipelineInfo{};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineInfo.stage.module = shaderModule;
+    pipelineInfo.stage.pName = "main";
+    pipelineInfo.layout = m_context->convertPipelineLayout;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    if (vkCreateComputePipelines(m_context->device,
+                                 m_context->pipelineCache->handle(),
+                                 1,
+                                 &pipelineInfo,
+                                 nullptr,
+                                 &m_context->convertPipeline)
+        != VK_SUCCESS) {
+        throw std::runtime_error("failed to create convert pipeline!");
+    }
+    m_mipPipelineMs += timer.nsecsElapsed() / 1e6;
+
+    vkDestroyShaderModule(m_context->device, shaderModule, nullptr);
+}
+
+int32_t VulkanWindow::convertFormat(const BmpReader &bmp)
+{
+    // Matches the FORMAT_ defines of convert.comp
+    switch (bmp.encoding()) {
+    case BmpReader::Encoding::Bgr:
+        return 0;
+    case BmpReader::Encoding::Bgra:
+        return bmp.hasAlpha() ? 1 : 2;
+    case BmpReader::Encoding::Palette8:
+        return 3;
+    case BmpReader::Encoding::Rgb565:
+        return 4;
+    case BmpReader::Encoding::Rgb555:
+        return 5;
+    default:
+        // 4 bit and RLE rows are not worth a shader of their own
+        return -1;
+    }
+}
+
+void VulkanWindow::createFramebuffers()
+{
+    TRACE_FUNCTION();
+
+    if (m_context->imagelessFramebuffer) {
+        VkFramebufferAttachmentImageInfoKHR imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_ATTACHMENT_IMAGE_INFO_KHR;
+        imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        imageInfo.width = m_swapChainExtent.width;
+        imageInfo.height = m_swapChainExtent.height;
+        imageInfo.layerCount = 1;
+        imageInfo.viewFormatCount = 1;
+        imageInfo.pViewFormats = &m_context->swapChainImageFormat;
+
+        VkFramebufferAttachmentsCreateInfoKHR attachmentsInfo{};
+        attachmentsInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_ATTACHMENTS_CREATE_INFO_KHR;
+        attachmentsInfo.attachmentImageInfoCount = 1;
+        attachmentsInfo.pAttachmentImageInfos = &imageInfo;
+
+        VkFramebufferCreateInfo framebufferInfo{};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.pNext = &attachmentsInfo;
+        framebufferInfo.flags = VK_FRAMEBUFFER_CREATE_IMAGELESS_BIT_KHR;
+        framebufferInfo.renderPass = m_context->renderPass;
+        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.width = m_swapChainExtent.width;
+        framebufferInfo.height = m_swapChainExtent.height;
+        framebufferInfo.layers = 1;
+
+        m_swapChainFramebuffers.resize(1);
+        if (vkCreateFramebuffer(m_context->device,
+                                &framebufferInfo,
+                                nullptr,
+                                &m_swapChainFramebuffers[0])
+            != VK_SUCCESS) {
+            throw std::runtime_error("failed to create framebuffer!");
+        }
+        return;
+    }
+
+    m_swapChainFramebuffers.resize(m_swapChainImageViews.size());
+
+    for (size_t i = 0; i < m_swapChainImageViews.size(); i++) {
+        VkImageView attachments[] = {m_swapChainImageViews[i]};
+
+        VkFramebufferCreateInfo framebufferInfo{};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = m_context->renderPass;
+        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.pAttachments = attachments;
+        framebufferInfo.width = m_swapChainExtent.width;
+        framebufferInfo.height = m_swapChainExtent.height;
+        framebufferInfo.layers = 1;
+
+        if (vkCreateFramebuffer(m_context->device,
+                                &framebufferInfo,
+                                nullptr,
+                                &m_swapChainFramebuffers[i])
+            != VK_SUCCESS) {
+            throw std::runtime_error("failed to create framebuffer!");
+        }
+    }
+}
+
+void VulkanWindow::createCommandPool()
+{
+    TRACE_FUNCTION();
+
+    QueueFamilyIndices queueFamilyIndices = findQueueFamilies(m_context->physicalDevice);
+
+    VkCommandPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+
+    if (vkCreateCommandPool(m_context->device, &poolInfo, nullptr, &m_commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create graphics command pool!");
+    }
+
+    if (m_context->transferQueue != VK_NULL_HANDLE) {
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = m_context->transferFamily;
+
+        if (vkCreateCommandPool(m_context->device, &poolInfo, nullptr, &m_transferCommandPool)
+            != VK_SUCCESS) {
+            throw std::runtime_error("failed to create transfer command pool!");
+        }
+    }
+}
+
+void VulkanWindow::initializeScaling(uint32_t imageWidth,
+                                     uint32_t imageHeight,
                                      uint32_t viewportWidth,
                                      uint32_t viewportHeight)
 {
@@ -705,259 +1888,1479 @@ void VulkanWindow::initializeScaling(uint32_t imageWidth,
     m_normOffsetX = 0;
     m_normOffsetY = 0;
 
-    m_zoomValueX = 1;
-    m_zoomValueY = 1;
-    m_viewport.width = viewportWidth * m_zoomValueX;
-    m_viewport.height = viewportHeight * m_zoomValueY;
-    m_viewportOffset.x = 0;
-    m_viewportOffset.y = 0;
-    m_offsetX = 0;
-    m_offsetY = 0;
+    m_zoomValueX = 1;
+    m_zoomValueY = 1;
+    m_viewport.width = viewportWidth * m_zoomValueX;
+    m_viewport.height = viewportHeight * m_zoomValueY;
+    m_viewportOffset.x = 0;
+    m_viewportOffset.y = 0;
+    m_offsetX = 0;
+    m_offsetY = 0;
+}
+
+VkExtent2D VulkanWindow::viewExtent() const
+{
+    return m_grid.cellExtent(m_swapChainExtent);
+}
+
+void VulkanWindow::imagePan(int32_t dY, int32_t dX)
+{
+    const VkExtent2D extent = viewExtent();
+    auto viewportWidth = extent.width;
+    auto viewportHeight = extent.height;
+
+    m_offsetX += dX;
+    m_offsetY += dY;
+
+    float normDx = (dX / (float) viewportWidth) * 2.0f;
+    float normDy = (dY / (float) viewportHeight) * 2.0f;
+
+    m_normOffsetX += normDx;
+    m_normOffsetY += normDy;
+
+    if (m_zoomValueX <= 1 && m_zoomValueY <= 1) {
+        m_dynamicParameters.offsetX = 0;
+        m_dynamicParameters.offsetY = 0;
+        m_viewportOffset.x = m_offsetX;
+        m_viewportOffset.y = m_offsetY;
+    } else {
+        m_dynamicParameters.offsetX = m_normOffsetX;
+        m_dynamicParameters.offsetY = m_normOffsetY;
+        m_viewportOffset.x = 0;
+        m_viewportOffset.y = 0;
+    }
+}
+
+void VulkanWindow::onZoomToPixel(float cursorX, float cursorY, bool zoomIn)
+{
+    const VkExtent2D extent = viewExtent();
+    auto viewportWidth = extent.width;
+    auto viewportHeight = extent.height;
+
+    float normCursorX = (cursorX / (float) viewportWidth) * 2.0f - 1.0f;
+    float normCursorY = (cursorY / (float) viewportHeight) * 2.0f - 1.0f;
+
+    // Map normalized window coordinates to image coordinates
+    float normImageCoordX = (normCursorX - m_normOffsetX) / m_zoomValueX;
+    float normImageCoordY = (normCursorY - m_normOffsetY) / m_zoomValueY;
+
+    int32_t imageCoordX = (cursorX - m_offsetX) / m_zoomValueX;
+    int32_t imageCoordY = (cursorY - m_offsetY) / m_zoomValueY;
+
+    float zoomFactorX;
+    float zoomFactorY;
+    if (zoomIn) {
+        zoomFactorX = m_zoomValueX >= 1 ? 1 : 0.1;
+        zoomFactorY = m_zoomValueY >= 1 ? 1 : 0.1;
+    } else {
+        zoomFactorX = m_zoomValueX > 1 ? -1 : -0.1;
+        zoomFactorY = m_zoomValueY > 1 ? -1 : -0.1;
+    }
+    float newScaleX = std::clamp(m_zoomValueX + zoomFactorX, 0.1f, 16.0f);
+    float newScaleY = std::clamp(m_zoomValueY + zoomFactorY, 0.1f, 16.0f);
+
+    m_offsetX = cursorX - (imageCoordX * newScaleX);
+    m_offsetY = cursorY - (imageCoordY * newScaleY);
+
+    m_normOffsetX = normCursorX - (normImageCoordX * newScaleX);
+    m_normOffsetY = normCursorY - (normImageCoordY * newScaleY);
+
+    if (newScaleX <= 1 && newScaleY <= 1) {
+        viewportWidth *= newScaleX;
+        viewportHeight *= newScaleY;
+
+        m_dynamicParameters.offsetX = 0;
+        m_dynamicParameters.offsetY = 0;
+        m_dynamicParameters.scaleX = 1;
+        m_dynamicParameters.scaleY = 1;
+
+        m_viewportOffset.x = m_offsetX;
+        m_viewportOffset.y = m_offsetY;
+    } else {
+        // Adjust the offsets to focus zoom on the cursor position
+        m_dynamicParameters.offsetX = m_normOffsetX;
+        m_dynamicParameters.offsetY = m_normOffsetY;
+
+        // Apply the updated scale and offsets
+        m_dynamicParameters.scaleX = newScaleX;
+        m_dynamicParameters.scaleY = newScaleY;
+        viewportWidth = std::min<uint32_t>(extent.width, viewportWidth * newScaleX);
+        viewportHeight = std::min<uint32_t>(extent.height, viewportWidth * newScaleY);
+
+        m_viewportOffset.x = 0;
+        m_viewportOffset.y = 0;
+    }
+    m_zoomValueX = newScaleX;
+    m_zoomValueY = newScaleY;
+
+    m_viewport.width = viewportWidth;
+    m_viewport.height = viewportHeight;
+}
+
+void VulkanWindow::applyStartupView()
+{
+    const float centerX = viewExtent().width / 2.0f;
+    const float centerY = viewExtent().height / 2.0f;
+
+    // Half a step of slack around the target keeps float steps from overshooting
+    const float target = std::clamp(m_options.zoom, 0.1f, 16.0f);
+    while (m_zoomValueX + 0.05f < target && m_zoomValueX < 16.0f) {
+        onZoomToPixel(centerX, centerY, true);
+    }
+    while (m_zoomValueX - 0.05f > target && m_zoomValueX > 0.15f) {
+        onZoomToPixel(centerX, centerY, false);
+    }
+
+    if (!m_options.pan.isNull())
+        imagePan(m_options.pan.y(), m_options.pan.x());
+}
+
+std::unique_ptr<VulkanWindow::TextureSource> VulkanWindow::openTextureSource(
+    const QString &imageName, MipFilter filter, Compression compression)
+{
+    TRACE_FUNCTION();
+
+    auto source = std::make_unique<TextureSource>();
+    source->filter = filter;
+    source->compression = compression;
+
+    // Tiles are read on demand, the device limit is checked again once there is a device
+    if (useTiledMode(imageName, UINT32_MAX)) {
+        source->tiled = true;
+        return source;
+    }
+
+    // A cached chain skips decoding and mip generation entirely
+    // Compressed chains are always filtered on the CPU
+    source->cacheKey = m_textureCache.key(imageName,
+                                          compression == Compression::None
+                                              ? QString("rgba8-srgb/") + mipFilterName(filter)
+                                              : QString("bc-srgb/") + compressionName(compression)
+                                                    + "/" + bcQualityName(m_bcQuality));
+    {
+        TRACE_SCOPE("texture cache lookup");
+        source->cached = m_textureCache.find(source->cacheKey);
+    }
+    if (source->cached) {
+        source->width = source->cached->width;
+        source->height = source->cached->height;
+        source->decoder = "cache";
+        return source;
+    }
+
+    // BMPs are decoded in stripes straight from the mapped file into the staging buffer once
+    // it exists, until then the file is only paged in. Everything else is decoded through
+    // QImage.
+    if (qgetenv("VIV_DECODER") != "qimage") {
+        auto bmp = std::make_unique<BmpReader>(imageName);
+        if (bmp->isValid()) {
+            TRACE_SCOPE("bmp prefetch");
+            bmp->prefetch();
+            source->width = bmp->width();
+            source->height = bmp->height();
+            source->hasAlpha = bmp->hasAlpha();
+            source->decoder = "bmp";
+            source->bmp = std::move(bmp);
+            return source;
+        }
+    }
+
+    TRACE_SCOPE("qimage decode");
+    const QImage image(imageName);
+    source->hasAlpha = image.hasAlphaChannel();
+    source->image = image.convertToFormat(QImage::Format_RGBA8888);
+    source->width = static_cast<uint32_t>(source->image.width());
+    source->height = static_cast<uint32_t>(source->image.height());
+    source->decoder = "qimage";
+    return source;
+}
+
+void VulkanWindow::startTextureFill(const QString &imageName)
+{
+    TRACE_FUNCTION();
+
+    PendingTexture &texture = m_pendingTexture;
+    {
+        TRACE_SCOPE("wait for texture source");
+        texture.source = m_textureSource.get();
+    }
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(m_context->physicalDevice, &properties);
+    if (texture.source->tiled
+        || useTiledMode(imageName, properties.limits.maxImageDimension2D)) {
+        texture.source.reset();
+        texture.tiled = true;
+        return;
+    }
+
+    // Only a device without compute mips or without linear blits, or without the requested
+    // compression, gets here. The cache key and the decoded levels depend on both, the filter
+    // only matters uncompressed.
+    if (texture.source->compression != m_compression
+        || (m_compression == Compression::None && texture.source->filter != m_mipFilter)) {
+        texture.source = openTextureSource(imageName, m_mipFilter, m_compression);
+    }
+
+    if (texture.source->width == 0 || texture.source->height == 0) {
+        throw std::runtime_error("failed to load texture image!");
+    }
+
+    beginTextureFill(texture);
+    m_texWidth = static_cast<int32_t>(texture.width);
+    m_texHeight = static_cast<int32_t>(texture.height);
+    m_mipLevels = texture.mipLevels;
+    m_textureDecoder = texture.decoder;
+    m_textureFormat = texture.format;
+}
+
+void VulkanWindow::beginTextureFill(PendingTexture &texture)
+{
+    const TextureSource &source = *texture.source;
+    texture.width = source.width;
+    texture.height = source.height;
+    texture.mipLevels = static_cast<uint32_t>(
+                            std::floor(std::log2(std::max(source.width, source.height))))
+                        + 1;
+    texture.decoder = source.decoder;
+
+    // The GPU can neither blit nor store BC blocks, so a compressed chain is filtered and
+    // encoded on the CPU. A cache hit has been encoded before.
+    texture.compressed = !source.cached && m_compression != Compression::None;
+    texture.blockBytes = source.cached ? source.cached->blockBytes : 0;
+    if (texture.compressed) {
+        texture.bcFormat = m_compression == Compression::Bc7
+                                   || (m_compression == Compression::Auto && source.hasAlpha)
+                               ? BcFormat::Bc7
+                               : BcFormat::Bc1;
+        texture.blockBytes = bcBlockBytes(texture.bcFormat);
+    }
+    texture.format = texture.blockBytes == 8    ? VK_FORMAT_BC1_RGB_SRGB_BLOCK
+                     : texture.blockBytes == 16 ? VK_FORMAT_BC7_SRGB_BLOCK
+                                                : VK_FORMAT_R8G8B8A8_SRGB;
+
+    // Cache hits and the CPU path upload the whole chain, everything else only level 0
+    texture.cpuMips = !source.cached && (m_mipFilter == MipFilter::Cpu || texture.compressed);
+    texture.fullChain = source.cached || texture.cpuMips;
+    texture.levels = mipChainLayout(source.width,
+                                    source.height,
+                                    texture.fullChain ? texture.mipLevels : 1,
+                                    texture.blockBytes);
+
+    // BMP pixel data goes up as stored when the compute mips follow, a 24 bit file is then a
+    // quarter smaller than its RGBA expansion and the CPU only copies. The palette follows the
+    // pixel data.
+    VkDeviceSize stagingSize = mipChainSize(texture.levels);
+    const int32_t format = source.bmp && m_gpuConvert && !texture.fullChain
+                                   && texture.mipLevels > 1
+                               ? convertFormat(*source.bmp)
+                               : -1;
+    if (format >= 0) {
+        const VkDeviceSize dataSize = (source.bmp->dataSize() + 3) & ~VkDeviceSize(3);
+        const VkDeviceSize rawSize = dataSize
+                                     + (source.bmp->encoding() == BmpReader::Encoding::Palette8
+                                            ? sizeof(source.bmp->palette())
+                                            : 0);
+        if (rawSize <= m_maxStorageBufferRange) {
+            texture.gpuConvert = true;
+            texture.convert.width = static_cast<int32_t>(source.width);
+            texture.convert.height = static_cast<int32_t>(source.height);
+            texture.convert.rowStride = source.bmp->rowStride();
+            texture.convert.format = static_cast<uint32_t>(format);
+            texture.convert.bottomUp = source.bmp->isBottomUp() ? 1 : 0;
+            texture.convert.paletteOffset = static_cast<uint32_t>(dataSize);
+            stagingSize = rawSize;
+            texture.decoder = "bmp-gpu";
+        }
+    }
+
+    createBuffer(stagingSize,
+                 VK_BUFFER_USAGE_TRANSFER_SRC_BIT
+                     | (texture.gpuConvert ? VK_BUFFER_USAGE_STORAGE_BUFFER_BIT : 0),
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 texture.stagingBuffer,
+                 texture.stagingBufferMemory);
+
+    if (!m_threadPool)
+        m_threadPool = std::make_unique<ThreadPool>();
+
+    // Only touches the mapped staging memory and the source, nothing the main thread uses
+    // before uploadTexture joins it
+    auto fill = std::make_shared<std::packaged_task<void()>>([this, &texture] {
+        TextureSource &source = *texture.source;
+        auto *staging = static_cast<uint8_t *>(texture.stagingBufferMemory.mapped);
+
+        // A compressed texture is decoded and filtered as RGBA first, then encoded to staging
+        const std::vector<MipLevel> rgbaLevels = texture.compressed
+                                                     ? mipChainLayout(source.width,
+                                                                      source.height,
+                                                                      texture.mipLevels)
+                                                     : texture.levels;
+        std::unique_ptr<uint8_t[]> rgba;
+        if (texture.compressed)
+            rgba.reset(new uint8_t[mipChainSize(rgbaLevels)]);
+        uint8_t *pixels = texture.compressed ? rgba.get() : staging;
+        {
+            TRACE_SCOPE("fill staging");
+            if (source.cached) {
+                memcpy(pixels, source.cached->pixels, source.cached->size);
+            } else if (texture.gpuConvert) {
+                source.bmp->copyRaw(pixels, *m_threadPool);
+                if (source.bmp->encoding() == BmpReader::Encoding::Palette8) {
+                    memcpy(pixels + texture.convert.paletteOffset,
+                           source.bmp->palette().data(),
+                           sizeof(source.bmp->palette()));
+                }
+                if (Tracer::statsEnabled()) {
+                    qDebug() << "bmp raw upload:" << source.bmp->dataSize() / 1e6
+                             << "MB instead of" << double(source.width) * source.height * 4 / 1e6
+                             << "MB";
+                }
+            } else if (source.bmp) {
+                QElapsedTimer timer;
+                timer.start();
+                source.bmp->decode(pixels, *m_threadPool);
+                if (Tracer::statsEnabled()) {
+                    const double ms = timer.nsecsElapsed() / 1e6;
+                    const double megabytes = double(source.width) * source.height * 4 / 1e6;
+                    qDebug() << "bmp decode:" << ms << "ms," << megabytes * 1e3 / ms
+                             << "MB/s, threads:" << m_threadPool->threadCount() + 1;
+                }
+            } else {
+                memcpy(pixels, source.image.constBits(), size_t(source.width) * source.height * 4);
+            }
+        }
+
+        if (texture.cpuMips) {
+            TRACE_SCOPE("cpu mip generation");
+            QElapsedTimer timer;
+            timer.start();
+            buildMipChain(pixels, rgbaLevels, *m_threadPool);
+            if (Tracer::statsEnabled()) {
+                qDebug() << "cpu mip generation:" << timer.nsecsElapsed() / 1e6 << "ms, levels:"
+                         << texture.mipLevels << "threads:" << m_threadPool->threadCount() + 1;
+            }
+        }
+
+        if (texture.compressed) {
+            TRACE_SCOPE("bc encode");
+            QElapsedTimer timer;
+            timer.start();
+            encodeBcChain(pixels,
+                          rgbaLevels,
+                          staging,
+                          texture.levels,
+                          texture.bcFormat,
+                          m_bcQuality,
+                          *m_threadPool);
+            if (Tracer::statsEnabled()) {
+                const double ms = timer.nsecsElapsed() / 1e6;
+                qDebug() << bcFormatName(texture.bcFormat) << "encode,"
+                         << bcQualityName(m_bcQuality) << "quality:" << ms << "ms,"
+                         << mipChainSize(rgbaLevels) / 4e3 / ms << "Mtexel/s,"
+                         << mipChainSize(texture.levels) / 1e6 << "MB instead of"
+                         << mipChainSize(rgbaLevels) / 1e6 << "MB";
+            }
+        }
+    });
+    texture.fill = fill->get_future();
+    m_threadPool->submit([fill] { (*fill)(); });
+}
+
+void VulkanWindow::createTextureImage(const QString &imageName)
+{
+    TRACE_FUNCTION();
+
+    if (m_pendingTexture.tiled) {
+        createTiledTexture(imageName);
+        return;
+    }
+
+    auto b = viewExtent();
+    initializeScaling(m_texWidth, m_texHeight, b.width, b.height);
+
+    const ResidentTexture texture = uploadTexture(m_pendingTexture);
+    m_pendingTexture = PendingTexture{};
+    m_textureImage = texture.image;
+    m_textureImageMemory = texture.memory;
+}
+
+ResidentTexture VulkanWindow::uploadTexture(PendingTexture &texture)
+{
+    TRACE_FUNCTION();
+
+    {
+        TRACE_SCOPE("wait for texture fill");
+        texture.fill.get();
+    }
+    const QString cacheKey = texture.source->cacheKey;
+    texture.source.reset();
+
+    ResidentTexture result;
+    result.width = texture.width;
+    result.height = texture.height;
+    result.mipLevels = texture.mipLevels;
+    result.format = texture.format;
+    result.decoder = texture.decoder;
+    result.uploader = this;
+    result.uploadSerial = m_uploads->nextSerial();
+
+    const int32_t width = static_cast<int32_t>(texture.width);
+    const int32_t height = static_cast<int32_t>(texture.height);
+    const uint32_t mipLevels = texture.mipLevels;
+    const std::vector<MipLevel> &levels = texture.levels;
+    VkBuffer stagingBuffer = texture.stagingBuffer;
+    DeviceAllocation &stagingBufferMemory = texture.stagingBufferMemory;
+    texture.stagingBuffer = VK_NULL_HANDLE;
+
+    // Storage images cannot be sRGB, so the compute path writes through UNORM views of a
+    // mutable image and samples it through an sRGB view. GPU conversion implies this path.
+    const bool computeMips = m_mipFilter != MipFilter::Blit && !texture.fullChain
+                             && mipLevels > 1;
+
+    createImage(width,
+                height,
+                mipLevels,
+                computeMips ? VK_FORMAT_R8G8B8A8_UNORM : texture.format,
+                VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT
+                    | VK_IMAGE_USAGE_SAMPLED_BIT
+                    | (computeMips ? VK_IMAGE_USAGE_STORAGE_BIT : 0),
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                result.image,
+                result.memory,
+                computeMips ? VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT : 0);
+
+    if (texture.gpuConvert) {
+        // The shader reads the host visible staging buffer directly, there is nothing to copy
+        if (m_mipPipelineReady.valid()) {
+            TRACE_SCOPE("wait for mip pipeline");
+            m_mipPipelineReady.get();
+        }
+        convertOnGpu(result.image, stagingBuffer, texture.convert, mipLevels);
+    } else if (m_context->transferQueue != VK_NULL_HANDLE) {
+        copyToImageOnTransferQueue(stagingBuffer, result.image, levels, mipLevels);
+    } else {
+        transitionImageLayout(result.image,
+                              VK_FORMAT_R8G8B8A8_SRGB,
+                              VK_IMAGE_LAYOUT_UNDEFINED,
+                              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                              mipLevels);
+        copyBufferToImage(m_uploads->commandBuffer(), stagingBuffer, result.image, levels);
+    }
+
+    if (texture.fullChain) {
+        transitionImageLayout(result.image,
+                              VK_FORMAT_R8G8B8A8_SRGB,
+                              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                              VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                              mipLevels);
+        if (texture.cpuMips && !cacheKey.isEmpty()) {
+            storeInTextureCache(cacheKey,
+                                stagingBuffer,
+                                stagingBufferMemory,
+                                levels,
+                                texture.blockBytes);
+        } else {
+            m_uploads->releaseAfterUpload(stagingBuffer, stagingBufferMemory);
+        }
+        return result;
+    }
+
+    m_uploads->releaseAfterUpload(stagingBuffer, stagingBufferMemory);
+
+    if (computeMips && m_mipPipelineReady.valid()) {
+        TRACE_SCOPE("wait for mip pipeline");
+        m_mipPipelineReady.get();
+    }
+
+    // Timed so filters and the blit path can be compared
+    m_uploads->timeMips(mipLevels, mipFilterName(computeMips ? m_mipFilter : MipFilter::Blit));
+
+    if (computeMips) {
+        generateMipmapsCompute(result.image, width, height, mipLevels);
+    } else {
+        generateMipmaps(result.image, VK_FORMAT_R8G8B8A8_SRGB, width, height, mipLevels);
+    }
+
+    const auto chain = mipChainLayout(texture.width, texture.height, mipLevels);
+    if (!cacheKey.isEmpty() && m_cacheReadback && mipChainSize(chain) <= MAX_CACHE_READBACK_BYTES)
+        readBackForTextureCache(cacheKey, result.image, chain);
+    return result;
+}
+
+void VulkanWindow::initBrowsing(const QString &imageName)
+{
+    TRACE_FUNCTION();
+
+    if (m_tiledMode)
+        return;
+
+    // A quarter of the largest device local heap leaves room for the rest of the system
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(m_context->physicalDevice, &memoryProperties);
+    VkDeviceSize deviceLocalBytes = 0;
+    for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+        if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+            deviceLocalBytes = std::max(deviceLocalBytes, memoryProperties.memoryHeaps[i].size);
+    }
+
+    // The budget covers every window on the device
+    bool ok = false;
+    const qint64 budgetMiB = qgetenv("VIV_VRAM_BUDGET").toLongLong(&ok);
+    const VkDeviceSize budget = ok ? VkDeviceSize(budgetMiB) << 20 : deviceLocalBytes / 4;
+    if (!m_context->textures)
+        m_context->textures = std::make_unique<GpuTextureCache>(m_context->device,
+                                                                *m_context->allocator,
+                                                                budget);
+    m_gpuTextures = m_context->textures.get();
+
+    // The opened image becomes the first resident texture, unless another window had it
+    const QFileInfo info(imageName);
+    m_displayedImage = info.absoluteFilePath();
+    if (!m_displayedTexture) {
+        ResidentTexture texture;
+        texture.image = m_textureImage;
+        texture.memory = m_textureImageMemory;
+        texture.view = m_textureImageView;
+        texture.descriptorPool = m_descriptorPool;
+        texture.descriptorSet = m_descriptorSet;
+        texture.width = static_cast<uint32_t>(m_texWidth);
+        texture.height = static_cast<uint32_t>(m_texHeight);
+        texture.mipLevels = m_mipLevels;
+        texture.format = m_textureFormat;
+        texture.decoder = m_textureDecoder;
+        texture.uploader = this;
+        texture.uploadSerial = m_uploads->nextSerial();
+
+        m_displayedTexture = &m_gpuTextures->insert(m_displayedImage, texture);
+    }
+
+    if (m_offscreen)
+        return;
+
+    // The grid shows its own images instead of browsing the directory
+    if (!m_grid.isEmpty()) {
+        m_gpuTextures->evict(this, m_grid.images());
+        for (const QString &fileName : m_grid.images()) {
+            requestTextureLoad(fileName);
+        }
+        return;
+    }
+
+    const int prefetchCount = qEnvironmentVariableIntValue("VIV_PREFETCH", &ok);
+    m_browser = ImageBrowser(m_displayedImage, ok ? prefetchCount : 2);
+
+    qDebug() << "browsing" << m_browser.size() << "images, gpu texture budget:"
+             << m_gpuTextures->budget() / (1024 * 1024) << "MiB, prefetching"
+             << m_browser.prefetchCount() << "each way";
+
+    // Pinned before another window's eviction can take the displayed texture
+    const QStringList window = m_browser.prefetchWindow();
+    m_gpuTextures->evict(this, window + QStringList{m_displayedImage});
+    for (const QString &fileName : window) {
+        requestTextureLoad(fileName);
+    }
+}
+
+void VulkanWindow::showImage(int index)
+{
+    TRACE_FUNCTION();
+
+    if (!m_browser.moveTo(index))
+        return;
+
+    const QString fileName = m_browser.current();
+
+    // A miss keeps the previous image up until the load is done
+    ResidentTexture *texture = m_gpuTextures->find(fileName);
+    if (Tracer::statsEnabled()) {
+        qDebug() << "gpu texture cache" << (texture ? "hit" : "miss") << "for"
+                 << QFileInfo(fileName).fileName() << m_gpuTextures->usedBytes() / (1024 * 1024)
+                 << "of" << m_gpuTextures->budget() / (1024 * 1024) << "MiB used";
+    }
+    if (texture) {
+        m_browser.setWanted(QString());
+        displayTexture(fileName, *texture);
+    } else {
+        m_browser.setWanted(fileName);
+        setTitle(fileName + " (loading)");
+    }
+
+    const QStringList window = m_browser.prefetchWindow();
+    for (const QString &file : window) {
+        requestTextureLoad(file);
+    }
+    m_gpuTextures->evict(this, window + QStringList{m_displayedImage});
+}
+
+void VulkanWindow::displayTexture(const QString &fileName, ResidentTexture &texture)
+{
+    m_displayedTexture = &texture;
+    m_displayedImage = fileName;
+
+    m_descriptorSet = texture.descriptorSet;
+    m_texWidth = static_cast<int32_t>(texture.width);
+    m_texHeight = static_cast<int32_t>(texture.height);
+    m_mipLevels = texture.mipLevels;
+    m_textureDecoder = texture.decoder;
+
+    auto b = viewExtent();
+    initializeScaling(m_texWidth, m_texHeight, b.width, b.height);
+
+    setTitle(fileName);
+    scheduleRedraw(false);
+}
+
+void VulkanWindow::requestTextureLoad(const QString &fileName)
+{
+    if (m_gpuTextures->find(fileName))
+        return;
+    for (const auto &load : m_textureLoads) {
+        if (load->fileName == fileName)
+            return;
+    }
+
+    if (!m_threadPool)
+        m_threadPool = std::make_unique<ThreadPool>();
+
+    auto load = std::make_unique<TextureLoad>();
+    load->fileName = fileName;
+    auto source = std::make_shared<std::packaged_task<std::unique_ptr<TextureSource>()>>(
+        [this, fileName, filter = m_mipFilter, compression = m_compression] {
+            return openTextureSource(fileName, filter, compression);
+        });
+    load->source = source->get_future();
+    m_threadPool->submit([source] { (*source)(); });
+    m_textureLoads.push_back(std::move(load));
+
+    if (!m_textureLoadPollPending) {
+        m_textureLoadPollPending = true;
+        QTimer::singleShot(2, this, [this] { pollTextureLoads(); });
+    }
+}
+
+void VulkanWindow::pollTextureLoads()
+{
+    TRACE_FUNCTION();
+
+    m_textureLoadPollPending = false;
+    if (!m_vulkanInitDone)
+        return;
+
+    auto isReady = [](const auto &future) {
+        return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+    };
+
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(m_context->physicalDevice, &properties);
+    const uint32_t maxDimension = properties.limits.maxImageDimension2D;
+
+    bool uploaded = false;
+    for (auto it = m_textureLoads.begin(); it != m_textureLoads.end();) {
+        TextureLoad &load = **it;
+        PendingTexture &texture = load.texture;
+
+        if (load.source.valid()) {
+            if (!isReady(load.source)) {
+                ++it;
+                continue;
+            }
+
+            texture.source = load.source.get();
+            const TextureSource &source = *texture.source;
+            if (!source.tiled && source.width > 0 && source.height > 0
+                && source.width <= maxDimension && source.height <= maxDimension) {
+                beginTextureFill(texture);
+                ++it;
+                continue;
+            }
+
+            // Browsing switches between textures of one draw path, tiles are not part of it
+            qWarning() << "skipping" << load.fileName
+                       << (source.width > 0 ? "which needs tiled mode" : "which cannot be decoded");
+            if (m_browser.takeWanted(load.fileName))
+                setTitle(load.fileName + " (cannot be shown)");
+            if (m_grid.markFailed(load.fileName))
+                updateGrid();
+        } else if (!isReady(texture.fill)) {
+            ++it;
+            continue;
+        } else {
+            ResidentTexture resident = uploadTexture(texture);
+            resident.view = createImageView(resident.image, resident.format, resident.mipLevels);
+            resident.descriptorPool = createTextureDescriptorPool();
+            resident.descriptorSet = createTextureDescriptorSet(resident.descriptorPool,
+                                                                resident.view);
+            ResidentTexture &inserted = m_gpuTextures->insert(load.fileName, resident);
+            uploaded = true;
+
+            if (m_browser.takeWanted(load.fileName))
+                displayTexture(load.fileName, inserted);
+        }
+
+        destroyTextureLoad(load);
+        it = m_textureLoads.erase(it);
+    }
+
+    if (uploaded) {
+        // Queue order puts the uploads ahead of the frame that first draws them
+        m_uploads->submit();
+        if (m_grid.isEmpty()) {
+            m_gpuTextures->evict(this, m_browser.prefetchWindow() + QStringList{m_displayedImage});
+        } else {
+            updateGrid();
+        }
+    }
+
+    if (!m_textureLoads.empty() && !m_textureLoadPollPending) {
+        m_textureLoadPollPending = true;
+        QTimer::singleShot(2, this, [this] { pollTextureLoads(); });
+    }
+}
+
+void VulkanWindow::destroyTextureLoad(TextureLoad &load)
+{
+    // The pool may still be working on it
+    if (load.source.valid())
+        load.source.wait();
+    if (load.texture.fill.valid())
+        load.texture.fill.wait();
+
+    if (load.texture.stagingBuffer != VK_NULL_HANDLE) {
+        vkDestroyBuffer(m_context->device, load.texture.stagingBuffer, nullptr);
+        m_context->allocator->free(load.texture.stagingBufferMemory);
+        load.texture.stagingBuffer = VK_NULL_HANDLE;
+    }
+}
+
+void VulkanWindow::generateMipmaps(
+    VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
+{
+    TRACE_FUNCTION();
+
+    // Check if image format supports linear blitting
+    VkFormatProperties formatProperties;
+    vkGetPhysicalDeviceFormatProperties(m_context->physicalDevice, imageFormat, &formatProperties);
+
+    if (!(formatProperties.optimalTilingFeatures
+          & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
+        throw std::runtime_error("texture image format does not support linear blitting!");
+    }
+
+    recordMipBlits(m_uploads->commandBuffer(),
+                   image,
+                   texWidth,
+                   texHeight,
+                   mipLevels,
+                   VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                   VK_ACCESS_SHADER_READ_BIT);
+}
+
+void VulkanWindow::convertOnGpu(VkImage image,
+                                VkBuffer buffer,
+                                const ConvertPushConstants &constants,
+                                uint32_t mipLevels)
+{
+    TRACE_FUNCTION();
+
+    VkCommandBuffer commandBuffer = m_uploads->commandBuffer();
+
+    VkImageViewCreateInfo viewInfo{};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = image;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    VkImageView levelView;
+    if (vkCreateImageView(m_context->device, &viewInfo, nullptr, &levelView) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create convert view!");
+    }
+    m_uploads->releaseAfterUpload(levelView);
+
+    std::array<VkDescriptorPoolSize, 2> poolSizes{};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[0].descriptorCount = 1;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSizes[1].descriptorCount = 1;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+    poolInfo.pPoolSizes = poolSizes.data();
+    poolInfo.maxSets = 1;
+
+    VkDescriptorPool descriptorPool;
+    if (vkCreateDescriptorPool(m_context->device, &poolInfo, nullptr, &descriptorPool)
+        != VK_SUCCESS) {
+        throw std::runtime_error("failed to create convert descriptor pool!");
+    }
+    m_uploads->releaseAfterUpload(descriptorPool);
+
+    VkDescriptorSetAllocateInfo allocInfo{};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &m_context->convertDescriptorSetLayout;
+
+    VkDescriptorSet descriptorSet;
+    if (vkAllocateDescriptorSets(m_context->device, &allocInfo, &descriptorSet) != VK_SUCCESS) {
+        throw std::runtime_error("failed to allocate convert descriptor set!");
+    }
+
+    VkDescriptorBufferInfo bufferInfo{};
+    bufferInfo.buffer = buffer;
+    bufferInfo.offset = 0;
+    bufferInfo.range = VK_WHOLE_SIZE;
+
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.imageView = levelView;
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+    std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+    for (uint32_t i = 0; i < descriptorWrites.size(); i++) {
+        descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[i].dstSet = descriptorSet;
+        descriptorWrites[i].dstBinding = i;
+        descriptorWrites[i].dstArrayElement = 0;
+        descriptorWrites[i].descriptorCount = 1;
+    }
+    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrites[0].pBufferInfo = &bufferInfo;
+    descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    descriptorWrites[1].pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(m_context->device,
+                           static_cast<uint32_t>(descriptorWrites.size()),
+                           descriptorWrites.data(),
+                           0,
+                           nullptr);
+
+    // Level 0 is written by the shader, the others wait for the mips as transfer destinations
+    std::array<VkImageMemoryBarrier, 2> barriers{};
+    for (auto &barrier : barriers) {
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.image = image;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.srcAccessMask = 0;
+    }
+    barriers[0].subresourceRange.baseMipLevel = 0;
+    barriers[0].subresourceRange.levelCount = 1;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barriers[0].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barriers[1].subresourceRange.baseMipLevel = 1;
+    barriers[1].subresourceRange.levelCount = mipLevels - 1;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         static_cast<uint32_t>(barriers.size()),
+                         barriers.data());
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_context->convertPipeline);
+    vkCmdBindDescriptorSets(commandBuffer,
+                            VK_PIPELINE_BIND_POINT_COMPUTE,
+                            m_context->convertPipelineLayout,
+                            0,
+                            1,
+                            &descriptorSet,
+                            0,
+                            nullptr);
+    vkCmdPushConstants(commandBuffer,
+                       m_context->convertPipelineLayout,
+                       VK_SHADER_STAGE_COMPUTE_BIT,
+                       0,
+                       sizeof(constants),
+                       &constants);
+    vkCmdDispatch(commandBuffer,
+                  static_cast<uint32_t>(constants.width + 15) / 16,
+                  static_cast<uint32_t>(constants.height + 15) / 16,
+                  1);
+
+    // generateMipmapsCompute takes level 0 from TRANSFER_DST_OPTIMAL, as if it was copied
+    VkImageMemoryBarrier barrier = barriers[0];
+    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         1,
+                         &barrier);
+}
+
+void VulkanWindow::generateMipmapsCompute(VkImage image,
+                                          int32_t texWidth,
+                                          int32_t texHeight,
+                                          uint32_t mipLevels)
+{
+    TRACE_FUNCTION();
+
+    VkCommandBuffer commandBuffer = m_uploads->commandBuffer();
+
+    std::vector<VkImageView> levelViews(mipLevels);
+    for (uint32_t level = 0; level < mipLevels; level++) {
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+        viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        viewInfo.subresourceRange.baseMipLevel = level;
+        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.baseArrayLayer = 0;
+        viewInfo.subresourceRange.layerCount = 1;
+
+        if (vkCreateImageView(m_context->device, &viewInfo, nullptr, &levelViews[level])
+            != VK_SUCCESS) {
+            throw std::runtime_error("failed to create mip level view!");
+        }
+        m_uploads->releaseAfterUpload(levelViews[level]);
+    }
+
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    poolSize.descriptorCount = 3 * mipLevels;
+
+    VkDescriptorPoolCreateInfo poolInfo{};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = mipLevels;
+
+    VkDescriptorPool descriptorPool;
+    if (vkCreateDescriptorPool(m_context->device, &poolInfo, nullptr, &descriptorPool)
+        != VK_SUCCESS) {
+        throw std::runtime_error("failed to create mip descriptor pool!");
+    }
+    m_uploads->releaseAfterUpload(descriptorPool);
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.image = image;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mipLevels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         1,
+                         &barrier);
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, m_context->mipPipeline);
+
+    int32_t srcWidth = texWidth;
+    int32_t srcHeight = texHeight;
+    uint32_t level = 0;
+
+    while (level + 1 < mipLevels) {
+        const int32_t dstWidth = std::max(srcWidth / 2, 1);
+        const int32_t dstHeight = std::max(srcHeight / 2, 1);
+
+        // Two box levels fit in one dispatch only when the second one is an exact 2x2 reduction
+        const bool twoLevels = m_mipFilter == MipFilter::Box && level + 2 < mipLevels
+                               && srcWidth % 4 == 0 && srcHeight % 4 == 0;
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = descriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &m_context->mipDescriptorSetLayout;
+
+        VkDescriptorSet descriptorSet;
+        if (vkAllocateDescriptorSets(m_context->device, &allocInfo, &descriptorSet) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate mip descriptor set!");
+        }
+
+        std::array<VkDescriptorImageInfo, 3> imageInfos{};
+        imageInfos[0].imageView = levelViews[level];
+        imageInfos[1].imageView = levelViews[level + 1];
+        imageInfos[2].imageView = levelViews[twoLevels ? level + 2 : level + 1];
+
+        std::array<VkWriteDescriptorSet, 3> descriptorWrites{};
+        for (uint32_t i = 0; i < descriptorWrites.size(); i++) {
+            imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+            descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[i].dstSet = descriptorSet;
+            descriptorWrites[i].dstBinding = i;
+            descriptorWrites[i].dstArrayElement = 0;
+            descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            descriptorWrites[i].descriptorCount = 1;
+            descriptorWrites[i].pImageInfo = &imageInfos[i];
+        }
+
+        vkUpdateDescriptorSets(m_context->device,
+                               static_cast<uint32_t>(descriptorWrites.size()),
+                               descriptorWrites.data(),
+                               0,
+                               nullptr);
+
+        MipPushConstants constants{};
+        constants.srcWidth = srcWidth;
+        constants.srcHeight = srcHeight;
+        constants.dstWidth = dstWidth;
+        constants.dstHeight = dstHeight;
+        constants.filterType = static_cast<int32_t>(m_mipFilter);
+        constants.levelCount = twoLevels ? 2 : 1;
+
+        vkCmdBindDescriptorSets(commandBuffer,
+                                VK_PIPELINE_BIND_POINT_COMPUTE,
+                                m_context->mipPipelineLayout,
+                                0,
+                                1,
+                                &descriptorSet,
+                                0,
+                                nullptr);
+        vkCmdPushConstants(commandBuffer,
+                           m_context->mipPipelineLayout,
+                           VK_SHADER_STAGE_COMPUTE_BIT,
+                           0,
+                           sizeof(constants),
+                           &constants);
+        vkCmdDispatch(commandBuffer,
+                      static_cast<uint32_t>(dstWidth + 15) / 16,
+                      static_cast<uint32_t>(dstHeight + 15) / 16,
+                      1);
+
+        const uint32_t written = twoLevels ? 2 : 1;
+
+        // The levels just written are the source of the next dispatch
+        barrier.subresourceRange.baseMipLevel = level + 1;
+        barrier.subresourceRange.levelCount = written;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        vkCmdPipelineBarrier(commandBuffer,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                             0,
+                             0,
+                             nullptr,
+                             0,
+                             nullptr,
+                             1,
+                             &barrier);
+
+        for (uint32_t i = 0; i < written; i++) {
+            srcWidth = std::max(srcWidth / 2, 1);
+            srcHeight = std::max(srcHeight / 2, 1);
+        }
+        level += written;
+    }
+
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mipLevels;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         1,
+                         &barrier);
 }
 
-void VulkanWindow::imagePan(int32_t dY, int32_t dX)
+bool VulkanWindow::useTiledMode(const QString &imageName, uint32_t maxDimension) const
 {
-    auto viewportWidth = m_swapChainExtent.width;
-    auto viewportHeight = m_swapChainExtent.height;
-
-    m_offsetX += dX;
-    m_offsetY += dY;
+    const QByteArray tiled = qgetenv("VIV_TILED");
+    if (tiled == "0")
+        return false;
 
-    float normDx = (dX / (float) viewportWidth) * 2.0f;
-    float normDy = (dY / (float) viewportHeight) * 2.0f;
+    QImageReader reader(imageName);
+    const QSize size = reader.size();
+    if (!size.isValid())
+        return false;
 
-    m_normOffsetX += normDx;
-    m_normOffsetY += normDy;
+    const VkDeviceSize imageSize = VkDeviceSize(size.width()) * size.height() * 4;
 
-    if (m_zoomValueX <= 1 && m_zoomValueY <= 1) {
-        m_dynamicParameters.offsetX = 0;
-        m_dynamicParameters.offsetY = 0;
-        m_viewportOffset.x = m_offsetX;
-        m_viewportOffset.y = m_offsetY;
-    } else {
-        m_dynamicParameters.offsetX = m_normOffsetX;
-        m_dynamicParameters.offsetY = m_normOffsetY;
-        m_viewportOffset.x = 0;
-        m_viewportOffset.y = 0;
+    if (tiled == "1" || static_cast<uint32_t>(size.width()) > maxDimension
+        || static_cast<uint32_t>(size.height()) > maxDimension) {
+        return true;
     }
+
+    // Files that fit the device are only tiled for their size when tiles can be read from
+    // them, palettized and RLE BMPs are decoded whole instead
+    return imageSize > TILED_MODE_THRESHOLD && BmpReader(imageName).hasDirectPixels();
 }
 
-void VulkanWindow::onZoomToPixel(float cursorX, float cursorY, bool zoomIn)
+void VulkanWindow::createTiledTexture(const QString &imageName)
 {
-    auto viewportWidth = m_swapChainExtent.width;
-    auto viewportHeight = m_swapChainExtent.height;
-
-    float normCursorX = (cursorX / (float) viewportWidth) * 2.0f - 1.0f;
-    float normCursorY = (cursorY / (float) viewportHeight) * 2.0f - 1.0f;
-
-    // Map normalized window coordinates to image coordinates
-    float normImageCoordX = (normCursorX - m_normOffsetX) / m_zoomValueX;
-    float normImageCoordY = (normCursorY - m_normOffsetY) / m_zoomValueY;
-
-    int32_t imageCoordX = (cursorX - m_offsetX) / m_zoomValueX;
-    int32_t imageCoordY = (cursorY - m_offsetY) / m_zoomValueY;
+    TRACE_FUNCTION();
 
-    float zoomFactorX;
-    float zoomFactorY;
-    if (zoomIn) {
-        zoomFactorX = m_zoomValueX >= 1 ? 1 : 0.1;
-        zoomFactorY = m_zoomValueY >= 1 ? 1 : 0.1;
-    } else {
-        zoomFactorX = m_zoomValueX > 1 ? -1 : -0.1;
-        zoomFactorY = m_zoomValueY > 1 ? -1 : -0.1;
+    m_tileSource = std::make_unique<TileSource>(imageName, TILE_SIZE);
+    m_textureDecoder = "tiled";
+    if (!m_tileSource->isValid()) {
+        throw std::runtime_error("tiled mode needs an uncompressed 24 or 32 bit BMP!");
     }
-    float newScaleX = std::clamp(m_zoomValueX + zoomFactorX, 0.1f, 16.0f);
-    float newScaleY = std::clamp(m_zoomValueY + zoomFactorY, 0.1f, 16.0f);
-
-    m_offsetX = cursorX - (imageCoordX * newScaleX);
-    m_offsetY = cursorY - (imageCoordY * newScaleY);
-
-    m_normOffsetX = normCursorX - (normImageCoordX * newScaleX);
-    m_normOffsetY = normCursorY - (normImageCoordY * newScaleY);
 
-    if (newScaleX <= 1 && newScaleY <= 1) {
-        viewportWidth *= newScaleX;
-        viewportHeight *= newScaleY;
+    m_tiledMode = true;
+    m_texWidth = m_tileSource->width();
+    m_texHeight = m_tileSource->height();
+    m_mipLevels = 1;
 
-        m_dynamicParameters.offsetX = 0;
-        m_dynamicParameters.offsetY = 0;
-        m_dynamicParameters.scaleX = 1;
-        m_dynamicParameters.scaleY = 1;
+    auto b = viewExtent();
+    initializeScaling(m_texWidth, m_texHeight, b.width, b.height);
 
-        m_viewportOffset.x = m_offsetX;
-        m_viewportOffset.y = m_offsetY;
-    } else {
-        // Adjust the offsets to focus zoom on the cursor position
-        m_dynamicParameters.offsetX = m_normOffsetX;
-        m_dynamicParameters.offsetY = m_normOffsetY;
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(m_context->physicalDevice, &properties);
 
-        // Apply the updated scale and offsets
-        m_dynamicParameters.scaleX = newScaleX;
-        m_dynamicParameters.scaleY = newScaleY;
-        viewportWidth = std::min<uint32_t>(m_swapChainExtent.width, viewportWidth * newScaleX);
-        viewportHeight = std::min<uint32_t>(m_swapChainExtent.height, viewportWidth * newScaleY);
+    // The texture is a fixed-size atlas of tile slots, whatever the image size
+    m_tileAtlasSize = std::min<uint32_t>(4096, properties.limits.maxImageDimension2D);
+    const uint32_t tilesPerRow = m_tileAtlasSize / TILE_SIZE;
 
-        m_viewportOffset.x = 0;
-        m_viewportOffset.y = 0;
-    }
-    m_zoomValueX = newScaleX;
-    m_zoomValueY = newScaleY;
+    createImage(m_tileAtlasSize,
+                m_tileAtlasSize,
+                1,
+                VK_FORMAT_R8G8B8A8_SRGB,
+                VK_IMAGE_TILING_OPTIMAL,
+                VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                m_textureImage,
+                m_textureImageMemory);
 
-    m_viewport.width = viewportWidth;
-    m_viewport.height = viewportHeight;
+    transitionImageLayout(m_textureImage,
+                          VK_FORMAT_R8G8B8A8_SRGB,
+                          VK_IMAGE_LAYOUT_UNDEFINED,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          1);
+    transitionImageLayout(m_textureImage,
+                          VK_FORMAT_R8G8B8A8_SRGB,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                          1);
+
+    createTileBuffers();
+
+    m_tileCache = std::make_unique<TileCache>(tilesPerRow * tilesPerRow);
+    m_tileLoader = std::make_unique<TileLoader>(*m_tileSource,
+                                                MAX_TILE_UPLOADS_PER_FRAME * 2,
+                                                [this] {
+                                                    QMetaObject::invokeMethod(
+                                                        this,
+                                                        [this] { scheduleRedraw(false); },
+                                                        Qt::QueuedConnection);
+                                                });
 }
 
-void VulkanWindow::createTextureImage(const QString &imageName)
+void VulkanWindow::createTileBuffers()
 {
-    QImage img(imageName);
-    QImage img2 = img.convertToFormat(QImage::Format_RGBA8888);
-    auto pixels = img2.bits();
-    m_texWidth = img2.width();
-    m_texHeight = img2.height();
+    VkDeviceSize stagingSize = VkDeviceSize(MAX_TILE_UPLOADS_PER_FRAME) * TILE_SIZE * TILE_SIZE * 4;
 
-    m_mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(m_texWidth, m_texHeight))))
-                  + 1;
+    m_tileStagingBuffers.resize(TILE_STAGING_BUFFERS);
+    m_tileStagingBuffersMemory.resize(TILE_STAGING_BUFFERS);
+    m_tileStagingSerials.assign(TILE_STAGING_BUFFERS, 0);
+    m_tileStagingIndex = 0;
 
-    auto b = m_swapChainExtent;
-    initializeScaling(m_texWidth, m_texHeight, b.width, b.height);
+    for (uint32_t i = 0; i < TILE_STAGING_BUFFERS; i++) {
+        createBuffer(stagingSize,
+                     VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     m_tileStagingBuffers[i],
+                     m_tileStagingBuffersMemory[i]);
+    }
 
-    VkDeviceSize imageSize = m_texWidth * m_texHeight * 4;
+    VkDeviceSize vertexBufferSize = sizeof(Vertex) * 4 * MAX_TILE_QUADS;
 
-    if (!pixels) {
-        throw std::runtime_error("failed to load texture image!");
+    m_tileVertexBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    m_tileVertexBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        createBuffer(vertexBufferSize,
+                     VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                     m_tileVertexBuffers[i],
+                     m_tileVertexBuffersMemory[i]);
+    }
+
+    std::vector<uint16_t> tileIndices;
+    tileIndices.reserve(MAX_TILE_QUADS * indices.size());
+    for (uint32_t quad = 0; quad < MAX_TILE_QUADS; quad++) {
+        for (uint16_t index : indices) {
+            tileIndices.push_back(static_cast<uint16_t>(quad * 4 + index));
+        }
     }
 
+    VkDeviceSize indexBufferSize = sizeof(tileIndices[0]) * tileIndices.size();
+
     VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-    createBuffer(imageSize,
+    DeviceAllocation stagingBufferMemory;
+    createBuffer(indexBufferSize,
                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                  stagingBuffer,
                  stagingBufferMemory);
 
-    void *data;
-    vkMapMemory(m_device, stagingBufferMemory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(m_device, stagingBufferMemory);
+    memcpy(stagingBufferMemory.mapped, tileIndices.data(), (size_t) indexBufferSize);
 
-    createImage(m_texWidth,
-                m_texHeight,
-                m_mipLevels,
-                VK_FORMAT_R8G8B8A8_SRGB,
-                VK_IMAGE_TILING_OPTIMAL,
-                VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT
-                    | VK_IMAGE_USAGE_SAMPLED_BIT,
-                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                m_textureImage,
-                m_textureImageMemory);
+    createBuffer(indexBufferSize,
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                 m_tileIndexBuffer,
+                 m_tileIndexBufferMemory);
 
-    transitionImageLayout(m_textureImage,
-                          VK_FORMAT_R8G8B8A8_SRGB,
-                          VK_IMAGE_LAYOUT_UNDEFINED,
-                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                          m_mipLevels);
-    copyBufferToImage(stagingBuffer,
-                      m_textureImage,
-                      static_cast<uint32_t>(m_texWidth),
-                      static_cast<uint32_t>(m_texHeight));
+    copyBuffer(stagingBuffer, m_tileIndexBuffer, indexBufferSize);
+
+    m_uploads->releaseAfterUpload(stagingBuffer, stagingBufferMemory);
+}
+
+void VulkanWindow::updateTiles()
+{
+    TRACE_FUNCTION();
+
+    m_tileFrame++;
+
+    auto visible = visibleTiles();
+    for (const auto &key : visible) {
+        m_tileCache->touch(key, m_tileFrame);
+    }
+
+    uploadLoadedTiles();
+    buildTileGeometry(visible);
+
+    // The coarsest level is always resident so there is something to fall back to
+    std::vector<TileKey> missing;
+    const uint32_t topLevel = m_tileSource->levelCount() - 1;
+    for (uint32_t y = 0; y < m_tileSource->tilesY(topLevel); y++) {
+        for (uint32_t x = 0; x < m_tileSource->tilesX(topLevel); x++) {
+            TileKey key{topLevel, x, y};
+            if (m_tileCache->find(key) < 0)
+                missing.push_back(key);
+        }
+    }
+    const auto firstVisible = missing.size();
+
+    float centerX = 0;
+    float centerY = 0;
+    for (const auto &key : visible) {
+        centerX += key.x;
+        centerY += key.y;
+        if (m_tileCache->find(key) < 0)
+            missing.push_back(key);
+    }
 
-    vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-    vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+    if (!visible.empty()) {
+        centerX /= visible.size();
+        centerY /= visible.size();
+        auto distance = [centerX, centerY](const TileKey &key) {
+            return std::abs(key.x - centerX) + std::abs(key.y - centerY);
+        };
+        std::stable_sort(missing.begin() + firstVisible,
+                         missing.end(),
+                         [&distance](const TileKey &a, const TileKey &b) {
+                             return distance(a) < distance(b);
+                         });
+    }
 
-    generateMipmaps(m_textureImage, VK_FORMAT_R8G8B8A8_SRGB, m_texWidth, m_texHeight, m_mipLevels);
+    m_tileLoader->request(missing);
 }
 
-void VulkanWindow::generateMipmaps(
-    VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
+std::vector<TileKey> VulkanWindow::visibleTiles()
 {
-    // Check if image format supports linear blitting
-    VkFormatProperties formatProperties;
-    vkGetPhysicalDeviceFormatProperties(m_physicalDevice, imageFormat, &formatProperties);
+    std::vector<TileKey> keys;
+    if (m_viewport.width == 0 || m_viewport.height == 0)
+        return keys;
+
+    const auto &p = m_dynamicParameters;
+    const float viewportWidth = static_cast<float>(m_viewport.width);
+    const float viewportHeight = static_cast<float>(m_viewport.height);
+    const float imageWidth = static_cast<float>(m_texWidth);
+    const float imageHeight = static_cast<float>(m_texHeight);
+
+    // Inverse of the viewport mapping followed by the vertex shader transform
+    auto toImageX = [&](float screenX) {
+        float ndc = (screenX - m_viewportOffset.x) / viewportWidth * 2.0f - 1.0f;
+        return ((ndc - p.offsetX) / p.scaleX + 1.0f) * 0.5f * imageWidth;
+    };
+    auto toImageY = [&](float screenY) {
+        float ndc = (screenY - m_viewportOffset.y) / viewportHeight * 2.0f - 1.0f;
+        return ((ndc - p.offsetY) / p.scaleY + 1.0f) * 0.5f * imageHeight;
+    };
 
-    if (!(formatProperties.optimalTilingFeatures
-          & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT)) {
-        throw std::runtime_error("texture image format does not support linear blitting!");
+    const float left = std::clamp(toImageX(0), 0.0f, imageWidth);
+    const float right = std::clamp(toImageX(m_swapChainExtent.width), 0.0f, imageWidth);
+    const float top = std::clamp(toImageY(0), 0.0f, imageHeight);
+    const float bottom = std::clamp(toImageY(m_swapChainExtent.height), 0.0f, imageHeight);
+
+    if (right <= left || bottom <= top)
+        return keys;
+
+    const float texelsPerPixel = std::min(imageWidth / (viewportWidth * p.scaleX),
+                                          imageHeight / (viewportHeight * p.scaleY));
+    uint32_t level = texelsPerPixel > 1.0f
+                         ? static_cast<uint32_t>(std::floor(std::log2(texelsPerPixel)))
+                         : 0;
+    level = std::min(level, m_tileSource->levelCount() - 1);
+
+    const uint32_t tilesPerRow = m_tileAtlasSize / TILE_SIZE;
+    const uint32_t maxVisible = std::min(MAX_TILE_QUADS, tilesPerRow * tilesPerRow / 2);
+
+    while (true) {
+        const float span = static_cast<float>(static_cast<uint64_t>(TILE_SIZE) << level);
+        const uint32_t x0 = static_cast<uint32_t>(left / span);
+        const uint32_t y0 = static_cast<uint32_t>(top / span);
+        const uint32_t x1 = std::min(m_tileSource->tilesX(level) - 1,
+                                     static_cast<uint32_t>(std::ceil(right / span)) - 1);
+        const uint32_t y1 = std::min(m_tileSource->tilesY(level) - 1,
+                                     static_cast<uint32_t>(std::ceil(bottom / span)) - 1);
+
+        // Drop to a coarser level rather than thrash the atlas on huge windows
+        if ((x1 - x0 + 1) * (y1 - y0 + 1) > maxVisible && level + 1 < m_tileSource->levelCount()) {
+            level++;
+            continue;
+        }
+
+        for (uint32_t y = y0; y <= y1; y++) {
+            for (uint32_t x = x0; x <= x1; x++) {
+                keys.push_back({level, x, y});
+            }
+        }
+        return keys;
+    }
+}
+
+void VulkanWindow::uploadLoadedTiles()
+{
+    TRACE_FUNCTION();
+
+    // Never wait for the GPU here, while both staging buffers are still being copied from
+    // the loaded tiles stay queued until a later frame
+    retireUploads(false);
+    const uint32_t staging = m_tileStagingIndex;
+    if (m_tileStagingSerials[staging] > m_uploads->completedSerial()) {
+        scheduleRedraw(false);
+        return;
+    }
+
+    auto tiles = m_tileLoader->takeCompleted(MAX_TILE_UPLOADS_PER_FRAME);
+    if (tiles.empty())
+        return;
+
+    // Loader notifications are coalesced, so a full batch may leave more tiles waiting
+    if (tiles.size() == MAX_TILE_UPLOADS_PER_FRAME)
+        scheduleRedraw(false);
+
+    const uint32_t tilesPerRow = m_tileAtlasSize / TILE_SIZE;
+    const VkDeviceSize tileSize = VkDeviceSize(TILE_SIZE) * TILE_SIZE * 4;
+    const uint32_t topLevel = m_tileSource->levelCount() - 1;
+
+    std::vector<VkBufferImageCopy> regions;
+    for (const auto &tile : tiles) {
+        int32_t slot = m_tileCache->insert(tile.key, m_tileFrame);
+        if (slot < 0)
+            continue;
+
+        if (tile.key.level == topLevel)
+            m_tileCache->pin(tile.key);
+
+        VkDeviceSize offset = regions.size() * tileSize;
+        memcpy(static_cast<char *>(m_tileStagingBuffersMemory[staging].mapped) + offset,
+               tile.pixels.data(),
+               static_cast<size_t>(tileSize));
+
+        VkBufferImageCopy region{};
+        region.bufferOffset = offset;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {static_cast<int32_t>((slot % tilesPerRow) * TILE_SIZE),
+                              static_cast<int32_t>((slot / tilesPerRow) * TILE_SIZE),
+                              0};
+        region.imageExtent = {TILE_SIZE, TILE_SIZE, 1};
+        regions.push_back(region);
     }
 
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    if (regions.empty())
+        return;
+
+    VkCommandBuffer commandBuffer = m_uploads->commandBuffer();
 
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-    barrier.image = image;
     barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
     barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = m_textureImage;
     barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
     barrier.subresourceRange.baseArrayLayer = 0;
     barrier.subresourceRange.layerCount = 1;
-    barrier.subresourceRange.levelCount = 1;
-
-    int32_t mipWidth = texWidth;
-    int32_t mipHeight = texHeight;
-
-    for (uint32_t i = 1; i < mipLevels; i++) {
-        barrier.subresourceRange.baseMipLevel = i - 1;
-        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-
-        vkCmdPipelineBarrier(commandBuffer,
-                             VK_PIPELINE_STAGE_TRANSFER_BIT,
-                             VK_PIPELINE_STAGE_TRANSFER_BIT,
-                             0,
-                             0,
-                             nullptr,
-                             0,
-                             nullptr,
-                             1,
-                             &barrier);
 
-        VkImageBlit blit{};
-        blit.srcOffsets[0] = {0, 0, 0};
-        blit.srcOffsets[1] = {mipWidth, mipHeight, 1};
-        blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        blit.srcSubresource.mipLevel = i - 1;
-        blit.srcSubresource.baseArrayLayer = 0;
-        blit.srcSubresource.layerCount = 1;
-        blit.dstOffsets[0] = {0, 0, 0};
-        blit.dstOffsets[1] = {mipWidth > 1 ? mipWidth / 2 : 1, mipHeight > 1 ? mipHeight / 2 : 1, 1};
-        blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        blit.dstSubresource.mipLevel = i;
-        blit.dstSubresource.baseArrayLayer = 0;
-        blit.dstSubresource.layerCount = 1;
-
-        vkCmdBlitImage(commandBuffer,
-                       image,
-                       VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
-                       image,
-                       VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                       1,
-                       &blit,
-                       VK_FILTER_LINEAR);
-
-        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    // Frames still in flight may be sampling slots that are about to be overwritten
+    barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
 
-        vkCmdPipelineBarrier(commandBuffer,
-                             VK_PIPELINE_STAGE_TRANSFER_BIT,
-                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                             0,
-                             0,
-                             nullptr,
-                             0,
-                             nullptr,
-                             1,
-                             &barrier);
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         1,
+                         &barrier);
 
-        if (mipWidth > 1)
-            mipWidth /= 2;
-        if (mipHeight > 1)
-            mipHeight /= 2;
-    }
+    vkCmdCopyBufferToImage(commandBuffer,
+                           m_tileStagingBuffers[staging],
+                           m_textureImage,
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           static_cast<uint32_t>(regions.size()),
+                           regions.data());
 
-    barrier.subresourceRange.baseMipLevel = mipLevels - 1;
     barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
     barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
     barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
@@ -974,18 +3377,84 @@ void VulkanWindow::generateMipmaps(
                          1,
                          &barrier);
 
-    endSingleTimeCommands(commandBuffer);
+    m_tileStagingSerials[staging] = m_uploads->submit();
+    m_tileStagingIndex = (staging + 1) % TILE_STAGING_BUFFERS;
+}
+
+void VulkanWindow::buildTileGeometry(const std::vector<TileKey> &visible)
+{
+    const uint32_t tilesPerRow = m_tileAtlasSize / TILE_SIZE;
+    const float atlasSize = static_cast<float>(m_tileAtlasSize);
+    const float imageWidth = static_cast<float>(m_texWidth);
+    const float imageHeight = static_cast<float>(m_texHeight);
+
+    auto *vertex = static_cast<Vertex *>(m_tileVertexBuffersMemory[m_currentFrame].mapped);
+    uint32_t quadCount = 0;
+
+    for (const auto &key : visible) {
+        if (quadCount == MAX_TILE_QUADS)
+            break;
+
+        // Until a tile streams in, draw its part of the closest resident ancestor
+        TileKey resident = key;
+        int32_t slot = m_tileCache->find(resident);
+        while (slot < 0 && resident.level + 1 < m_tileSource->levelCount()) {
+            resident = {resident.level + 1, resident.x / 2, resident.y / 2};
+            slot = m_tileCache->find(resident);
+        }
+        if (slot < 0)
+            continue;
+
+        m_tileCache->touch(resident, m_tileFrame);
+
+        const float span = static_cast<float>(static_cast<uint64_t>(TILE_SIZE) << key.level);
+        const float x0 = key.x * span;
+        const float y0 = key.y * span;
+        const float x1 = std::min(x0 + span, imageWidth);
+        const float y1 = std::min(y0 + span, imageHeight);
+
+        const float residentSpan = static_cast<float>(static_cast<uint64_t>(TILE_SIZE)
+                                                      << resident.level);
+        const float originX = resident.x * residentSpan;
+        const float originY = resident.y * residentSpan;
+        const float texelScale = TILE_SIZE / residentSpan;
+        const float slotX = static_cast<float>((slot % tilesPerRow) * TILE_SIZE);
+        const float slotY = static_cast<float>((slot / tilesPerRow) * TILE_SIZE);
+
+        const float u0 = (slotX + (x0 - originX) * texelScale) / atlasSize;
+        const float u1 = (slotX + (x1 - originX) * texelScale) / atlasSize;
+        const float v0 = (slotY + (y0 - originY) * texelScale) / atlasSize;
+        const float v1 = (slotY + (y1 - originY) * texelScale) / atlasSize;
+
+        const float px0 = x0 / imageWidth * 2.0f - 1.0f;
+        const float px1 = x1 / imageWidth * 2.0f - 1.0f;
+        const float py0 = y0 / imageHeight * 2.0f - 1.0f;
+        const float py1 = y1 / imageHeight * 2.0f - 1.0f;
+
+        vertex[0] = {{px0, py0}, {u0, v0}};
+        vertex[1] = {{px1, py0}, {u1, v0}};
+        vertex[2] = {{px1, py1}, {u1, v1}};
+        vertex[3] = {{px0, py1}, {u0, v1}};
+        vertex += 4;
+        quadCount++;
+    }
+
+    m_tileIndexCount = quadCount * static_cast<uint32_t>(indices.size());
 }
 
 void VulkanWindow::createTextureImageView()
 {
-    m_textureImageView = createImageView(m_textureImage, VK_FORMAT_R8G8B8A8_SRGB, m_mipLevels);
+    TRACE_FUNCTION();
+
+    m_textureImageView = createImageView(m_textureImage, m_textureFormat, m_mipLevels);
 }
 
 void VulkanWindow::createTextureSampler()
 {
+    TRACE_FUNCTION();
+
     VkPhysicalDeviceProperties properties{};
-    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+    vkGetPhysicalDeviceProperties(m_context->physicalDevice, &properties);
 
     VkSamplerCreateInfo samplerInfo{};
     samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
@@ -1001,10 +3470,12 @@ void VulkanWindow::createTextureSampler()
     samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
     samplerInfo.minLod = 0;
-    samplerInfo.maxLod = static_cast<float>(m_mipLevels);
+    // Shared by every browsed texture, their views limit the levels
+    samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
     samplerInfo.mipLodBias = 0;
 
-    if (vkCreateSampler(m_device, &samplerInfo, nullptr, &m_textureSampler) != VK_SUCCESS) {
+    if (vkCreateSampler(m_context->device, &samplerInfo, nullptr, &m_context->textureSampler)
+        != VK_SUCCESS) {
         throw std::runtime_error("failed to create texture sampler!");
     }
 }
@@ -1023,7 +3494,7 @@ VkImageView VulkanWindow::createImageView(VkImage image, VkFormat format, uint32
     viewInfo.subresourceRange.layerCount = 1;
 
     VkImageView imageView;
-    if (vkCreateImageView(m_device, &viewInfo, nullptr, &imageView) != VK_SUCCESS) {
+    if (vkCreateImageView(m_context->device, &viewInfo, nullptr, &imageView) != VK_SUCCESS) {
         throw std::runtime_error("failed to create texture image view!");
     }
 
@@ -1038,10 +3509,12 @@ void VulkanWindow::createImage(uint32_t width,
                                VkImageUsageFlags usage,
                                VkMemoryPropertyFlags properties,
                                VkImage &image,
-                               VkDeviceMemory &imageMemory)
+                               DeviceAllocation &imageMemory,
+                               VkImageCreateFlags flags)
 {
     VkImageCreateInfo imageInfo{};
     imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.flags = flags;
     imageInfo.imageType = VK_IMAGE_TYPE_2D;
     imageInfo.extent.width = width;
     imageInfo.extent.height = height;
@@ -1055,23 +3528,19 @@ void VulkanWindow::createImage(uint32_t width,
     imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
     imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    if (vkCreateImage(m_device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
+    if (vkCreateImage(m_context->device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
         throw std::runtime_error("failed to create image!");
     }
 
     VkMemoryRequirements memRequirements;
-    vkGetImageMemoryRequirements(m_device, image, &memRequirements);
+    vkGetImageMemoryRequirements(m_context->device, image, &memRequirements);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+    const uint32_t memoryType = findMemoryType(memRequirements.memoryTypeBits, properties);
+    imageMemory = m_context->allocator->allocate(memRequirements,
+                                                 memoryType,
+                                                 tiling == VK_IMAGE_TILING_LINEAR);
 
-    if (vkAllocateMemory(m_device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate image memory!");
-    }
-
-    vkBindImageMemory(m_device, image, imageMemory, 0);
+    vkBindImageMemory(m_context->device, image, imageMemory.memory, imageMemory.offset);
 }
 
 void VulkanWindow::transitionImageLayout(VkImage image,
@@ -1080,7 +3549,7 @@ void VulkanWindow::transitionImageLayout(VkImage image,
                                          VkImageLayout newLayout,
                                          uint32_t mipLevels)
 {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    VkCommandBuffer commandBuffer = m_uploads->commandBuffer();
 
     VkImageMemoryBarrier barrier{};
     barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1118,51 +3587,119 @@ void VulkanWindow::transitionImageLayout(VkImage image,
 
     vkCmdPipelineBarrier(
         commandBuffer, sourceStage, destinationStage, 0, 0, nullptr, 0, nullptr, 1, &barrier);
-
-    endSingleTimeCommands(commandBuffer);
 }
 
-void VulkanWindow::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
+void VulkanWindow::copyBufferToImage(VkCommandBuffer commandBuffer,
+                                     VkBuffer buffer,
+                                     VkImage image,
+                                     const std::vector<MipLevel> &levels)
 {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
-
-    VkBufferImageCopy region{};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-    region.imageOffset = {0, 0, 0};
-    region.imageExtent = {width, height, 1};
+    std::vector<VkBufferImageCopy> regions(levels.size());
+    for (size_t i = 0; i < levels.size(); i++) {
+        VkBufferImageCopy &region = regions[i];
+        region.bufferOffset = levels[i].offset;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = static_cast<uint32_t>(i);
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = {0, 0, 0};
+        region.imageExtent = {levels[i].width, levels[i].height, 1};
+    }
 
     vkCmdCopyBufferToImage(commandBuffer,
                            buffer,
                            image,
                            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                           1,
-                           &region);
+                           static_cast<uint32_t>(regions.size()),
+                           regions.data());
+}
+
+void VulkanWindow::copyToImageOnTransferQueue(VkBuffer buffer,
+                                              VkImage image,
+                                              const std::vector<MipLevel> &levels,
+                                              uint32_t mipLevels)
+{
+    VkCommandBuffer transfer = m_uploads->transferCommandBuffer();
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = mipLevels;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(transfer,
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         1,
+                         &barrier);
+
+    copyBufferToImage(transfer, buffer, image, levels);
+
+    // Release on the transfer queue, then the matching acquire on the graphics queue
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = m_context->transferFamily;
+    barrier.dstQueueFamilyIndex = m_context->graphicsFamily;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+
+    vkCmdPipelineBarrier(transfer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         1,
+                         &barrier);
 
-    endSingleTimeCommands(commandBuffer);
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+    vkCmdPipelineBarrier(m_uploads->commandBuffer(),
+                         VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         1,
+                         &barrier);
 }
 
 void VulkanWindow::createVertexBuffer()
 {
+    TRACE_FUNCTION();
+
     VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
 
     VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
+    DeviceAllocation stagingBufferMemory;
     createBuffer(bufferSize,
                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                  stagingBuffer,
                  stagingBufferMemory);
 
-    void *data;
-    vkMapMemory(m_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, vertices.data(), (size_t) bufferSize);
-    vkUnmapMemory(m_device, stagingBufferMemory);
+    memcpy(stagingBufferMemory.mapped, vertices.data(), (size_t) bufferSize);
 
     createBuffer(bufferSize,
                  VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
@@ -1172,26 +3709,24 @@ void VulkanWindow::createVertexBuffer()
 
     copyBuffer(stagingBuffer, m_vertexBuffer, bufferSize);
 
-    vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-    vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+    m_uploads->releaseAfterUpload(stagingBuffer, stagingBufferMemory);
 }
 
 void VulkanWindow::createIndexBuffer()
 {
+    TRACE_FUNCTION();
+
     VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
 
     VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
+    DeviceAllocation stagingBufferMemory;
     createBuffer(bufferSize,
                  VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
                  VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
                  stagingBuffer,
                  stagingBufferMemory);
 
-    void *data;
-    vkMapMemory(m_device, stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, indices.data(), (size_t) bufferSize);
-    vkUnmapMemory(m_device, stagingBufferMemory);
+    memcpy(stagingBufferMemory.mapped, indices.data(), (size_t) bufferSize);
 
     createBuffer(bufferSize,
                  VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
@@ -1201,109 +3736,79 @@ void VulkanWindow::createIndexBuffer()
 
     copyBuffer(stagingBuffer, m_indexBuffer, bufferSize);
 
-    vkDestroyBuffer(m_device, stagingBuffer, nullptr);
-    vkFreeMemory(m_device, stagingBufferMemory, nullptr);
+    m_uploads->releaseAfterUpload(stagingBuffer, stagingBufferMemory);
 }
 
-void VulkanWindow::createUniformBuffers()
+void VulkanWindow::createDescriptorPool()
 {
-    VkDeviceSize bufferSize = sizeof(UniformBufferObject);
+    TRACE_FUNCTION();
 
-    m_uniformBuffers.resize(MAX_FRAMES_IN_FLIGHT);
-    m_uniformBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
-    m_uniformBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+    m_descriptorPool = createTextureDescriptorPool();
+}
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        createBuffer(bufferSize,
-                     VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-                     m_uniformBuffers[i],
-                     m_uniformBuffersMemory[i]);
+void VulkanWindow::createDescriptorSets()
+{
+    TRACE_FUNCTION();
 
-        vkMapMemory(m_device,
-                    m_uniformBuffersMemory[i],
-                    0,
-                    bufferSize,
-                    0,
-                    &m_uniformBuffersMapped[i]);
-    }
+    m_descriptorSet = createTextureDescriptorSet(m_descriptorPool, m_textureImageView);
 }
 
-void VulkanWindow::createDescriptorPool()
+VkDescriptorPool VulkanWindow::createTextureDescriptorPool()
 {
-    std::array<VkDescriptorPoolSize, 2> poolSizes{};
-    poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-    poolSizes[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    VkDescriptorPoolSize poolSize{};
+    poolSize.type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    poolSize.descriptorCount = 1;
 
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-    poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
-    poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = 1;
 
-    if (vkCreateDescriptorPool(m_device, &poolInfo, nullptr, &m_descriptorPool) != VK_SUCCESS) {
+    VkDescriptorPool pool;
+    if (vkCreateDescriptorPool(m_context->device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
         throw std::runtime_error("failed to create descriptor pool!");
     }
+    return pool;
 }
 
-void VulkanWindow::createDescriptorSets()
+VkDescriptorSet VulkanWindow::createTextureDescriptorSet(VkDescriptorPool pool,
+                                                         VkImageView imageView)
 {
-    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, m_descriptorSetLayout);
     VkDescriptorSetAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
-    allocInfo.descriptorPool = m_descriptorPool;
-    allocInfo.descriptorSetCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
-    allocInfo.pSetLayouts = layouts.data();
+    allocInfo.descriptorPool = pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &m_context->descriptorSetLayout;
 
-    m_descriptorSets.resize(MAX_FRAMES_IN_FLIGHT);
-    if (vkAllocateDescriptorSets(m_device, &allocInfo, m_descriptorSets.data()) != VK_SUCCESS) {
+    VkDescriptorSet descriptorSet;
+    if (vkAllocateDescriptorSets(m_context->device, &allocInfo, &descriptorSet) != VK_SUCCESS) {
         throw std::runtime_error("failed to allocate descriptor sets!");
     }
 
-    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        VkDescriptorBufferInfo bufferInfo{};
-        bufferInfo.buffer = m_uniformBuffers[i];
-        bufferInfo.offset = 0;
-        bufferInfo.range = sizeof(UniformBufferObject);
-
-        VkDescriptorImageInfo imageInfo{};
-        imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-        imageInfo.imageView = m_textureImageView;
-        imageInfo.sampler = m_textureSampler;
-
-        std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
-
-        descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[0].dstSet = m_descriptorSets[i];
-        descriptorWrites[0].dstBinding = 0;
-        descriptorWrites[0].dstArrayElement = 0;
-        descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-        descriptorWrites[0].descriptorCount = 1;
-        descriptorWrites[0].pBufferInfo = &bufferInfo;
-
-        descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-        descriptorWrites[1].dstSet = m_descriptorSets[i];
-        descriptorWrites[1].dstBinding = 1;
-        descriptorWrites[1].dstArrayElement = 0;
-        descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        descriptorWrites[1].descriptorCount = 1;
-        descriptorWrites[1].pImageInfo = &imageInfo;
-
-        vkUpdateDescriptorSets(m_device,
-                               static_cast<uint32_t>(descriptorWrites.size()),
-                               descriptorWrites.data(),
-                               0,
-                               nullptr);
-    }
+    VkDescriptorImageInfo imageInfo{};
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    imageInfo.imageView = imageView;
+    imageInfo.sampler = m_context->textureSampler;
+
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = descriptorSet;
+    descriptorWrite.dstBinding = 1;
+    descriptorWrite.dstArrayElement = 0;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pImageInfo = &imageInfo;
+
+    vkUpdateDescriptorSets(m_context->device, 1, &descriptorWrite, 0, nullptr);
+    return descriptorSet;
 }
 
 void VulkanWindow::createBuffer(VkDeviceSize size,
                                 VkBufferUsageFlags usage,
                                 VkMemoryPropertyFlags properties,
                                 VkBuffer &buffer,
-                                VkDeviceMemory &bufferMemory)
+                                DeviceAllocation &bufferMemory)
 {
     VkBufferCreateInfo bufferInfo{};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -1311,75 +3816,236 @@ void VulkanWindow::createBuffer(VkDeviceSize size,
     bufferInfo.usage = usage;
     bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    if (vkCreateBuffer(m_device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+    if (vkCreateBuffer(m_context->device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
         throw std::runtime_error("failed to create buffer!");
     }
 
     VkMemoryRequirements memRequirements;
-    vkGetBufferMemoryRequirements(m_device, buffer, &memRequirements);
+    vkGetBufferMemoryRequirements(m_context->device, buffer, &memRequirements);
+
+    const uint32_t memoryType = findMemoryType(memRequirements.memoryTypeBits, properties);
+    bufferMemory = m_context->allocator->allocate(memRequirements, memoryType, true);
 
-    VkMemoryAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+    vkBindBufferMemory(m_context->device, buffer, bufferMemory.memory, bufferMemory.offset);
+}
 
-    if (vkAllocateMemory(m_device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-        throw std::runtime_error("failed to allocate buffer memory!");
+void VulkanWindow::retireUploads(bool wait)
+{
+    const UploadQueue::MipTiming mips = m_uploads->retire(wait);
+    if (mips.textures > 0 && m_gpuProfiler->isEnabled()) {
+        qDebug() << "mip generation:" << gpuStats(GpuScope::MipGeneration).lastMs << "ms for"
+                 << mips.textures << "textures, levels:" << mips.levels << "filter:" << mips.filter;
     }
 
-    vkBindBufferMemory(m_device, buffer, bufferMemory, 0);
+    retireTextureCacheWrites(wait);
 }
 
-VkCommandBuffer VulkanWindow::beginSingleTimeCommands()
+void VulkanWindow::storeInTextureCache(const QString &key,
+                                       VkBuffer buffer,
+                                       DeviceAllocation &memory,
+                                       const std::vector<MipLevel> &levels,
+                                       uint32_t blockBytes)
 {
-    VkCommandBufferAllocateInfo allocInfo{};
-    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = m_commandPool;
-    allocInfo.commandBufferCount = 1;
+    PendingCacheWrite pending;
+    pending.serial = m_uploads->nextSerial();
+    pending.key = key;
+    pending.width = levels[0].width;
+    pending.height = levels[0].height;
+    pending.levelCount = static_cast<uint32_t>(levels.size());
+    pending.size = mipChainSize(levels);
+    pending.blockBytes = blockBytes;
+    pending.staging = {buffer, memory};
+    m_pendingCacheWrites.push_back(std::move(pending));
+    memory = DeviceAllocation{};
+}
 
-    VkCommandBuffer commandBuffer;
-    vkAllocateCommandBuffers(m_device, &allocInfo, &commandBuffer);
+void VulkanWindow::readBackForTextureCache(const QString &key,
+                                           VkImage image,
+                                           const std::vector<MipLevel> &levels)
+{
+    VkBuffer buffer;
+    DeviceAllocation memory;
+    createBuffer(mipChainSize(levels),
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 buffer,
+                 memory);
 
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    VkCommandBuffer commandBuffer = m_uploads->commandBuffer();
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = static_cast<uint32_t>(levels.size());
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+    // Chains onto the barriers that left the levels readable by the fragment shader
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr,
+                         1,
+                         &barrier);
+
+    std::vector<VkBufferImageCopy> regions(levels.size());
+    for (size_t i = 0; i < levels.size(); i++) {
+        VkBufferImageCopy &region = regions[i];
+        region.bufferOffset = levels[i].offset;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = static_cast<uint32_t>(i);
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = {levels[i].width, levels[i].height, 1};
+    }
+    vkCmdCopyImageToBuffer(commandBuffer,
+                           image,
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           buffer,
+                           static_cast<uint32_t>(regions.size()),
+                           regions.data());
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    VkBufferMemoryBarrier hostBarrier{};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.buffer = buffer;
+    hostBarrier.offset = 0;
+    hostBarrier.size = VK_WHOLE_SIZE;
 
-    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    vkCmdPipelineBarrier(commandBuffer,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_HOST_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         1,
+                         &hostBarrier,
+                         1,
+                         &barrier);
 
-    return commandBuffer;
+    storeInTextureCache(key, buffer, memory, levels, 0);
 }
 
-void VulkanWindow::endSingleTimeCommands(VkCommandBuffer commandBuffer)
+void VulkanWindow::retireTextureCacheWrites(bool wait)
 {
-    vkEndCommandBuffer(commandBuffer);
+    for (auto it = m_pendingCacheWrites.begin(); it != m_pendingCacheWrites.end();) {
+        if (!it->write.valid()) {
+            if (it->serial > m_uploads->completedSerial()) {
+                ++it;
+                continue;
+            }
 
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffer;
+            // Writing hundreds of megabytes would stall the frame loop
+            const uint8_t *pixels = static_cast<const uint8_t *>(it->staging.memory.mapped);
+            it->write = std::async(std::launch::async,
+                                   [this,
+                                    key = it->key,
+                                    width = it->width,
+                                    height = it->height,
+                                    levelCount = it->levelCount,
+                                    pixels,
+                                    size = it->size,
+                                    blockBytes = it->blockBytes] {
+                                       return m_textureCache.store(key,
+                                                                   width,
+                                                                   height,
+                                                                   levelCount,
+                                                                   pixels,
+                                                                   size,
+                                                                   blockBytes);
+                                   });
+        }
+
+        if (wait) {
+            it->write.wait();
+        } else if (it->write.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            ++it;
+            continue;
+        }
 
-    vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(m_graphicsQueue);
+        vkDestroyBuffer(m_context->device, it->staging.buffer, nullptr);
+        m_context->allocator->free(it->staging.memory);
+        it = m_pendingCacheWrites.erase(it);
+    }
+}
 
-    vkFreeCommandBuffers(m_device, m_commandPool, 1, &commandBuffer);
+const char *VulkanWindow::mipFilterName(MipFilter filter)
+{
+    switch (filter) {
+    case MipFilter::Box:
+        return "box";
+    case MipFilter::Kaiser:
+        return "kaiser";
+    case MipFilter::Lanczos:
+        return "lanczos";
+    case MipFilter::Blit:
+        return "blit";
+    case MipFilter::Cpu:
+        return "cpu";
+    }
+    return "";
 }
 
-void VulkanWindow::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+const char *VulkanWindow::compressionName(Compression compression)
+{
+    switch (compression) {
+    case Compression::None:
+        return "none";
+    case Compression::Bc1:
+        return "bc1";
+    case Compression::Bc7:
+        return "bc7";
+    case Compression::Auto:
+        return "auto";
+    }
+    return "";
+}
+
+const char *VulkanWindow::presentProfileName(PresentProfile profile)
 {
-    VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    switch (profile) {
+    case PresentProfile::LowLatency:
+        return "low-latency";
+    case PresentProfile::PowerSaving:
+        return "power-saving";
+    case PresentProfile::TearFree:
+    case PresentProfile::Count:
+        break;
+    }
+    return "tear-free";
+}
 
+void VulkanWindow::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+{
     VkBufferCopy copyRegion{};
     copyRegion.size = size;
-    vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-    endSingleTimeCommands(commandBuffer);
+    vkCmdCopyBuffer(m_uploads->commandBuffer(), srcBuffer, dstBuffer, 1, &copyRegion);
 }
 
 uint32_t VulkanWindow::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
 {
     VkPhysicalDeviceMemoryProperties memProperties;
-    vkGetPhysicalDeviceMemoryProperties(m_physicalDevice, &memProperties);
+    vkGetPhysicalDeviceMemoryProperties(m_context->physicalDevice, &memProperties);
 
     for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++) {
         if ((typeFilter & (1 << i))
@@ -1393,7 +4059,35 @@ uint32_t VulkanWindow::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags
 
 void VulkanWindow::createCommandBuffers()
 {
-    m_commandBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    TRACE_FUNCTION();
+
+    if (!m_commandBuffers.empty()) {
+        vkFreeCommandBuffers(m_context->device,
+                             m_commandPool,
+                             static_cast<uint32_t>(m_commandBuffers.size()),
+                             m_commandBuffers.data());
+    }
+
+    m_commandBuffers.resize(m_swapChainImages.size());
+    m_recordedFrames.assign(m_swapChainImages.size(), RecordedFrame{});
+    m_presentedFrame = RecordedFrame{};
+    m_imagesInFlight.assign(m_swapChainImages.size(), VK_NULL_HANDLE);
+
+    // Each image's command buffer keeps writing the same query set when it is replayed
+    for (auto set : m_frameQuerySets) {
+        m_gpuProfiler->releaseSet(set);
+    }
+    m_frameQuerySets.resize(m_swapChainImages.size());
+    for (auto &set : m_frameQuerySets) {
+        set = m_gpuProfiler->acquireSet();
+    }
+
+    // Written by the host right before each submit of the image, once its last one is done
+    createBuffer(sizeof(Vertex) * vertices.size() * m_swapChainImages.size(),
+                 VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 m_viewQuadBuffer,
+                 m_viewQuadBufferMemory);
 
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -1401,13 +4095,76 @@ void VulkanWindow::createCommandBuffers()
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
     allocInfo.commandBufferCount = (uint32_t) m_commandBuffers.size();
 
-    if (vkAllocateCommandBuffers(m_device, &allocInfo, m_commandBuffers.data()) != VK_SUCCESS) {
+    if (vkAllocateCommandBuffers(m_context->device, &allocInfo, m_commandBuffers.data())
+        != VK_SUCCESS) {
         throw std::runtime_error("failed to allocate command buffers!");
     }
 }
 
-void VulkanWindow::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+VulkanWindow::RecordedFrame VulkanWindow::currentFrameState() const
 {
+    RecordedFrame frame;
+    frame.generation = m_pipelineGeneration;
+    frame.view = m_dynamicParameters;
+    frame.viewport = m_viewport;
+    frame.viewportOffset = m_viewportOffset;
+    frame.vertexBuffer = m_tiledMode ? m_tileVertexBuffers[m_currentFrame] : m_vertexBuffer;
+    frame.indexCount = m_tiledMode ? m_tileIndexCount : static_cast<uint32_t>(indices.size());
+    frame.descriptorSet = m_descriptorSet;
+    if (!m_grid.isEmpty()) {
+        frame.descriptorSet = m_grid.descriptorSet();
+        frame.indexCount = frame.descriptorSet != VK_NULL_HANDLE ? frame.indexCount : 0;
+    }
+    frame.overlayGeneration = m_gpuOverlayGeneration;
+    return frame;
+}
+
+VkRect2D VulkanWindow::frameDamage(const RecordedFrame &before, const RecordedFrame &after) const
+{
+    const VkRect2D full{{0, 0}, m_swapChainExtent};
+
+    // Tiles change what a frame shows without changing its state
+    if (m_tiledMode || before.generation == 0 || before.generation != after.generation)
+        return full;
+
+    VkRect2D damage{};
+    const bool imageChanged = before.view.scaleX != after.view.scaleX
+                              || before.view.scaleY != after.view.scaleY
+                              || before.view.offsetX != after.view.offsetX
+                              || before.view.offsetY != after.view.offsetY
+                              || before.viewport.width != after.viewport.width
+                              || before.viewport.height != after.viewport.height
+                              || before.viewportOffset.x != after.viewportOffset.x
+                              || before.viewportOffset.y != after.viewportOffset.y
+                              || before.vertexBuffer != after.vertexBuffer
+                              || before.indexCount != after.indexCount
+                              || before.descriptorSet != after.descriptorSet;
+    if (imageChanged && !m_grid.isEmpty()) {
+        // Every cell moves with the view
+        damage = full;
+    } else if (imageChanged) {
+        // Primitives are clipped to the viewport, so nothing is drawn outside of it
+        damage = unite({before.viewportOffset, before.viewport},
+                       {after.viewportOffset, after.viewport});
+    }
+    if (before.overlayGeneration != after.overlayGeneration) {
+        const int32_t bars = static_cast<int32_t>(GpuScope::Count);
+        const VkRect2D overlay{{OVERLAY_MARGIN, OVERLAY_MARGIN},
+                               {static_cast<uint32_t>(OVERLAY_BAR_WIDTH),
+                                static_cast<uint32_t>(bars * (OVERLAY_BAR_HEIGHT
+                                                              + OVERLAY_BAR_SPACING)
+                                                      - OVERLAY_BAR_SPACING)}};
+        damage = unite(damage, overlay);
+    }
+    return intersect(damage, full);
+}
+
+void VulkanWindow::recordCommandBuffer(VkCommandBuffer commandBuffer,
+                                       uint32_t imageIndex,
+                                       const VkRect2D &damage)
+{
+    TRACE_FUNCTION();
+
     VkCommandBufferBeginInfo beginInfo{};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 
@@ -1415,12 +4172,26 @@ void VulkanWindow::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t i
         throw std::runtime_error("failed to begin recording command buffer!");
     }
 
+    const uint32_t querySet = m_frameQuerySets[imageIndex];
+    m_gpuProfiler->resetSet(commandBuffer, querySet);
+    m_gpuProfiler->beginScope(commandBuffer, querySet, GpuScope::Draw);
+
+    const bool partial = damage.extent.width != m_swapChainExtent.width
+                         || damage.extent.height != m_swapChainExtent.height;
+
     VkRenderPassBeginInfo renderPassInfo{};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-    renderPassInfo.renderPass = m_renderPass;
-    renderPassInfo.framebuffer = m_swapChainFramebuffers[imageIndex];
-    renderPassInfo.renderArea.offset = {0, 0};
-    renderPassInfo.renderArea.extent = m_swapChainExtent;
+    renderPassInfo.renderPass = partial ? m_context->damageRenderPass : m_context->renderPass;
+    renderPassInfo.framebuffer
+        = m_swapChainFramebuffers[m_context->imagelessFramebuffer ? 0 : imageIndex];
+
+    VkRenderPassAttachmentBeginInfoKHR attachmentInfo{};
+    attachmentInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_ATTACHMENT_BEGIN_INFO_KHR;
+    attachmentInfo.attachmentCount = 1;
+    attachmentInfo.pAttachments = &m_swapChainImageViews[imageIndex];
+    if (m_context->imagelessFramebuffer)
+        renderPassInfo.pNext = &attachmentInfo;
+    renderPassInfo.renderArea = damage;
 
     VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
     renderPassInfo.clearValueCount = 1;
@@ -1428,51 +4199,202 @@ void VulkanWindow::recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t i
 
     vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
-    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_graphicsPipeline);
+    vkCmdSetScissor(commandBuffer, 0, 1, &damage);
+
+    const RecordedFrame frame = currentFrameState();
+    if (!m_grid.isEmpty()) {
+        m_grid.draw(commandBuffer,
+                    *m_context,
+                    frame.vertexBuffer,
+                    m_indexBuffer,
+                    frame.indexCount,
+                    frame.view,
+                    frame.viewportOffset,
+                    frame.viewport,
+                    m_swapChainExtent);
+    } else {
+        drawView(commandBuffer, imageIndex, frame);
+    }
+
+    if (m_gpuOverlay)
+        drawGpuOverlay(commandBuffer, damage);
+
+    vkCmdEndRenderPass(commandBuffer);
+
+    m_gpuProfiler->endScope(commandBuffer, querySet, GpuScope::Draw);
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record command buffer!");
+    }
+
+    m_recordedFrames[imageIndex] = frame;
+    m_recordedFrames[imageIndex].full = !partial;
+}
+
+bool VulkanWindow::viewInQuadBuffer() const
+{
+    // Tiles are placed by the view transform and the grid maps it per cell in its shader
+    return !m_tiledMode && m_grid.isEmpty();
+}
+
+void VulkanWindow::writeViewQuad(uint32_t imageIndex)
+{
+    const ViewTransform &view = m_dynamicParameters;
+
+    // Same mapping as the view transform and viewport, done here so that the commands do not
+    // depend on it. The quad is clipped to the viewport exactly like in gridcells.vert.
+    auto mapAxis = [](float scale,
+                      float offset,
+                      float viewportOrigin,
+                      float viewportSize,
+                      float extent,
+                      float *position,
+                      float *texCoord) {
+        viewportSize = std::max(viewportSize, 1.0f);
+        for (int edge = 0; edge < 2; edge++) {
+            const float corner = (edge == 0 ? -1.0f : 1.0f) * scale + offset;
+            const float pixel = viewportOrigin + (corner * 0.5f + 0.5f) * viewportSize;
+            const float clipped = std::clamp(pixel, viewportOrigin, viewportOrigin + viewportSize);
+            const float clippedPosition = (clipped - viewportOrigin) / viewportSize * 2.0f - 1.0f;
+            texCoord[edge] = (clippedPosition - offset) / scale * 0.5f + 0.5f;
+            position[edge] = clipped / extent * 2.0f - 1.0f;
+        }
+    };
+
+    float x[2], y[2], u[2], v[2];
+    mapAxis(view.scaleX,
+            view.offsetX,
+            static_cast<float>(m_viewportOffset.x),
+            static_cast<float>(m_viewport.width),
+            static_cast<float>(m_swapChainExtent.width),
+            x,
+            u);
+    mapAxis(view.scaleY,
+            view.offsetY,
+            static_cast<float>(m_viewportOffset.y),
+            static_cast<float>(m_viewport.height),
+            static_cast<float>(m_swapChainExtent.height),
+            y,
+            v);
+
+    // Corners in the order of vertices, so indices draw it unchanged
+    auto *quad = static_cast<Vertex *>(m_viewQuadBufferMemory.mapped)
+                 + imageIndex * vertices.size();
+    quad[0] = {{x[0], y[0]}, {u[0], v[0]}};
+    quad[1] = {{x[1], y[0]}, {u[1], v[0]}};
+    quad[2] = {{x[1], y[1]}, {u[1], v[1]}};
+    quad[3] = {{x[0], y[1]}, {u[0], v[1]}};
+}
+
+void VulkanWindow::drawView(VkCommandBuffer commandBuffer,
+                            uint32_t imageIndex,
+                            const RecordedFrame &frame)
+{
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_context->graphicsPipeline);
+
+    // The quad buffer is already in window coordinates, drawn with an identity transform
+    const bool quadBuffer = viewInQuadBuffer();
+    const ViewTransform identity{1.0f, 1.0f, 0.0f, 0.0f};
 
     VkViewport viewport{};
-    viewport.x = m_viewportOffset.x;
-    viewport.y = m_viewportOffset.y;
-    viewport.width = (float) m_viewport.width;
-    viewport.height = (float) m_viewport.height;
+    viewport.x = quadBuffer ? 0.0f : m_viewportOffset.x;
+    viewport.y = quadBuffer ? 0.0f : m_viewportOffset.y;
+    viewport.width = (float) (quadBuffer ? m_swapChainExtent.width : m_viewport.width);
+    viewport.height = (float) (quadBuffer ? m_swapChainExtent.height : m_viewport.height);
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
     vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
 
-    VkRect2D scissor{};
-    scissor.offset = {0, 0};
-    scissor.extent = m_swapChainExtent;
-    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
-
-    VkBuffer vertexBuffers[] = {m_vertexBuffer};
-    VkDeviceSize offsets[] = {0};
+    VkBuffer vertexBuffers[] = {quadBuffer ? m_viewQuadBuffer : frame.vertexBuffer};
+    VkDeviceSize offsets[] = {quadBuffer ? sizeof(Vertex) * vertices.size() * imageIndex : 0};
     vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
 
-    vkCmdBindIndexBuffer(commandBuffer, m_indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+    vkCmdBindIndexBuffer(commandBuffer,
+                         m_tiledMode ? m_tileIndexBuffer : m_indexBuffer,
+                         0,
+                         VK_INDEX_TYPE_UINT16);
 
     vkCmdBindDescriptorSets(commandBuffer,
                             VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            m_pipelineLayout,
+                            m_context->pipelineLayout,
                             0,
                             1,
-                            &m_descriptorSets[m_currentFrame],
+                            &frame.descriptorSet,
                             0,
                             nullptr);
 
-    vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+    vkCmdPushConstants(commandBuffer,
+                       m_context->pipelineLayout,
+                       VK_SHADER_STAGE_VERTEX_BIT,
+                       0,
+                       sizeof(ViewTransform),
+                       quadBuffer ? &identity : &frame.view);
 
-    vkCmdEndRenderPass(commandBuffer);
+    if (frame.indexCount > 0) {
+        vkCmdDrawIndexed(commandBuffer, frame.indexCount, 1, 0, 0, 0);
+    }
+}
 
-    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-        throw std::runtime_error("failed to record command buffer!");
+void VulkanWindow::drawGpuOverlay(VkCommandBuffer commandBuffer, const VkRect2D &renderArea)
+{
+    // The full bar width is one 60 Hz frame
+    const float FULL_SCALE_MS = 1000.0f / 60;
+    const std::array<VkClearColorValue, 3> colors = {{{{0.1f, 0.4f, 1.0f, 1.0f}},
+                                                      {{0.2f, 0.9f, 0.2f, 1.0f}},
+                                                      {{1.0f, 0.5f, 0.1f, 1.0f}}}};
+
+    auto clear = [&](const VkClearColorValue &color, int32_t x, int32_t y, float width) {
+        const uint32_t clamped = static_cast<uint32_t>(
+            std::clamp(width, 0.0f, OVERLAY_BAR_WIDTH));
+        if (clamped == 0 || uint32_t(x) + clamped > m_swapChainExtent.width
+            || uint32_t(y + OVERLAY_BAR_HEIGHT) > m_swapChainExtent.height) {
+            return;
+        }
+
+        // Clears ignore the scissor but must stay inside the render area
+        const VkRect2D bar = intersect({{x, y}, {clamped, uint32_t(OVERLAY_BAR_HEIGHT)}},
+                                       renderArea);
+        if (bar.extent.width == 0 || bar.extent.height == 0)
+            return;
+
+        VkClearAttachment attachment{};
+        attachment.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        attachment.colorAttachment = 0;
+        attachment.clearValue.color = color;
+
+        VkClearRect rect{};
+        rect.rect = bar;
+        rect.baseArrayLayer = 0;
+        rect.layerCount = 1;
+
+        vkCmdClearAttachments(commandBuffer, 1, &attachment, 1, &rect);
+    };
+
+    // Dark track, the p99 dimmed behind the average
+    for (uint32_t i = 0; i < colors.size(); i++) {
+        const auto stats = gpuStats(static_cast<GpuScope>(i));
+        const int32_t y = OVERLAY_MARGIN
+                          + static_cast<int32_t>(i) * (OVERLAY_BAR_HEIGHT + OVERLAY_BAR_SPACING);
+
+        VkClearColorValue dimmed = colors[i];
+        for (int c = 0; c < 3; c++) {
+            dimmed.float32[c] *= 0.35f;
+        }
+
+        clear({{0.05f, 0.05f, 0.05f, 1.0f}}, OVERLAY_MARGIN, y, OVERLAY_BAR_WIDTH);
+        clear(dimmed, OVERLAY_MARGIN, y, stats.p99Ms / FULL_SCALE_MS * OVERLAY_BAR_WIDTH);
+        clear(colors[i], OVERLAY_MARGIN, y, stats.avgMs / FULL_SCALE_MS * OVERLAY_BAR_WIDTH);
     }
 }
 
 void VulkanWindow::createSyncObjects()
 {
+    TRACE_FUNCTION();
+
     m_imageAvailableSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
     m_renderFinishedSemaphores.resize(MAX_FRAMES_IN_FLIGHT);
     m_inFlightFences.resize(MAX_FRAMES_IN_FLIGHT);
+    m_frameSlotSerials.assign(MAX_FRAMES_IN_FLIGHT, 0);
 
     VkSemaphoreCreateInfo semaphoreInfo{};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -1481,49 +4403,130 @@ void VulkanWindow::createSyncObjects()
     fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
     fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
+    const VkDevice device = m_context->device;
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        if (vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_imageAvailableSemaphores[i])
+        if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &m_imageAvailableSemaphores[i])
                 != VK_SUCCESS
-            || vkCreateSemaphore(m_device, &semaphoreInfo, nullptr, &m_renderFinishedSemaphores[i])
+            || vkCreateSemaphore(device, &semaphoreInfo, nullptr, &m_renderFinishedSemaphores[i])
                    != VK_SUCCESS
-            || vkCreateFence(m_device, &fenceInfo, nullptr, &m_inFlightFences[i]) != VK_SUCCESS) {
+            || vkCreateFence(device, &fenceInfo, nullptr, &m_inFlightFences[i]) != VK_SUCCESS) {
             throw std::runtime_error("failed to create synchronization objects for a frame!");
         }
     }
 }
 
-void VulkanWindow::updateUniformBuffer(uint32_t currentImage)
-{
-    UniformBufferObject ubo = m_dynamicParameters;
-    memcpy(m_uniformBuffersMapped[currentImage], &ubo, sizeof(ubo));
-}
-
 void VulkanWindow::drawFrame()
 {
-    vkWaitForFences(m_device, 1, &m_inFlightFences[m_currentFrame], VK_TRUE, UINT64_MAX);
+    TRACE_FUNCTION();
+
+    m_frameDamaged = false;
+    m_activityStats.drawnFrames++;
+
+    {
+        TRACE_SCOPE("wait for frame fence");
+        vkWaitForFences(m_context->device,
+                        1,
+                        &m_inFlightFences[m_currentFrame],
+                        VK_TRUE,
+                        UINT64_MAX);
+    }
+    m_completedFrameSerial = std::max(m_completedFrameSerial,
+                                      m_frameSlotSerials[m_currentFrame]);
+    retireSwapChains(false);
+
+    retireUploads(false);
+
+    // Recorded command buffers may still bind a destroyed texture, they must not be replayed
+    if (m_gpuTextures) {
+        m_gpuTextures->collect(this, m_completedFrameSerial, m_uploads->completedSerial());
+        if (m_gpuTextures->destroyedGeneration() != m_texturesDestroyedGeneration) {
+            m_texturesDestroyedGeneration = m_gpuTextures->destroyedGeneration();
+            m_recordedFrames.assign(m_recordedFrames.size(), RecordedFrame{});
+        }
+    }
 
     uint32_t imageIndex;
-    VkResult result = vkAcquireNextImageKHR(m_device,
-                                            m_swapChain,
-                                            UINT64_MAX,
-                                            m_imageAvailableSemaphores[m_currentFrame],
-                                            VK_NULL_HANDLE,
-                                            &imageIndex);
+    VkResult result;
+    {
+        TRACE_SCOPE("acquire");
+        result = vkAcquireNextImageKHR(m_context->device,
+                                       m_swapChain,
+                                       UINT64_MAX,
+                                       m_imageAvailableSemaphores[m_currentFrame],
+                                       VK_NULL_HANDLE,
+                                       &imageIndex);
+    }
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR) {
         recreateSwapChain();
+        scheduleRedraw(false);
         return;
     } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
         throw std::runtime_error("failed to acquire swap chain image!");
     }
 
-    updateUniformBuffer(m_currentFrame);
+    // The image's command buffer may still be executing for a frame from another slot
+    if (m_imagesInFlight[imageIndex] != VK_NULL_HANDLE) {
+        TRACE_SCOPE("wait for image fence");
+        vkWaitForFences(m_context->device, 1, &m_imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+    }
+    m_imagesInFlight[imageIndex] = m_inFlightFences[m_currentFrame];
+
+    // Its previous submission has completed, so its timings can be read without waiting
+    const uint64_t drawSamples = gpuStats(GpuScope::Draw).samples;
+    m_gpuProfiler->collect(m_frameQuerySets[imageIndex]);
+    if (gpuStats(GpuScope::Draw).samples > drawSamples)
+        m_activityStats.gpuBusyMs += gpuStats(GpuScope::Draw).lastMs;
+    if (m_gpuOverlay
+        && (!m_gpuOverlayTimer.isValid() || m_gpuOverlayTimer.elapsed() >= 250)) {
+        m_gpuOverlayGeneration++;
+        m_gpuOverlayTimer.start();
+    }
+
+    QElapsedTimer cpuTimer;
+    cpuTimer.start();
+
+    if (m_tiledMode) {
+        updateTiles();
+    }
 
-    vkResetFences(m_device, 1, &m_inFlightFences[m_currentFrame]);
+    vkResetFences(m_context->device, 1, &m_inFlightFences[m_currentFrame]);
+
+    // Replaying is enough while the view, geometry and pipeline are what was recorded.
+    // Otherwise only what changed since this image was last drawn is drawn again, replaying
+    // that later redraws the same pixels the same way.
+    // The single view reads its transform from the image's quad buffer, so a recording of the
+    // whole image also replays after a pan or zoom. When only the view differs from a partial
+    // recording, it is recorded in full so that the following pans replay.
+    const VkRect2D fullFrame{{0, 0}, m_swapChainExtent};
+    const RecordedFrame frame = currentFrameState();
+    const RecordedFrame &recorded = m_recordedFrames[imageIndex];
+    const bool quadBuffer = viewInQuadBuffer();
+    if (quadBuffer)
+        writeViewQuad(imageIndex);
+    if (!m_alwaysRecord && !(recorded == frame) && quadBuffer && recorded.full
+        && recorded.sameCommands(frame)) {
+        m_recordedFrames[imageIndex] = frame;
+        m_recordedFrames[imageIndex].full = true;
+        m_frameStats.replayedViewChanges++;
+    } else if (m_alwaysRecord || !(recorded == frame)) {
+        VkRect2D damage = frameDamage(recorded, frame);
+        if (damage.extent.width == 0 || damage.extent.height == 0
+            || (quadBuffer && recorded.sameCommands(frame))) {
+            damage = fullFrame;
+        } else if (damage.extent.width != fullFrame.extent.width
+                   || damage.extent.height != fullFrame.extent.height) {
+            m_frameStats.partialFrames++;
+        }
 
-    vkResetCommandBuffer(m_commandBuffers[m_currentFrame],
-                         /*VkCommandBufferResetFlagBits*/ 0);
-    recordCommandBuffer(m_commandBuffers[m_currentFrame], imageIndex);
+        QElapsedTimer recordTimer;
+        recordTimer.start();
+        vkResetCommandBuffer(m_commandBuffers[imageIndex],
+                             /*VkCommandBufferResetFlagBits*/ 0);
+        recordCommandBuffer(m_commandBuffers[imageIndex], imageIndex, damage);
+        m_frameStats.recordSumUs += recordTimer.nsecsElapsed() / 1e3;
+        m_frameStats.recordedFrames++;
+    }
 
     VkSubmitInfo submitInfo{};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
@@ -1535,16 +4538,27 @@ void VulkanWindow::drawFrame()
     submitInfo.pWaitDstStageMask = waitStages;
 
     submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &m_commandBuffers[m_currentFrame];
+    submitInfo.pCommandBuffers = &m_commandBuffers[imageIndex];
 
     VkSemaphore signalSemaphores[] = {m_renderFinishedSemaphores[m_currentFrame]};
     submitInfo.signalSemaphoreCount = 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
-    if (vkQueueSubmit(m_graphicsQueue, 1, &submitInfo, m_inFlightFences[m_currentFrame])
-        != VK_SUCCESS) {
-        throw std::runtime_error("failed to submit draw command buffer!");
+    {
+        TRACE_SCOPE("submit");
+        if (vkQueueSubmit(m_context->graphicsQueue,
+                          1,
+                          &submitInfo,
+                          m_inFlightFences[m_currentFrame])
+            != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit draw command buffer!");
+        }
     }
+    m_frameSlotSerials[m_currentFrame] = ++m_frameSerial;
+    if (m_displayedTexture)
+        m_displayedTexture->frameSerials[this] = m_frameSerial;
+    m_gpuProfiler->submitted(m_frameQuerySets[imageIndex]);
+    m_frameStats.cpuSumUs += cpuTimer.nsecsElapsed() / 1e3;
 
     VkPresentInfoKHR presentInfo{};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -1558,7 +4572,34 @@ void VulkanWindow::drawFrame()
 
     presentInfo.pImageIndices = &imageIndex;
 
-    result = vkQueuePresentKHR(m_presentQueue, &presentInfo);
+    // Tells the compositor what differs from the last present, it may skip the rest
+    const VkRect2D presentDamage = frameDamage(m_presentedFrame, frame);
+    VkRectLayerKHR presentRect{};
+    presentRect.offset = presentDamage.offset;
+    presentRect.extent = presentDamage.extent;
+    presentRect.layer = 0;
+
+    VkPresentRegionKHR presentRegion{};
+    presentRegion.rectangleCount = 1;
+    presentRegion.pRectangles = &presentRect;
+
+    VkPresentRegionsKHR presentRegions{};
+    presentRegions.sType = VK_STRUCTURE_TYPE_PRESENT_REGIONS_KHR;
+    presentRegions.swapchainCount = 1;
+    presentRegions.pRegions = &presentRegion;
+
+    if (m_context->incrementalPresent && presentDamage.extent.width > 0
+        && presentDamage.extent.height > 0
+        && (presentDamage.extent.width != fullFrame.extent.width
+            || presentDamage.extent.height != fullFrame.extent.height)) {
+        presentInfo.pNext = &presentRegions;
+    }
+    m_presentedFrame = frame;
+
+    {
+        TRACE_SCOPE("present");
+        result = vkQueuePresentKHR(m_context->presentQueue, &presentInfo);
+    }
 
     if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || m_framebufferResized) {
         m_framebufferResized = false;
@@ -1567,7 +4608,162 @@ void VulkanWindow::drawFrame()
         throw std::runtime_error("failed to present swap chain image!");
     }
 
-    m_currentFrame = (m_currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+    recordFramePresented();
+
+    if (!m_firstFramePresented) {
+        m_firstFramePresented = true;
+        qDebug() << "time to first frame:" << m_startupTimer.elapsed() << "ms, peak RSS:"
+                 << peakResidentSetSize() / (1024 * 1024) << "MiB, decoder:" << m_textureDecoder;
+
+        const auto memory = m_context->allocator->stats();
+        qDebug() << "device memory:" << memory.usedBytes / 1024 << "KiB used of"
+                 << memory.reservedBytes / 1024 << "KiB reserved in" << memory.blockCount
+                 << "blocks," << memory.allocationCount << "allocations,"
+                 << memory.deviceAllocationCount << "vkAllocateMemory calls";
+    }
+
+    m_currentFrame = (m_currentFrame + 1) % m_framesInFlight;
+}
+
+void VulkanWindow::renderOffscreen()
+{
+    TRACE_FUNCTION();
+
+    retireUploads(false);
+
+    if (m_tiledMode) {
+        updateTiles();
+
+        const auto visible = visibleTiles();
+        const bool resident = std::all_of(visible.begin(),
+                                          visible.end(),
+                                          [this](const TileKey &key) {
+                                              return m_tileCache->find(key) >= 0;
+                                          });
+        if (!resident) {
+            QTimer::singleShot(10, this, [this] { renderOffscreen(); });
+            return;
+        }
+    }
+
+    if (viewInQuadBuffer())
+        writeViewQuad(0);
+    recordCommandBuffer(m_commandBuffers[0], 0, {{0, 0}, m_swapChainExtent});
+
+    const VkDeviceSize size = VkDeviceSize(m_swapChainExtent.width) * m_swapChainExtent.height
+                              * 4;
+    createBuffer(size,
+                 VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                 m_readbackBuffer,
+                 m_readbackBufferMemory);
+
+    // The render pass already left the image in TRANSFER_SRC_OPTIMAL for this copy
+    VkCommandBuffer readback = UploadQueue::beginCommands(m_context->device, m_commandPool);
+
+    VkBufferImageCopy region{};
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {m_swapChainExtent.width, m_swapChainExtent.height, 1};
+    vkCmdCopyImageToBuffer(readback,
+                           m_offscreenImage,
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                           m_readbackBuffer,
+                           1,
+                           &region);
+
+    VkBufferMemoryBarrier hostBarrier{};
+    hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    hostBarrier.buffer = m_readbackBuffer;
+    hostBarrier.offset = 0;
+    hostBarrier.size = VK_WHOLE_SIZE;
+
+    vkCmdPipelineBarrier(readback,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT,
+                         VK_PIPELINE_STAGE_HOST_BIT,
+                         0,
+                         0,
+                         nullptr,
+                         1,
+                         &hostBarrier,
+                         0,
+                         nullptr);
+
+    if (vkEndCommandBuffer(readback) != VK_SUCCESS) {
+        throw std::runtime_error("failed to record readback command buffer!");
+    }
+
+    VkCommandBuffer commandBuffers[] = {m_commandBuffers[0], readback};
+
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 2;
+    submitInfo.pCommandBuffers = commandBuffers;
+
+    vkResetFences(m_context->device, 1, &m_inFlightFences[0]);
+    if (vkQueueSubmit(m_context->graphicsQueue, 1, &submitInfo, m_inFlightFences[0])
+        != VK_SUCCESS) {
+        throw std::runtime_error("failed to submit offscreen command buffers!");
+    }
+    m_gpuProfiler->submitted(m_frameQuerySets[0]);
+
+    readBackOffscreen();
+}
+
+void VulkanWindow::readBackOffscreen()
+{
+    retireUploads(false);
+
+    if (vkGetFenceStatus(m_context->device, m_inFlightFences[0]) != VK_SUCCESS) {
+        QTimer::singleShot(1, this, [this] { readBackOffscreen(); });
+        return;
+    }
+
+    if (!m_outputWrite.valid()) {
+        m_gpuProfiler->collect(m_frameQuerySets[0]);
+        qDebug() << "offscreen frame rendered in" << m_startupTimer.elapsed() << "ms, gpu draw:"
+                 << gpuStats(GpuScope::Draw).lastMs << "ms";
+
+        // Wraps the mapped buffer, which stays alive until the write has finished
+        const int width = static_cast<int>(m_swapChainExtent.width);
+        const int height = static_cast<int>(m_swapChainExtent.height);
+        const QImage image(static_cast<const uchar *>(m_readbackBufferMemory.mapped),
+                           width,
+                           height,
+                           qsizetype(width) * 4,
+                           QImage::Format_RGBA8888);
+
+        m_outputWrite = std::async(std::launch::async,
+                                   [image, fileName = m_options.outputFile] {
+                                       QImageWriter writer(fileName);
+                                       if (writer.write(image))
+                                           return true;
+
+                                       qWarning() << "failed to write" << fileName << ":"
+                                                  << writer.errorString();
+                                       return false;
+                                   });
+    }
+
+    if (m_outputWrite.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        QTimer::singleShot(1, this, [this] { readBackOffscreen(); });
+        return;
+    }
+
+    const bool written = m_outputWrite.get();
+    if (written)
+        qDebug() << "wrote" << m_options.outputFile;
+
+    vkDeviceWaitIdle(m_context->device);
+    cleanup();
+    m_vulkanInitDone = false;
+    qApp->exit(written ? 0 : 1);
 }
 
 VkShaderModule VulkanWindow::createShaderModule(const std::vector<char> &code)
@@ -1578,7 +4774,8 @@ VkShaderModule VulkanWindow::createShaderModule(const std::vector<char> &code)
     createInfo.pCode = reinterpret_cast<const uint32_t *>(code.data());
 
     VkShaderModule shaderModule;
-    if (vkCreateShaderModule(m_device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS) {
+    if (vkCreateShaderModule(m_context->device, &createInfo, nullptr, &shaderModule)
+        != VK_SUCCESS) {
         throw std::runtime_error("failed to create shader module!");
     }
 
@@ -1588,6 +4785,15 @@ VkShaderModule VulkanWindow::createShaderModule(const std::vector<char> &code)
 VkSurfaceFormatKHR VulkanWindow::chooseSwapSurfaceFormat(
     const std::vector<VkSurfaceFormatKHR> &availableFormats)
 {
+    // The render pass and pipeline shared with the other windows fix the format
+    if (m_context->renderPass != VK_NULL_HANDLE) {
+        for (const auto &availableFormat : availableFormats) {
+            if (availableFormat.format == m_context->swapChainImageFormat)
+                return availableFormat;
+        }
+        throw std::runtime_error("failed to find the shared swap chain format!");
+    }
+
     for (const auto &availableFormat : availableFormats) {
         if (availableFormat.format == VK_FORMAT_B8G8R8A8_SRGB
             && availableFormat.colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR) {
@@ -1601,12 +4807,28 @@ VkSurfaceFormatKHR VulkanWindow::chooseSwapSurfaceFormat(
 VkPresentModeKHR VulkanWindow::chooseSwapPresentMode(
     const std::vector<VkPresentModeKHR> &availablePresentModes)
 {
-    for (const auto &availablePresentMode : availablePresentModes) {
-        if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-            return availablePresentMode;
+    std::vector<VkPresentModeKHR> preferred;
+    switch (m_presentProfile) {
+    case PresentProfile::LowLatency:
+        preferred = {VK_PRESENT_MODE_IMMEDIATE_KHR,
+                     VK_PRESENT_MODE_MAILBOX_KHR,
+                     VK_PRESENT_MODE_FIFO_RELAXED_KHR};
+        break;
+    case PresentProfile::TearFree:
+        preferred = {VK_PRESENT_MODE_MAILBOX_KHR};
+        break;
+    default:
+        break;
+    }
+
+    for (const auto presentMode : preferred) {
+        if (std::find(availablePresentModes.begin(), availablePresentModes.end(), presentMode)
+            != availablePresentModes.end()) {
+            return presentMode;
         }
     }
 
+    // Always supported
     return VK_PRESENT_MODE_FIFO_KHR;
 }
 
@@ -1667,6 +4889,9 @@ bool VulkanWindow::isDeviceSuitable(VkPhysicalDevice device)
 {
     QueueFamilyIndices indices = findQueueFamilies(device);
 
+    if (m_offscreen)
+        return indices.isComplete();
+
     bool extensionsSupported = checkDeviceExtensionSupport(device);
 
     bool swapChainAdequate = false;
@@ -1723,7 +4948,12 @@ VulkanWindow::QueueFamilyIndices VulkanWindow::findQueueFamilies(VkPhysicalDevic
         }
 
         VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_surface, &presentSupport);
+        if (m_offscreen) {
+            // Without a surface the graphics queue stands in for the present queue
+            presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+        } else {
+            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_surface, &presentSupport);
+        }
 
         if (presentSupport) {
             indices.presentFamily = i;
@@ -1736,15 +4966,49 @@ VulkanWindow::QueueFamilyIndices VulkanWindow::findQueueFamilies(VkPhysicalDevic
         i++;
     }
 
+    // Prefer a transfer-only family (usually a DMA engine), then any family without graphics
+    for (uint32_t family = 0; family < queueFamilyCount; family++) {
+        const VkQueueFlags flags = queueFamilies[family].queueFlags;
+        if ((flags & VK_QUEUE_GRAPHICS_BIT)
+            || !(flags & (VK_QUEUE_TRANSFER_BIT | VK_QUEUE_COMPUTE_BIT))) {
+            continue;
+        }
+
+        if (!(flags & VK_QUEUE_COMPUTE_BIT)) {
+            indices.transferFamily = family;
+            break;
+        }
+        if (!indices.transferFamily.has_value())
+            indices.transferFamily = family;
+    }
+
     return indices;
 }
 
 std::vector<const char *> VulkanWindow::getRequiredExtensions()
 {
-    std::vector<const char *> extensions = {
-        VK_KHR_SURFACE_EXTENSION_NAME,          // Always enabled
-        VK_KHR_PLATFORM_SURFACE_EXTENSION_NAME, // Enable platform surface extension
-    };
+    std::vector<const char *> extensions;
+    if (!m_offscreen) {
+        extensions.push_back(VK_KHR_SURFACE_EXTENSION_NAME);
+        extensions.push_back(VK_KHR_PLATFORM_SURFACE_EXTENSION_NAME);
+
+        // Needed by the imageless framebuffer extension on Vulkan 1.0
+        uint32_t extensionCount = 0;
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+        vkEnumerateInstanceExtensionProperties(nullptr,
+                                               &extensionCount,
+                                               availableExtensions.data());
+        for (const auto &extension : availableExtensions) {
+            if (strcmp(extension.extensionName,
+                       VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)
+                == 0) {
+                m_physicalDeviceProperties2 = true;
+            }
+        }
+        if (m_physicalDeviceProperties2)
+            extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+    }
 
     if (enableValidationLayers) {
         extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
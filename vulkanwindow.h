@@ -2,13 +2,19 @@
 #define VULKANWINDOW_H
 
 #include <QDebug>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileDialog>
 #include <QGuiApplication>
 #include <QImage>
+#include <QImageReader>
+#include <QImageWriter>
+#include <QKeyEvent>
 #include <QMenuBar>
 #include <QMouseEvent>
+#include <QScreen>
 #include <QStandardPaths>
+#include <QTimer>
 #include <QWindow>
 
 #ifdef Q_OS_WIN
@@ -28,10 +34,29 @@
 #define GLM_FORCE_RADIANS
 #include <glm/glm.hpp>
 
+#include "bcencoder.h"
+#include "bmpreader.h"
+#include "deviceallocator.h"
+#include "gpuprofiler.h"
+#include "gputexturecache.h"
+#include "gridview.h"
+#include "imagebrowser.h"
+#include "mipblits.h"
+#include "mipbuilder.h"
+#include "pipelinecache.h"
+#include "rendercontext.h"
+#include "texturecache.h"
+#include "threadpool.h"
+#include "tilestreamer.h"
+#include "tracer.h"
+#include "uploadqueue.h"
+
 #include <array>
 #include <cstdint>
 #include <cstdlib>
 #include <cstring>
+#include <future>
+#include <memory>
 #include <optional>
 #include <vector>
 
@@ -58,6 +83,8 @@ class VulkanWindow : public QWindow
     {
         std::optional<uint32_t> graphicsFamily;
         std::optional<uint32_t> presentFamily;
+        // Family without graphics support, used for uploads when present
+        std::optional<uint32_t> transferFamily;
 
         bool isComplete() { return graphicsFamily.has_value() && presentFamily.has_value(); }
     };
@@ -102,20 +129,159 @@ class VulkanWindow : public QWindow
         }
     };
 
-    struct UniformBufferObject
+    // A host visible copy of a finished mip chain, written to the texture cache on a worker
+    // once the upload batch that filled it has completed
+    struct PendingCacheWrite
+    {
+        uint64_t serial;
+        QString key;
+        uint32_t width;
+        uint32_t height;
+        uint32_t levelCount;
+        size_t size;
+        uint32_t blockBytes;
+        UploadQueue::StagingBuffer staging;
+        std::future<bool> write;
+    };
+
+    // Values match the FILTER_* defines in mipmap.comp, Blit and Cpu are not shader filters
+    enum class MipFilter { Box = 0, Kaiser = 1, Lanczos = 2, Blit, Cpu };
+
+    // Auto picks BC1 for opaque images and BC7 for the others
+    enum class Compression { None, Bc1, Bc7, Auto };
+
+    // Present mode, swapchain image count and frames in flight, chosen together.
+    // LowLatency tears if it has to, PowerSaving waits for every vblank with as few images as
+    // the surface allows, TearFree prefers mailbox with a spare image.
+    enum class PresentProfile { LowLatency, PowerSaving, TearFree, Count };
+
+    // The image as far as it can be read before a device exists: a cache hit, a mapped BMP or
+    // a decoded QImage. Filled on a worker while the instance and device are created.
+    struct TextureSource
+    {
+        MipFilter filter;
+        Compression compression;
+        QString cacheKey;
+        std::unique_ptr<CachedTexture> cached;
+        std::unique_ptr<BmpReader> bmp;
+        QImage image;
+        const char *decoder = "";
+        uint32_t width = 0;
+        uint32_t height = 0;
+        bool hasAlpha = false;
+        bool tiled = false;
+    };
+
+    // Push constants of the pixel conversion shader, formats as defined there
+    struct ConvertPushConstants
+    {
+        int32_t width;
+        int32_t height;
+        uint32_t rowStride;
+        uint32_t format;
+        uint32_t bottomUp;
+        uint32_t paletteOffset;
+    };
+
+    // Staging for a texture, filled on the thread pool while the main thread goes on.
+    // uploadTexture waits for fill and records the upload.
+    struct PendingTexture
+    {
+        std::unique_ptr<TextureSource> source;
+        bool tiled = false;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t mipLevels = 0;
+        const char *decoder = "";
+        bool cpuMips = false;
+        bool fullChain = false;
+        // The CPU chain is encoded into staging as bcFormat. Cache hits may be compressed
+        // too, blockBytes and format describe what staging holds either way.
+        bool compressed = false;
+        BcFormat bcFormat = BcFormat::Bc1;
+        uint32_t blockBytes = 0;
+        VkFormat format = VK_FORMAT_R8G8B8A8_SRGB;
+        // The staging buffer holds the BMP pixel data as stored, converted by convertOnGpu
+        bool gpuConvert = false;
+        ConvertPushConstants convert{};
+        std::vector<MipLevel> levels;
+        VkBuffer stagingBuffer = VK_NULL_HANDLE;
+        DeviceAllocation stagingBufferMemory;
+        std::future<void> fill;
+    };
+
+    // A browsed image on its way into the GPU texture cache. Its source is read and its
+    // staging filled on the thread pool, only the upload is recorded on the main thread.
+    struct TextureLoad
+    {
+        QString fileName;
+        std::future<std::unique_ptr<TextureSource>> source;
+        PendingTexture texture;
+    };
+
+    struct MipPushConstants
+    {
+        int32_t srcWidth;
+        int32_t srcHeight;
+        int32_t dstWidth;
+        int32_t dstHeight;
+        int32_t filterType;
+        int32_t levelCount;
+    };
+
+    // Everything a swapchain image's command buffer was recorded with
+    struct RecordedFrame
     {
-        float scaleX;
-        float scaleY;
-        float offsetX;
-        float offsetY;
+        uint64_t generation = 0;
+        ViewTransform view{};
+        VkExtent2D viewport{};
+        VkOffset2D viewportOffset{};
+        VkBuffer vertexBuffer = VK_NULL_HANDLE;
+        uint32_t indexCount = 0;
+        VkDescriptorSet descriptorSet = VK_NULL_HANDLE;
+        uint64_t overlayGeneration = 0;
+        // Recorded with the whole image as its render area
+        bool full = false;
+
+        bool operator==(const RecordedFrame &other) const
+        {
+            return sameCommands(other) && view.scaleX == other.view.scaleX
+                   && view.scaleY == other.view.scaleY && view.offsetX == other.view.offsetX
+                   && view.offsetY == other.view.offsetY
+                   && viewport.width == other.viewport.width
+                   && viewport.height == other.viewport.height
+                   && viewportOffset.x == other.viewportOffset.x
+                   && viewportOffset.y == other.viewportOffset.y;
+        }
+
+        // Equal apart from the view, which the single view reads from its quad buffer
+        bool sameCommands(const RecordedFrame &other) const
+        {
+            return generation == other.generation && overlayGeneration == other.overlayGeneration
+                   && vertexBuffer == other.vertexBuffer && indexCount == other.indexCount
+                   && descriptorSet == other.descriptorSet;
+        }
     };
 
-    const int MAX_FRAMES_IN_FLIGHT = 2;
+    // Sync objects and tile vertex buffers exist for this many frames, the present profile
+    // cycles through m_framesInFlight of them
+    const uint32_t MAX_FRAMES_IN_FLIGHT = 3;
+
+    const uint32_t TILE_SIZE = 256;
+    const uint32_t MAX_TILE_QUADS = 1024;
+    const uint32_t MAX_TILE_UPLOADS_PER_FRAME = 16;
+    // One tile batch fills a staging buffer while the previous one is still being copied
+    const uint32_t TILE_STAGING_BUFFERS = 2;
+    const VkDeviceSize TILED_MODE_THRESHOLD = VkDeviceSize(512) << 20;
+    const VkDeviceSize MAX_CACHE_READBACK_BYTES = VkDeviceSize(256) << 20;
 
     const std::vector<const char *> validationLayers = {"VK_LAYER_KHRONOS_validation"};
 
     const std::vector<const char *> deviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 
+    // The instance can query and enable features of device extensions
+    bool m_physicalDeviceProperties2 = false;
+
     const std::vector<Vertex> vertices = {{{-1.0f, -1.0f}, {0.0f, 0.0f}},
                                           {{1.0f, -1.0f}, {1.0f, 0.0f}},
                                           {{1.0f, 1.0f}, {1.0f, 1.0f}},
@@ -124,15 +290,36 @@ class VulkanWindow : public QWindow
     const std::vector<uint16_t> indices = {0, 1, 2, 2, 3, 0};
 
 public:
-    VulkanWindow();
+    // Command line settings, an output file renders a single frame offscreen instead of
+    // opening a window
+    struct Options
+    {
+        QString imageName;
+        QString outputFile;
+        QSize outputSize{800, 600};
+        float zoom = 1;
+        QPoint pan;
+        // Opened in windows of their own once this one has set up the device they share
+        QStringList windowImages;
+        // Shown side by side in this window with one zoom and pan, imageName first
+        QStringList gridImages;
+    };
+
+    explicit VulkanWindow(const Options &options);
+
+    // Rolling GPU timings, empty until the profiled work has completed at least once
+    GpuProfiler::ScopeStats gpuStats(GpuScope scope) const;
 
 protected:
     bool event(QEvent *e) override;
 
 private:
+    Options m_options;
+    // No surface or swapchain, frames go to m_offscreenImage and are read back to a file
+    bool m_offscreen = false;
     bool m_vulkanInitDone = false;
     bool m_mousePressed = false;
-    UniformBufferObject m_dynamicParameters;
+    ViewTransform m_dynamicParameters;
     QPoint m_panStart;
     int32_t m_mipLevels;
     VkExtent2D m_viewport;
@@ -146,65 +333,238 @@ private:
     float m_normOffsetX;
     float m_normOffsetY;
 
-    VkInstance m_instance;
-    VkDebugUtilsMessengerEXT m_debugMessenger;
-    VkSurfaceKHR m_surface;
-
-    VkPhysicalDevice m_physicalDevice = VK_NULL_HANDLE;
-    VkDevice m_device;
+    // Owns the instance, device, queues, allocator, pipelines, layouts, sampler and browsed
+    // textures, the first window creates them in it and every window reads them from it
+    std::shared_ptr<RenderContext> m_context;
+    // Opened from another window, deleted when closed
+    bool m_deleteOnClose = false;
 
-    VkRenderPass m_renderPass;
-    VkDescriptorSetLayout m_descriptorSetLayout;
-    VkPipelineLayout m_pipelineLayout;
-    VkPipeline m_graphicsPipeline;
+    VkSurfaceKHR m_surface = VK_NULL_HANDLE;
 
-    VkQueue m_graphicsQueue;
-    VkQueue m_presentQueue;
+    std::unique_ptr<GpuProfiler> m_gpuProfiler;
+    // Written by the pipeline threads, read once they are joined
+    double m_graphicsPipelineMs = 0;
+    double m_mipPipelineMs = 0;
 
-    VkSwapchainKHR m_swapChain;
+    VkSwapchainKHR m_swapChain = VK_NULL_HANDLE;
     std::vector<VkImage> m_swapChainImages;
-    VkFormat m_swapChainImageFormat;
     VkExtent2D m_swapChainExtent;
     std::vector<VkImageView> m_swapChainImageViews;
     std::vector<VkFramebuffer> m_swapChainFramebuffers;
 
+    // A swapchain replaced by a resize, with what frames recorded for it may still use. It is
+    // destroyed once the last frame submitted before the replacement has completed.
+    struct RetiredSwapChain
+    {
+        VkSwapchainKHR swapChain;
+        std::vector<VkImageView> imageViews;
+        std::vector<VkFramebuffer> framebuffers;
+        std::vector<VkCommandBuffer> commandBuffers;
+        std::vector<uint32_t> querySets;
+        VkBuffer viewQuadBuffer;
+        DeviceAllocation viewQuadBufferMemory;
+        uint64_t frameSerial;
+    };
+    std::vector<RetiredSwapChain> m_retiredSwapChains;
+
+    // The single view's quad per swapchain image, already transformed and clipped to the
+    // viewport. Pan and zoom only rewrite it, the recorded command buffers are replayed.
+    VkBuffer m_viewQuadBuffer = VK_NULL_HANDLE;
+    DeviceAllocation m_viewQuadBufferMemory;
+
+    VkImage m_offscreenImage = VK_NULL_HANDLE;
+    DeviceAllocation m_offscreenImageMemory;
+    VkBuffer m_readbackBuffer = VK_NULL_HANDLE;
+    DeviceAllocation m_readbackBufferMemory;
+    std::future<bool> m_outputWrite;
+
     VkCommandPool m_commandPool;
+    VkCommandPool m_transferCommandPool = VK_NULL_HANDLE;
 
     VkImage m_textureImage;
-    VkDeviceMemory m_textureImageMemory;
+    DeviceAllocation m_textureImageMemory;
     VkImageView m_textureImageView;
-    VkSampler m_textureSampler;
 
     VkBuffer m_vertexBuffer;
-    VkDeviceMemory m_vertexBufferMemory;
+    DeviceAllocation m_vertexBufferMemory;
     VkBuffer m_indexBuffer;
-    VkDeviceMemory m_indexBufferMemory;
-
-    std::vector<VkBuffer> m_uniformBuffers;
-    std::vector<VkDeviceMemory> m_uniformBuffersMemory;
-    std::vector<void *> m_uniformBuffersMapped;
+    DeviceAllocation m_indexBufferMemory;
+
+
+    MipFilter m_mipFilter = MipFilter::Blit;
+    // BMP pixel data is converted on the GPU when the compute mip path is in use
+    bool m_gpuConvert = false;
+    VkDeviceSize m_maxStorageBufferRange = 0;
+    Compression m_compression = Compression::None;
+    const BcQuality m_bcQuality = requestedBcQuality();
+    std::unique_ptr<ThreadPool> m_threadPool;
+
+    TextureCache m_textureCache;
+    std::vector<PendingCacheWrite> m_pendingCacheWrites;
+    // Mip chains made on the GPU are only read back into the cache with
+    // VIV_TEXTURE_CACHE_READBACK=1, and only up to MAX_CACHE_READBACK_BYTES. The copy holds a
+    // host visible buffer of the whole chain until the entry is written.
+    bool m_cacheReadback = false;
+
+    // Startup work running on other threads, joined where the result is first needed
+    std::future<std::unique_ptr<TextureSource>> m_textureSource;
+    PendingTexture m_pendingTexture;
+    std::future<void> m_mipPipelineReady;
+
+    // Next and previous image in the directory of the opened one, not in tiled or offscreen
+    // mode. The current image and its neighbours are loaded ahead into m_gpuTextures, which
+    // m_context shares with the other windows.
+    GpuTextureCache *m_gpuTextures = nullptr;
+    uint64_t m_texturesDestroyedGeneration = 0;
+    ResidentTexture *m_displayedTexture = nullptr;
+    QString m_displayedImage;
+    ImageBrowser m_browser;
+    std::vector<std::unique_ptr<TextureLoad>> m_textureLoads;
+    bool m_textureLoadPollPending = false;
 
     VkDescriptorPool m_descriptorPool;
-    std::vector<VkDescriptorSet> m_descriptorSets;
+    VkDescriptorSet m_descriptorSet;
+
+    // Empty unless Options::gridImages asked for a grid the device can draw
+    GridView m_grid;
+
+    bool m_tiledMode = false;
+    std::unique_ptr<TileSource> m_tileSource;
+    std::unique_ptr<TileCache> m_tileCache;
+    std::unique_ptr<TileLoader> m_tileLoader;
+    uint32_t m_tileAtlasSize;
+    uint64_t m_tileFrame = 0;
+    uint32_t m_tileIndexCount = 0;
 
+    std::vector<VkBuffer> m_tileStagingBuffers;
+    std::vector<DeviceAllocation> m_tileStagingBuffersMemory;
+    // Upload serial that last read each staging buffer
+    std::vector<uint64_t> m_tileStagingSerials;
+    uint32_t m_tileStagingIndex = 0;
+
+    std::vector<VkBuffer> m_tileVertexBuffers;
+    std::vector<DeviceAllocation> m_tileVertexBuffersMemory;
+
+    VkBuffer m_tileIndexBuffer;
+    DeviceAllocation m_tileIndexBufferMemory;
+
+    // Created with the command pools, everything this window uploads is batched in it
+    std::unique_ptr<UploadQueue> m_uploads;
+
+    // One per swapchain image, re-recorded only when what it would draw has changed
     std::vector<VkCommandBuffer> m_commandBuffers;
+    std::vector<RecordedFrame> m_recordedFrames;
+    std::vector<VkFence> m_imagesInFlight;
+    std::vector<uint32_t> m_frameQuerySets;
+    uint64_t m_pipelineGeneration = 1;
+    bool m_alwaysRecord = false;
 
     std::vector<VkSemaphore> m_imageAvailableSemaphores;
     std::vector<VkSemaphore> m_renderFinishedSemaphores;
     std::vector<VkFence> m_inFlightFences;
     uint32_t m_currentFrame = 0;
+    PresentProfile m_presentProfile = PresentProfile::TearFree;
+    uint32_t m_framesInFlight = 2;
+    VkPresentModeKHR m_presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    // Serial of the last frame submitted with each in flight fence, every frame up to
+    // m_completedFrameSerial has finished on the GPU
+    std::vector<uint64_t> m_frameSlotSerials;
+    uint64_t m_frameSerial = 0;
+    uint64_t m_completedFrameSerial = 0;
 
     bool m_framebufferResized = false;
+
+    QElapsedTimer m_startupTimer;
+    bool m_firstFramePresented = false;
+    const char *m_textureDecoder = "";
+    VkFormat m_textureFormat = VK_FORMAT_R8G8B8A8_SRGB;
+
+    // Input only changes the view and marks it dirty, frames are drawn on UpdateRequest
+    bool m_redrawPending = false;
+    // Set by every redraw that is not input: the view state cannot tell that tiles arrived or
+    // the swapchain was rebuilt. Without it a frame whose state matches the last present is
+    // skipped.
+    bool m_frameDamaged = false;
+    // What the window shows, reset by an expose since uncovered pixels may be lost
+    RecordedFrame m_presentedFrame;
+    QElapsedTimer m_inputTimer;
+    QElapsedTimer m_presentTimer;
+    double m_redrawRequestedMs = 0;
+
+    struct FrameStats
+    {
+        uint64_t frames = 0;
+        uint64_t inputEvents = 0;
+        uint64_t droppedFrames = 0;
+        uint64_t latencySamples = 0;
+        double latencySumMs = 0;
+        double latencyMaxMs = 0;
+        uint64_t recordedFrames = 0;
+        uint64_t partialFrames = 0;
+        uint64_t replayedViewChanges = 0;
+        double cpuSumUs = 0;
+        double recordSumUs = 0;
+    };
+    FrameStats m_frameStats;
+
+    // Input to present latency of each present profile, the last LATENCY_HISTORY samples are
+    // kept for percentiles
+    struct LatencyStats
+    {
+        uint64_t samples = 0;
+        double sumMs = 0;
+        double maxMs = 0;
+        std::vector<float> historyMs;
+        size_t next = 0;
+    };
+    static const size_t LATENCY_HISTORY = 4096;
+    std::array<LatencyStats, size_t(PresentProfile::Count)> m_profileLatency;
+
+    // What the viewer costs while nobody interacts with it, printed every minute with
+    // VIV_FRAME_STATS=1 even when no frame was drawn
+    struct ActivityStats
+    {
+        uint64_t wakeups = 0;
+        uint64_t drawnFrames = 0;
+        uint64_t skippedFrames = 0;
+        double gpuBusyMs = 0;
+    };
+    ActivityStats m_activityStats;
+    QElapsedTimer m_frameStatsTimer;
+    bool m_frameStatsEnabled = false;
+
+    // Redrawn a few times a second at most, so replayed frames stay replayed
+    bool m_gpuOverlay = false;
+    QElapsedTimer m_gpuOverlayTimer;
+    uint64_t m_gpuOverlayGeneration = 0;
     VkSurfaceKHR createSurface(QWindow *window, VkInstance instance);
 
     void initVulkan(const QString &imageName);
 
+    // A window after the first uses the device and everything made once per device from the
+    // shared context, and only creates its surface and GPU profiler
+    void adoptRenderContext();
+
+    // Shares m_context, filled by the first window while it set up Vulkan, with later windows
+    void shareRenderContext();
+
+    // Shows imageName in a new window on the same device, N opens one on the current image
+    void openWindow(const QString &imageName);
+
     void cleanupSwapChain();
 
+    // Waits until the GPU is done with what this window submitted, without waiting for the
+    // other windows on the device
+    void waitForSubmittedWork();
+
     void cleanup();
 
+    // Creates the new swapchain from the old one without waiting for the device, the old
+    // one is retired instead of destroyed
     void recreateSwapChain();
 
+    void retireSwapChains(bool wait);
+
     void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT &createInfo);
 
     void setupDebugMessenger();
@@ -219,6 +579,9 @@ private:
 
     void createSwapChain();
 
+    // Stands in for the swapchain with a single device local image of the requested size
+    void createOffscreenTarget();
+
     void createImageViews();
 
     void createRenderPass();
@@ -227,6 +590,68 @@ private:
 
     void createGraphicsPipeline();
 
+    // Pipeline drawing the image quad with the given shaders, the vertex input and fixed
+    // function state are the same for the single view and the grid
+    VkPipeline createImagePipeline(const QString &vertShader,
+                                   const QString &fragShader,
+                                   VkPipelineLayout layout);
+
+    void createGridPipeline();
+
+    // Keeps the grid when the device and the build can draw it and the opened image fits a
+    // single texture, otherwise each image gets a window of its own
+    void chooseGridView(bool sharedContext);
+
+    // Shows the grid once all images are resident or have failed to load
+    void updateGrid();
+
+    // The filter asked for with VIV_MIP_FILTER, before checking what the device supports
+    static MipFilter requestedMipFilter();
+
+    // Picks the mip filter from VIV_MIP_FILTER, staying on blits when the device or the build
+    // cannot run the compute shader, and on the CPU when the device cannot blit the texture
+    // format either
+    void chooseMipFilter();
+
+    // VIV_COMPRESS=bc1|bc7|auto stores textures block compressed, VIV_COMPRESS_QUALITY picks
+    // the encoder preset: fast, normal or high
+    static Compression requestedCompression();
+    static BcQuality requestedBcQuality();
+
+    // VIV_PRESENT=low-latency|power-saving|tear-free picks the starting profile,
+    // VIV_FRAMES_IN_FLIGHT overrides the frames in flight of every profile
+    static PresentProfile requestedPresentProfile();
+    void choosePresentProfile(PresentProfile profile);
+
+    // Switches to the next profile on P, printing the latency measured with the last one
+    void cyclePresentProfile();
+    void reportPresentProfile(PresentProfile profile) const;
+
+    // Drops the requested compression when the device cannot sample its formats
+    void chooseCompression();
+
+    // Builds the compute pipeline for a shader filter, and the conversion pipeline with it,
+    // thread safe against the rest of init
+    void createMipPipeline();
+    void createConvertPipeline();
+
+    // The shader's format for the BMP's stored pixels, or -1 when only the CPU decodes it
+    static int32_t convertFormat(const BmpReader &bmp);
+
+    // Fills level 0 from the raw pixel data in buffer and leaves every level in
+    // TRANSFER_DST_OPTIMAL, ready for generateMipmapsCompute
+    void convertOnGpu(VkImage image,
+                      VkBuffer buffer,
+                      const ConvertPushConstants &constants,
+                      uint32_t mipLevels);
+
+    // Expects every level in TRANSFER_DST_OPTIMAL with level 0 filled, leaves them all in
+    // SHADER_READ_ONLY_OPTIMAL
+    void generateMipmapsCompute(VkImage image,
+                                int32_t texWidth,
+                                int32_t texHeight,
+                                uint32_t mipLevels);
+
     void createFramebuffers();
 
     void createCommandPool();
@@ -236,12 +661,64 @@ private:
                            uint32_t viewportWidth,
                            uint32_t viewportHeight);
 
+    // What zoom and pan work in, one grid cell or the whole swapchain
+    VkExtent2D viewExtent() const;
+
     void imagePan(int32_t dY, int32_t dX);
 
     void onZoomToPixel(float cursorX, float cursorY, bool zoomIn);
 
+    // Zoom and pan given on the command line, zoom snaps to the steps of the mouse wheel
+    void applyStartupView();
+
+    // Runs on a worker, needs no Vulkan object
+    std::unique_ptr<TextureSource> openTextureSource(const QString &imageName,
+                                                     MipFilter filter,
+                                                     Compression compression);
+
+    // Joins the startup source and starts filling its staging
+    void startTextureFill(const QString &imageName);
+
+    // Creates the staging buffer for texture.source and fills it on the thread pool
+    void beginTextureFill(PendingTexture &texture);
+
+    // Waits for the fill and records the upload and mip generation into the upload batch,
+    // the texture has no view or descriptor set yet
+    ResidentTexture uploadTexture(PendingTexture &texture);
+
     void createTextureImage(const QString &imageName);
 
+    // Lists the images next to the opened one and hands its texture to m_gpuTextures
+    void initBrowsing(const QString &imageName);
+
+    // Moves the browser and shows its current image, or loads it and shows it when done
+    void showImage(int index);
+
+    void displayTexture(const QString &fileName, ResidentTexture &texture);
+
+    // Starts loading an image that is neither resident nor already loading
+    void requestTextureLoad(const QString &fileName);
+
+    // Moves loads along, records uploads for the filled ones and shows the wanted image
+    void pollTextureLoads();
+
+    void destroyTextureLoad(TextureLoad &load);
+
+    // maxDimension is the device limit, images past it have to be tiled
+    bool useTiledMode(const QString &imageName, uint32_t maxDimension) const;
+
+    void createTiledTexture(const QString &imageName);
+
+    void createTileBuffers();
+
+    void updateTiles();
+
+    std::vector<TileKey> visibleTiles();
+
+    void uploadLoadedTiles();
+
+    void buildTileGeometry(const std::vector<TileKey> &visible);
+
     void generateMipmaps(VkImage image,
                          VkFormat imageFormat,
                          int32_t texWidth,
@@ -262,7 +739,8 @@ private:
                      VkImageUsageFlags usage,
                      VkMemoryPropertyFlags properties,
                      VkImage &image,
-                     VkDeviceMemory &imageMemory);
+                     DeviceAllocation &imageMemory,
+                     VkImageCreateFlags flags = 0);
 
     void transitionImageLayout(VkImage image,
                                VkFormat format,
@@ -270,47 +748,114 @@ private:
                                VkImageLayout newLayout,
                                uint32_t mipLevels);
 
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
+    // One region per entry of levels, all read from the same buffer
+    void copyBufferToImage(VkCommandBuffer commandBuffer,
+                           VkBuffer buffer,
+                           VkImage image,
+                           const std::vector<MipLevel> &levels);
 
     void createVertexBuffer();
 
     void createIndexBuffer();
 
-    void createUniformBuffers();
-
     void createDescriptorPool();
 
     void createDescriptorSets();
 
+    // One pool per texture, so an evicted texture takes its set along
+    VkDescriptorPool createTextureDescriptorPool();
+
+    VkDescriptorSet createTextureDescriptorSet(VkDescriptorPool pool, VkImageView imageView);
+
     void createBuffer(VkDeviceSize size,
                       VkBufferUsageFlags usage,
                       VkMemoryPropertyFlags properties,
                       VkBuffer &buffer,
-                      VkDeviceMemory &bufferMemory);
+                      DeviceAllocation &bufferMemory);
+
+    // Copies the given levels on the transfer queue and hands the image over to the graphics
+    // queue, leaving every level in TRANSFER_DST_OPTIMAL
+    void copyToImageOnTransferQueue(VkBuffer buffer,
+                                    VkImage image,
+                                    const std::vector<MipLevel> &levels,
+                                    uint32_t mipLevels);
 
-    VkCommandBuffer beginSingleTimeCommands();
+    // Retires completed upload batches and then the texture cache writes waiting for them
+    void retireUploads(bool wait);
 
-    void endSingleTimeCommands(VkCommandBuffer commandBuffer);
+    // Takes over buffer, which must hold the whole chain in the mipChainLayout layout by the
+    // time the batch being recorded completes
+    void storeInTextureCache(const QString &key,
+                             VkBuffer buffer,
+                             DeviceAllocation &memory,
+                             const std::vector<MipLevel> &levels,
+                             uint32_t blockBytes);
+
+    // Copies every level of a SHADER_READ_ONLY_OPTIMAL image back for the texture cache
+    void readBackForTextureCache(const QString &key,
+                                 VkImage image,
+                                 const std::vector<MipLevel> &levels);
+
+    void retireTextureCacheWrites(bool wait);
+
+    static const char *mipFilterName(MipFilter filter);
+    static const char *compressionName(Compression compression);
+    static const char *presentProfileName(PresentProfile profile);
 
     void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
 
     uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
 
+    // Also reallocates them for a recreated swapchain
     void createCommandBuffers();
 
-    void recordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+    RecordedFrame currentFrameState() const;
 
-    void createSyncObjects();
+    // Only damage is cleared and drawn, the rest of the image keeps what it was last
+    // recorded with. Damage covering the whole extent records a plain full frame.
+    void recordCommandBuffer(VkCommandBuffer commandBuffer,
+                             uint32_t imageIndex,
+                             const VkRect2D &damage);
 
-    void updateUniformBuffer(uint32_t currentImage);
+    // The part of the frame that differs between two recorded states. Only the image quad
+    // and the overlay change, so this is their old and new bounds, or everything when the
+    // states cannot be compared. A pan of an image covering the window damages all of it:
+    // every pixel moves, and earlier frames cannot be read back from the swapchain to scroll.
+    VkRect2D frameDamage(const RecordedFrame &before, const RecordedFrame &after) const;
+
+    // One bar per GPU scope in the top left corner, cleared into the current render pass
+    void drawGpuOverlay(VkCommandBuffer commandBuffer, const VkRect2D &renderArea);
+
+    // The opened image through m_viewport, or the tiles in tiled mode
+    void drawView(VkCommandBuffer commandBuffer, uint32_t imageIndex, const RecordedFrame &frame);
+    bool viewInQuadBuffer() const;
+    void writeViewQuad(uint32_t imageIndex);
+
+    void createSyncObjects();
 
     void drawFrame();
 
+    // Renders the view once, retrying until every visible tile is resident in tiled mode
+    void renderOffscreen();
+
+    // Polls the readback and the file write, then shuts down with the exit status
+    void readBackOffscreen();
+
+    // Coalesces redraws into a single UpdateRequest, fromInput starts the latency clock.
+    // Input that leaves the view state as presented draws nothing.
+    void scheduleRedraw(bool fromInput);
+
+    void reportActivity();
+
+    // Input to present latency, and refresh intervals missed while redraws kept coming
+    void recordFramePresented();
+
     VkShaderModule createShaderModule(const std::vector<char> &code);
 
     VkSurfaceFormatKHR chooseSwapSurfaceFormat(
         const std::vector<VkSurfaceFormatKHR> &availableFormats);
 
+    // The first mode of the present profile's preference list that the surface supports
     VkPresentModeKHR chooseSwapPresentMode(
         const std::vector<VkPresentModeKHR> &availablePresentModes);
 